@@ -1,8 +1,26 @@
-from amio.audio_clip import AudioClip, InputAudioChunk
+from amio.audio_clip import (
+    AudioClip,
+    ClipStoreStats,
+    InputAudioChunk,
+    OVERVIEW_DTYPE,
+    SAMPLE_FORMAT_FLOAT32,
+    SAMPLE_FORMAT_INT16,
+    SAMPLE_FORMAT_INT24,
+    get_clip_store_stats,
+    set_clip_memory_budget,
+)
 from amio.fader import factor_to_dB, dB_to_factor, Fader
-from amio.playspec import Playspec, PlayspecEntry
+from amio.playspec import (
+    FADE_CURVE_EQUAL_POWER,
+    FADE_CURVE_LINEAR,
+    FADE_CURVE_SMOOTH,
+    PackedPlayspec,
+    Playspec,
+    PlayspecEntry,
+    PlayspecPatch,
+)
 
-from amio.interface import Interface
+from amio.interface import Interface, TransportSnapshot
 from amio.dummy_interface import DummyInterface
 from amio.native_interface import NativeInterface
 from amio.null_interface import NullInterface
@@ -17,6 +35,6 @@ def create_io_interface(driver: str = "jack", **kwargs) -> Interface:
     elif driver == "null":
         return NullInterface(**kwargs)
     elif driver == "jack":
-        return NativeInterface()
+        return NativeInterface(**kwargs)
     else:
         raise NotImplementedError("No such AMIO driver")
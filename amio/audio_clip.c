@@ -1,14 +1,24 @@
 #include "audio_clip.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "clip_store.h"
+#include "gc.h"
 #include "interface.h"
 #include "pool.h"
+#include "resampler.h"
+#include "stream.h"
 
 #define MAX_AUDIO_CLIPS 1024
 
+/* Largest number of threads resampling a clip, including the Python thread */
+#define MAX_RESAMPLING_THREADS 8
+
 static struct Pool *pool;
+static int num_clips;
 
 static void ensure_pool_initialized()
 {
@@ -24,7 +34,32 @@ struct AudioClip * get_audio_clip_by_id(int id)
     return pool_find(pool, id);
 }
 
-int AudioClip_init(char *bytes, int n, int channels, float framerate)
+/* Converts samples passed from Python into the storage format of a clip */
+typedef void (*ConvertFunction)(
+    int format, void *dst, const void *src, int samples);
+
+static void copy_int16(int format, void *dst, const void *src, int samples)
+{
+    /* Only clips in the 16-bit format are uploaded from 16-bit samples */
+    (void)format;
+
+    memcpy(dst, src, samples * sizeof(int16_t));
+}
+
+static void convert_float32(
+    int format, void *dst, const void *src, int samples)
+{
+    mixer_convert_float32(format, dst, src, samples);
+}
+
+static void convert_float64(
+    int format, void *dst, const void *src, int samples)
+{
+    mixer_convert_float64(format, dst, src, samples);
+}
+
+static struct AudioClip * create_audio_clip(
+    int64_t length, int channels, float framerate, int format)
 {
     /* Runs on the Python thread */
 
@@ -34,14 +69,534 @@ int AudioClip_init(char *bytes, int n, int channels, float framerate)
     result = malloc(sizeof(struct AudioClip));
     result->id = pool_put(pool, result);
     result->referenced_by_python = true;
-    result->length = n / (sizeof(int16_t) * channels);
+    result->length = length;
     result->channels = channels;
     result->framerate = framerate;
-    result->data = malloc(n);
-    memcpy(result->data, bytes, n);
+    result->format = format;
+    result->num_blocks = (length + CLIP_BLOCK_FRAMES - 1) / CLIP_BLOCK_FRAMES;
+    result->blocks = calloc(result->num_blocks, sizeof(struct ClipData *));
+    result->stream = NULL;
+    result->granule_peaks = calloc(
+        (length + CLIP_GRANULE_FRAMES - 1) / CLIP_GRANULE_FRAMES,
+        sizeof(float));
+    result->overview = overview_create(length);
+    ++num_clips;
+    return result;
+}
+
+/* Compute the peaks of the granules overlapping the given frames */
+static void update_granule_peaks(
+    struct AudioClip *clip, int64_t frame, int64_t frames)
+{
+    /* Runs on the Python thread */
+
+    int64_t first = frame / CLIP_GRANULE_FRAMES;
+    int64_t last = (frame + frames - 1) / CLIP_GRANULE_FRAMES;
+    for (int64_t granule = first; granule <= last; ++granule) {
+        /* Granules never cross block boundaries */
+        int n;
+        const char *data = audio_clip_frame_data(
+            clip, granule * CLIP_GRANULE_FRAMES, &n);
+        if (n > CLIP_GRANULE_FRAMES)
+            n = CLIP_GRANULE_FRAMES;
+        clip->granule_peaks[granule] =
+            mixer_peak(clip->format, data, n * clip->channels);
+    }
+}
+
+/* Update what the clip knows about its samples after frames were stored */
+static void update_summaries(
+    struct AudioClip *clip, int64_t frame, int64_t frames)
+{
+    /* Runs on the Python thread */
+
+    if (frames <= 0)
+        return;
+
+    update_granule_peaks(clip, frame, frames);
+    overview_update(clip->overview, clip, frame, frames);
+}
+
+/*
+ * Store frames [frame, frame + frames) of the clip, converted from src,
+ * replacing the blocks they overlap. The frames of those blocks that aren't
+ * replaced keep their previous data.
+ */
+static void write_frames(
+    struct AudioClip *clip,
+    int64_t frame,
+    int64_t frames,
+    const char *src,
+    int src_frame_size,
+    ConvertFunction convert)
+{
+    /* Runs on the Python thread */
+
+    int frame_size = audio_clip_frame_size(clip);
+    int64_t first_frame = frame;
+    int64_t num_frames = frames;
+
+    while (frames > 0) {
+        int block = frame / CLIP_BLOCK_FRAMES;
+        int frame_in_block = frame % CLIP_BLOCK_FRAMES;
+        int block_frames = audio_clip_block_frames(clip, block);
+        int n = block_frames - frame_in_block;
+        if (n > frames)
+            n = frames;
+
+        struct ClipData *old_block = clip->blocks[block];
+        size_t size = (size_t)block_frames * frame_size;
+
+        if (n == block_frames && convert == copy_int16) {
+            /* Not copied if there is an identical block already */
+            clip->blocks[block] = clip_store_add_copy(src, size);
+        } else {
+            char *bytes = malloc(size);
+            if (n < block_frames) {
+                clip_store_page_in(old_block);
+                memcpy(bytes, old_block->bytes, size);
+            }
+            convert(
+                clip->format, bytes + frame_in_block * frame_size, src,
+                n * clip->channels);
+            clip->blocks[block] = clip_store_add(bytes, size);
+        }
+
+        if (old_block)
+            clip_store_release(old_block);
+
+        src += n * src_frame_size;
+        frame += n;
+        frames -= n;
+    }
+
+    update_summaries(clip, first_frame, num_frames);
+}
+
+static int init_from_samples(
+    char *samples,
+    int64_t n,
+    int channels,
+    float framerate,
+    int format,
+    int sample_size,
+    ConvertFunction convert)
+{
+    /* Runs on the Python thread */
+
+    if (channels < 1 || n % (sample_size * channels) != 0)
+        return -1;
+    if (format < 0 || format >= NUM_SAMPLE_FORMATS)
+        return -1;
+
+    int64_t length = n / (sample_size * channels);
+    struct AudioClip *result = create_audio_clip(
+        length, channels, framerate, format);
+    write_frames(result, 0, length, samples, sample_size * channels, convert);
+    gc_enforce_clip_memory_budget();
     return result->id;
 }
 
+int AudioClip_init(char *samples, long long n, int channels, float framerate)
+{
+    /* Runs on the Python thread */
+
+    return init_from_samples(
+        samples, n, channels, framerate, SAMPLE_FORMAT_INT16,
+        sizeof(int16_t), copy_int16);
+}
+
+int AudioClip_init_from_float32(
+    char *samples, long long n, int channels, float framerate, int format)
+{
+    /* Runs on the Python thread */
+
+    return init_from_samples(
+        samples, n, channels, framerate, format,
+        sizeof(float), convert_float32);
+}
+
+int AudioClip_init_from_float64(
+    char *samples, long long n, int channels, float framerate, int format)
+{
+    /* Runs on the Python thread */
+
+    return init_from_samples(
+        samples, n, channels, framerate, format,
+        sizeof(double), convert_float64);
+}
+
+int AudioClip_init_silent(
+    long long length, int channels, float framerate, int format)
+{
+    /* Runs on the Python thread */
+
+    if (length < 0 || channels < 1)
+        return -1;
+    if (format < 0 || format >= NUM_SAMPLE_FORMATS)
+        return -1;
+
+    struct AudioClip *result = create_audio_clip(
+        length, channels, framerate, format);
+    for (int i = 0; i < result->num_blocks; ++i) {
+        size_t size =
+            (size_t)audio_clip_block_frames(result, i) * channels
+            * sample_format_size(format);
+        result->blocks[i] = clip_store_add(calloc(size, 1), size);
+    }
+    gc_enforce_clip_memory_budget();
+    return result->id;
+}
+
+int AudioClip_init_streaming(
+    const char *path,
+    long long data_offset,
+    long long length,
+    int channels,
+    float framerate,
+    int format)
+{
+    /* Runs on the Python thread */
+
+    if (data_offset < 0 || length < 0 || channels < 1)
+        return -1;
+    if (format < 0 || format >= NUM_SAMPLE_FORMATS)
+        return -1;
+
+    struct AudioClip *result = create_audio_clip(
+        length, channels, framerate, format);
+    free(result->granule_peaks);
+    result->granule_peaks = NULL;
+    overview_destroy(result->overview);
+    result->overview = NULL;
+    if (!stream_open(result, path, data_offset)) {
+        destroy_audio_clip(result->id);
+        return -1;
+    }
+    return result->id;
+}
+
+static int init_updated(
+    int clip_id,
+    long long frame,
+    char *samples,
+    int64_t n,
+    int sample_size,
+    ConvertFunction convert)
+{
+    /* Runs on the Python thread */
+
+    /* Streaming clips are read-only */
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip || clip->stream)
+        return -1;
+
+    int src_frame_size = sample_size * clip->channels;
+    if (n % src_frame_size != 0)
+        return -1;
+
+    int64_t frames = n / src_frame_size;
+    if (frame < 0 || frame + frames > clip->length)
+        return -1;
+
+    struct AudioClip *result = create_audio_clip(
+        clip->length, clip->channels, clip->framerate, clip->format);
+    for (int i = 0; i < result->num_blocks; ++i) {
+        result->blocks[i] = clip->blocks[i];
+        clip_store_retain(result->blocks[i]);
+    }
+    memcpy(result->granule_peaks, clip->granule_peaks,
+        (clip->length + CLIP_GRANULE_FRAMES - 1) / CLIP_GRANULE_FRAMES
+            * sizeof(float));
+    overview_copy(result->overview, clip->overview);
+    write_frames(result, frame, frames, samples, src_frame_size, convert);
+    gc_enforce_clip_memory_budget();
+    return result->id;
+}
+
+int AudioClip_init_updated_from_float32(
+    int clip_id, long long frame, char *samples, long long n)
+{
+    /* Runs on the Python thread */
+
+    return init_updated(
+        clip_id, frame, samples, n, sizeof(float), convert_float32);
+}
+
+int AudioClip_init_updated_from_float64(
+    int clip_id, long long frame, char *samples, long long n)
+{
+    /* Runs on the Python thread */
+
+    return init_updated(
+        clip_id, frame, samples, n, sizeof(double), convert_float64);
+}
+
+/* Blocks of a new clip resampled from another one by several threads */
+struct ResamplingJob
+{
+    const struct Resampler *resampler;
+    const struct AudioClip *source;
+    const struct AudioClip *clip;
+
+    /* Converted samples of every block of the clip */
+    char **block_bytes;
+
+    /* Next block to be resampled by any of the threads */
+    int next_block;
+};
+
+static void * resample_blocks(void *arg)
+{
+    /* Runs on a resampling thread or the Python thread */
+
+    struct ResamplingJob *job = arg;
+    const struct AudioClip *clip = job->clip;
+    float *samples = malloc(
+        (size_t)CLIP_BLOCK_FRAMES * clip->channels * sizeof(float));
+
+    for (;;) {
+        int block = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_RELAXED);
+        if (block >= clip->num_blocks)
+            break;
+
+        int frames = audio_clip_block_frames(clip, block);
+        resampler_process_clip(
+            job->resampler, job->source, (int64_t)block * CLIP_BLOCK_FRAMES,
+            frames, samples);
+
+        char *bytes = malloc((size_t)frames * audio_clip_frame_size(clip));
+        mixer_convert_float32(
+            clip->format, bytes, samples, frames * clip->channels);
+        job->block_bytes[block] = bytes;
+    }
+
+    free(samples);
+    return NULL;
+}
+
+int AudioClip_init_resampled(int clip_id, float framerate)
+{
+    /* Runs on the Python thread */
+
+    /* Streaming clips aren't in memory */
+    struct AudioClip *source = get_audio_clip_by_id(clip_id);
+    if (!source || source->stream)
+        return -1;
+
+    struct Resampler resampler;
+    if (!resampler_create(&resampler, source->framerate, framerate))
+        return -1;
+
+    /* The resampling threads can't read spilled blocks back */
+    audio_clip_page_in(source);
+
+    struct AudioClip *result = create_audio_clip(
+        resampler_output_length(&resampler, source->length),
+        source->channels, framerate, source->format);
+
+    struct ResamplingJob job;
+    job.resampler = &resampler;
+    job.source = source;
+    job.clip = result;
+    job.block_bytes = calloc(result->num_blocks, sizeof(char *));
+    job.next_block = 0;
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > MAX_RESAMPLING_THREADS)
+        num_threads = MAX_RESAMPLING_THREADS;
+    if (num_threads > result->num_blocks)
+        num_threads = result->num_blocks;
+
+    /* The Python thread resamples blocks as well */
+    pthread_t threads[MAX_RESAMPLING_THREADS];
+    int num_started = 0;
+    while (num_started < num_threads - 1) {
+        if (pthread_create(
+                &threads[num_started], NULL, resample_blocks, &job) != 0)
+            break;
+        ++num_started;
+    }
+    resample_blocks(&job);
+    for (int i = 0; i < num_started; ++i)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < result->num_blocks; ++i) {
+        size_t size =
+            (size_t)audio_clip_block_frames(result, i)
+            * audio_clip_frame_size(result);
+        result->blocks[i] = clip_store_add(job.block_bytes[i], size);
+    }
+    free(job.block_bytes);
+    resampler_destroy(&resampler);
+
+    update_summaries(result, 0, result->length);
+    gc_enforce_clip_memory_budget();
+    return result->id;
+}
+
+long long AudioClip_get_data_size(int clip_id)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip)
+        return -1;
+
+    return clip->length * audio_clip_frame_size(clip);
+}
+
+long long AudioClip_get_shared_data_size(int clip_id)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip)
+        return -1;
+
+    /* Blocks of streaming clips are never shared */
+    long long result = 0;
+    if (clip->stream)
+        return result;
+    for (int i = 0; i < clip->num_blocks; ++i) {
+        if (clip->blocks[i]->refcount > 1)
+            result += clip->blocks[i]->size;
+    }
+    return result;
+}
+
+int AudioClip_get_stream_underruns(int clip_id)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip || !clip->stream)
+        return -1;
+
+    return __atomic_load_n(&clip->stream->underruns, __ATOMIC_RELAXED);
+}
+
+long long AudioClip_get_resident_data_size(int clip_id)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip)
+        return -1;
+
+    long long result = 0;
+    for (int i = 0; i < clip->num_blocks; ++i) {
+        /*
+         * Blocks of streaming clips may be loaded, and spilled blocks read
+         * back, concurrently
+         */
+        struct ClipData *data =
+            __atomic_load_n(&clip->blocks[i], __ATOMIC_RELAXED);
+        if (data && (clip->stream
+                || __atomic_load_n(&data->bytes, __ATOMIC_RELAXED))) {
+            result +=
+                (long long)audio_clip_block_frames(clip, i)
+                * audio_clip_frame_size(clip);
+        }
+    }
+    return result;
+}
+
+long long AudioClip_get_silent_frames(int clip_id)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip)
+        return -1;
+
+    long long result = 0;
+    for (int64_t frame = 0; frame < clip->length;) {
+        bool silent;
+        int n = audio_clip_silence_run(
+            clip, frame, clip->length - frame < CLIP_BLOCK_FRAMES
+                ? clip->length - frame : CLIP_BLOCK_FRAMES, &silent);
+        if (silent)
+            result += n;
+        frame += n;
+    }
+    return result;
+}
+
+int AudioClip_get_overview(
+    int clip_id,
+    long long start_frame,
+    int frames_per_bin,
+    char *bytearray,
+    int n)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(clip_id);
+    if (!clip || !clip->overview)
+        return -1;
+    if (start_frame < 0 || start_frame > clip->length || frames_per_bin < 1)
+        return -1;
+
+    long long remaining =
+        (clip->length - start_frame + frames_per_bin - 1) / frames_per_bin;
+    int num_points = n / sizeof(struct OverviewPoint);
+    if (num_points > remaining)
+        num_points = remaining;
+
+    overview_query(
+        clip->overview, clip, start_frame, frames_per_bin,
+        (struct OverviewPoint *)bytearray, num_points);
+
+    /* Short points may have read spilled samples back */
+    if (frames_per_bin < OVERVIEW_BASE_FRAMES)
+        gc_enforce_clip_memory_budget();
+    return num_points;
+}
+
+int AudioClip_get_num_clips()
+{
+    /* Runs on the Python thread */
+
+    return num_clips;
+}
+
+void AudioClip_set_memory_budget(
+    long long budget, const char *spill_directory)
+{
+    /* Runs on the Python thread */
+
+    clip_store_set_memory_budget(budget, spill_directory);
+    gc_enforce_clip_memory_budget();
+}
+
+void audio_clip_page_in(struct AudioClip *clip)
+{
+    /* Runs on the Python thread */
+
+    if (clip->stream)
+        return;
+
+    for (int i = 0; i < clip->num_blocks; ++i)
+        clip_store_page_in(clip->blocks[i]);
+}
+
+void audio_clip_request_page_in(struct AudioClip *clip)
+{
+    /* Runs on the Python thread */
+
+    if (clip->stream)
+        return;
+
+    bool requested = false;
+    for (int i = 0; i < clip->num_blocks; ++i) {
+        if (clip_store_request_page_in(clip->blocks[i]))
+            requested = true;
+    }
+    if (requested)
+        stream_wake_reader();
+}
+
 void AudioClip_del(int interface, int clip_id)
 {
     /* Runs on the Python thread */
@@ -62,8 +617,21 @@ void destroy_audio_clip(int audio_clip_id)
         return;
 
     pool_remove(pool, audio_clip_id);
-    free(clip->data);
+    if (clip->stream) {
+        stream_close(clip);
+    } else {
+        /* Blocks are missing if the file of a streaming clip didn't open */
+        for (int i = 0; i < clip->num_blocks; ++i) {
+            if (clip->blocks[i])
+                clip_store_release(clip->blocks[i]);
+        }
+    }
+    free(clip->blocks);
+    free(clip->granule_peaks);
+    if (clip->overview)
+        overview_destroy(clip->overview);
     free(clip);
+    --num_clips;
 }
 
 void for_each_audio_clip(void (*callback)(int audio_clip_id))
@@ -4,8 +4,24 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "clip_store.h"
 #include "communication.h"
 #include "interface.h"
+#include "mixer.h"
+#include "overview.h"
+#include "stream.h"
+
+/*
+ * Number of frames in a block of clip data. Updating a region of a clip
+ * only stores the blocks that the region overlaps anew.
+ */
+#define CLIP_BLOCK_FRAMES 65536
+
+/*
+ * Number of frames in a granule, the unit in which clips keep track
+ * of silence. The mixer skips silent granules.
+ */
+#define CLIP_GRANULE_FRAMES 256
 
 /*
  * AudioClip objects are created on the Python thread. When they are fully
@@ -32,13 +48,39 @@ struct AudioClip
 {
     int id;
 
-    int length;
+    int64_t length;
     int channels;
     int framerate;
-    int16_t *data;
+
+    /*
+     * Channel-interleaved samples in the SAMPLE_FORMAT_* format, stored
+     * in blocks of CLIP_BLOCK_FRAMES frames (the last one may be shorter).
+     * The blocks are held by the clip store, and may be shared with other
+     * clips, e.g. with the previous version of an updated clip.
+     */
+    int format;
+    int num_blocks;
+    struct ClipData **blocks;
+
+    /*
+     * File backing a streaming clip, or NULL for a clip held in memory.
+     * The blocks of a streaming clip are loaded and evicted by the stream
+     * reader thread (see stream.h), and are NULL while they aren't loaded.
+     */
+    struct ClipStream *stream;
+
+    /*
+     * Peak of every granule of the clip, as computed by mixer_peak when
+     * its samples are stored. Granules with a peak of 0.0 are silent.
+     * NULL for streaming clips, whose samples aren't known in advance.
+     */
+    float *granule_peaks;
 
     /* The following fields are only accessed from the Python thread */
 
+    /* Overview of the samples of the clip; NULL for streaming clips */
+    struct ClipOverview *overview;
+
     /*
      * Indicator whether the playspec currently in the playspec queue
      * on the I/O thread might have a reference to this clip
@@ -50,7 +92,190 @@ struct AudioClip
 
 struct AudioClip * get_audio_clip_by_id(int id);
 
-int AudioClip_init(char *bytes, int n, int channels, float framerate);
+int AudioClip_init(char *samples, long long n, int channels, float framerate);
+
+/*
+ * Create a clip from channel-interleaved float samples in the range
+ * [-1.0, 1.0], in native byte order. The samples are converted straight
+ * into the clip storage of the given SAMPLE_FORMAT_* format, in a single
+ * pass. Returns -1 if the format is unknown or the buffer size doesn't
+ * match the number of channels.
+ */
+int AudioClip_init_from_float32(
+    char *samples, long long n, int channels, float framerate, int format);
+int AudioClip_init_from_float64(
+    char *samples, long long n, int channels, float framerate, int format);
+
+/* Create a silent clip. Its blocks all share the same data. */
+int AudioClip_init_silent(
+    long long length, int channels, float framerate, int format);
+
+/*
+ * Create a new version of a clip, with the frames starting at the given
+ * frame replaced by float samples, converted like by AudioClip_init_from_*.
+ * Only the blocks that the replaced frames overlap are stored anew, the rest
+ * is shared with the original clip, which is left unchanged, so that
+ * the I/O thread can keep playing it until a playspec using the new version
+ * is applied. Returns -1 if there is no such clip or the frames are out
+ * of its bounds.
+ */
+int AudioClip_init_updated_from_float32(
+    int clip_id, long long frame, char *samples, long long n);
+int AudioClip_init_updated_from_float64(
+    int clip_id, long long frame, char *samples, long long n);
+
+/*
+ * Create a copy of a clip resampled to the given frame rate, in the same
+ * storage format (see resampler.h). Several threads resample the blocks
+ * of the copy at once. Returns -1 if there is no such clip, it's a streaming
+ * clip or the resampler doesn't support the ratio of the frame rates.
+ */
+int AudioClip_init_resampled(int clip_id, float framerate);
+
+/*
+ * Create a clip streamed from a file of channel-interleaved samples
+ * of the given SAMPLE_FORMAT_* format, in native byte order, starting
+ * at the given offset in bytes. Frames missing from the file are silent.
+ * Returns -1 if the file can't be opened or the arguments are invalid.
+ */
+int AudioClip_init_streaming(
+    const char *path,
+    long long data_offset,
+    long long length,
+    int channels,
+    float framerate,
+    int format);
+
+/*
+ * Number of times the I/O thread found a block of the streaming clip
+ * that wasn't loaded yet, or -1 if there is no such streaming clip
+ */
+int AudioClip_get_stream_underruns(int clip_id);
+
+/*
+ * Size of the data of the clip in bytes, and the size of the part of it
+ * that is shared with other clips. Both return -1 if there is no such clip.
+ */
+long long AudioClip_get_data_size(int clip_id);
+long long AudioClip_get_shared_data_size(int clip_id);
+
+/*
+ * Size of the part of the data of the clip that is in memory, rather than
+ * spilled or not loaded from the file of a streaming clip. Returns -1
+ * if there is no such clip.
+ */
+long long AudioClip_get_resident_data_size(int clip_id);
+
+/*
+ * Number of frames of the clip in silent granules, or -1 if there is no
+ * such clip
+ */
+long long AudioClip_get_silent_frames(int clip_id);
+
+/*
+ * Fill the bytearray with points of the overview of the clip
+ * (struct OverviewPoint), each of which summarizes frames_per_bin frames
+ * from start_frame on, up to the end of the clip. Returns the number
+ * of points, or -1 if there is no such clip, it's a streaming clip
+ * or the arguments are out of range.
+ */
+int AudioClip_get_overview(
+    int clip_id,
+    long long start_frame,
+    int frames_per_bin,
+    char *bytearray,
+    int n);
+
+/* Number of existing clips */
+int AudioClip_get_num_clips();
+
+/*
+ * Limit the memory taken by the data of clips to the given number of bytes
+ * (0 for no limit). The data of clips that aren't used by any playspec
+ * is spilled to a file in the given directory (TMPDIR if NULL) when needed,
+ * and read back when the clip is used in a playspec again.
+ */
+void AudioClip_set_memory_budget(
+    long long budget, const char *spill_directory);
+
+/* Read the spilled data of the clip back into memory right away */
+void audio_clip_page_in(struct AudioClip *clip);
+
+/*
+ * Have the stream reader thread read the spilled data of the clip back
+ * into memory in the background
+ */
+void audio_clip_request_page_in(struct AudioClip *clip);
+
+/* Size of a frame of the clip in bytes */
+static inline int audio_clip_frame_size(const struct AudioClip *clip)
+{
+    return clip->channels * sample_format_size(clip->format);
+}
+
+/* Number of frames in a block of the clip */
+static inline int audio_clip_block_frames(
+    const struct AudioClip *clip, int block)
+{
+    int64_t remaining = clip->length - (int64_t)block * CLIP_BLOCK_FRAMES;
+    return remaining < CLIP_BLOCK_FRAMES ? remaining : CLIP_BLOCK_FRAMES;
+}
+
+/*
+ * Sample data of the given frame of the clip, and the number of frames
+ * from there that are stored contiguously. Returns NULL if the frame
+ * belongs to a block of a streaming clip that isn't loaded, or to spilled
+ * data that isn't read back yet.
+ */
+static inline const char * audio_clip_frame_data(
+    const struct AudioClip *clip, int64_t frame, int *contiguous_frames)
+{
+    int block = frame / CLIP_BLOCK_FRAMES;
+    int frame_in_block = frame % CLIP_BLOCK_FRAMES;
+    *contiguous_frames = audio_clip_block_frames(clip, block) - frame_in_block;
+
+    /* Pairs with the stores of the stream reader thread */
+    struct ClipData *data =
+        __atomic_load_n(&clip->blocks[block], __ATOMIC_SEQ_CST);
+    if (!data)
+        return NULL;
+
+    /* Pairs with the stores of the threads reading spilled data back */
+    const char *bytes = __atomic_load_n(&data->bytes, __ATOMIC_ACQUIRE);
+    if (!bytes)
+        return NULL;
+    return bytes + frame_in_block * audio_clip_frame_size(clip);
+}
+
+/*
+ * Length of the run of frames starting at the given frame, up to
+ * max_frames, that are either all in silent granules or all in audible ones,
+ * and which of these it is
+ */
+static inline int audio_clip_silence_run(
+    const struct AudioClip *clip,
+    int64_t frame,
+    int max_frames,
+    bool *silent)
+{
+    if (!clip->granule_peaks) {
+        *silent = false;
+        return max_frames;
+    }
+
+    int64_t granule = frame / CLIP_GRANULE_FRAMES;
+    *silent = clip->granule_peaks[granule] == 0.0f;
+
+    int64_t end = frame + max_frames;
+    int64_t run_end = (granule + 1) * CLIP_GRANULE_FRAMES;
+    while (run_end < end
+            && (clip->granule_peaks[run_end / CLIP_GRANULE_FRAMES] == 0.0f)
+                == *silent)
+        run_end += CLIP_GRANULE_FRAMES;
+
+    return (run_end < end ? run_end : end) - frame;
+}
+
 void AudioClip_del(int interface, int clip_id);
 
 void destroy_audio_clip(int audio_clip_id);
@@ -2,23 +2,123 @@ from __future__ import annotations
 
 import amio._native
 from amio.fader import factor_to_dB
+from collections import namedtuple
 import datetime
 import matplotlib.pyplot as plt
 import numpy as np
 import os
 import soundfile as sf
 import struct
+import sys
 from subprocess import Popen
 from tempfile import NamedTemporaryFile
-from typing import Iterable, Optional, Tuple
+from typing import Any, Dict, Iterable, Optional, Set, Tuple, Union
+
+
+# Native storage formats of clips; must match SAMPLE_FORMAT_* in mixer.h
+SAMPLE_FORMAT_INT16 = 0
+SAMPLE_FORMAT_FLOAT32 = 1
+SAMPLE_FORMAT_INT24 = 2
+
+# Size of a sample of every format in bytes; must match sample_format_size
+SAMPLE_FORMAT_SIZES = {
+    SAMPLE_FORMAT_INT16: 2,
+    SAMPLE_FORMAT_FLOAT32: 4,
+    SAMPLE_FORMAT_INT24: 3,
+}
+
+# Point of the overview of a clip; must match struct OverviewPoint
+OVERVIEW_DTYPE = np.dtype(
+    [("min", np.float32), ("max", np.float32), ("rms", np.float32)]
+)
+
+# Largest number of overview points fetched from the native code at once
+_MAX_OVERVIEW_POINTS = 65536
+
+
+def _native_float_samples(array: np.ndarray) -> np.ndarray:
+    """
+    Return the samples as a C-contiguous float32 or float64 array in native
+    byte order, which the native code can read through the buffer protocol.
+    The array itself is returned if it's already in that form.
+    """
+    if array.dtype not in (np.float32, np.float64):
+        array = array.astype(np.float64 if array.dtype.itemsize > 4 else np.float32)
+    return np.ascontiguousarray(array)
+
+
+class WavLayout(
+    namedtuple("WavLayout", "data_offset frames channels frame_rate sample_format")
+):
+    """Where the samples of a WAV file are, and how they're stored"""
+
+
+# Format tags of the fmt chunk of a WAV file
+_WAVE_FORMAT_PCM = 1
+_WAVE_FORMAT_IEEE_FLOAT = 3
+_WAVE_FORMAT_EXTENSIBLE = 0xFFFE
+
+
+def read_wav_layout(filename: str) -> WavLayout:
+    """
+    Find the samples in a WAV file, so that it can be streamed without
+    decoding. Only 16-bit and 24-bit PCM and 32-bit float files are supported,
+    since their samples are stored like SAMPLE_FORMAT_* samples.
+    """
+    file_size = os.path.getsize(filename)
+    with open(filename, "rb") as f:
+        riff, _, wave = struct.unpack("<4sI4s", f.read(12))
+        if riff != b"RIFF" or wave != b"WAVE":
+            raise ValueError("Not a WAV file")
+        fmt = None
+        while True:
+            header = f.read(8)
+            if len(header) < 8:
+                raise ValueError("No data chunk in the WAV file")
+            chunk_id, chunk_size = struct.unpack("<4sI", header)
+            if chunk_id == b"fmt ":
+                fmt = f.read(chunk_size)
+            elif chunk_id == b"data":
+                break
+            else:
+                f.seek(chunk_size, os.SEEK_CUR)
+            # Chunks are aligned to 2 bytes
+            if chunk_size % 2:
+                f.seek(1, os.SEEK_CUR)
+        data_offset = f.tell()
+    if fmt is None or len(fmt) < 16:
+        raise ValueError("No format chunk in the WAV file")
+    format_tag, channels, frame_rate, _, _, bits = struct.unpack("<HHIIHH", fmt[:16])
+    if format_tag == _WAVE_FORMAT_EXTENSIBLE and len(fmt) >= 26:
+        (format_tag,) = struct.unpack("<H", fmt[24:26])
+    if format_tag == _WAVE_FORMAT_PCM and bits == 16:
+        sample_format = SAMPLE_FORMAT_INT16
+    elif format_tag == _WAVE_FORMAT_PCM and bits == 24:
+        sample_format = SAMPLE_FORMAT_INT24
+    elif format_tag == _WAVE_FORMAT_IEEE_FLOAT and bits == 32:
+        sample_format = SAMPLE_FORMAT_FLOAT32
+    else:
+        raise ValueError("Unsupported WAV sample format")
+    # The size of the data chunk isn't reliable in files that weren't closed
+    data_size = min(chunk_size, file_size - data_offset)
+    return WavLayout(
+        data_offset,
+        data_size // (channels * bits // 8),
+        channels,
+        frame_rate,
+        sample_format,
+    )
 
 
 class ImmutableAudioClip:
     """
     For internal AMIO use only.
 
-    An immutable clip of 16-bit native-endian channel-interleaved audio data.
-    The length is determined by the length of the data-supplying bytes object.
+    An immutable clip of native-endian channel-interleaved audio data.
+    The data is supplied either as a bytes object of 16-bit samples,
+    or as a float NumPy array of shape (length_in_frames, channel_count),
+    which is converted by the native code without intermediate copies
+    to the given storage format (one of SAMPLE_FORMAT_*).
     Sample rate is expected to be equal to the audio output sample rate.
     Objects of this class exist primarily to automate garbage collection.
     When ImmutableAudioClip is destroyed, the I/O thread is informed
@@ -28,18 +128,142 @@ class ImmutableAudioClip:
     def __init__(
         self,
         jack_client: "amio.native_interface.NativeInterface",
-        data: bytes,
+        data: Union[bytes, np.ndarray],
         channels: int,
         frame_rate: float,
+        sample_format: int = SAMPLE_FORMAT_INT16,
     ):
         if not isinstance(channels, int) or channels < 1:
             raise TypeError("Invalid number of channels (must be positive integer)")
         self.jack_client = jack_client
-        self.io_owned_clip = amio._native.AudioClip_init(data, channels, frame_rate)
+        self.io_owned_clip = -1
+        if isinstance(data, np.ndarray):
+            samples = _native_float_samples(data)
+            if samples.dtype == np.float32:
+                init = amio._native.AudioClip_init_from_float32
+            else:
+                init = amio._native.AudioClip_init_from_float64
+            self.io_owned_clip = init(samples, channels, frame_rate, sample_format)
+        else:
+            self.io_owned_clip = amio._native.AudioClip_init(data, channels, frame_rate)
+        if self.io_owned_clip < 0:
+            raise ValueError("Audio data doesn't match the number of channels")
 
     def __del__(self):
         amio._native.AudioClip_del(self.jack_client.jack_interface, self.io_owned_clip)
 
+    @property
+    def data_size(self) -> int:
+        """Size of the native data of the clip in bytes"""
+        return amio._native.AudioClip_get_data_size(self.io_owned_clip)
+
+    @property
+    def shared_data_size(self) -> int:
+        """
+        Size of the part of the native data that is shared with other clips.
+        Identical blocks of data, e.g. in clips with the same content or in
+        versions of an updated clip, are stored only once.
+        """
+        return amio._native.AudioClip_get_shared_data_size(self.io_owned_clip)
+
+    @property
+    def resident_data_size(self) -> int:
+        """
+        Size of the part of the native data that is in memory, rather than
+        spilled to disk or not loaded yet from the file of a streaming clip
+        """
+        return amio._native.AudioClip_get_resident_data_size(self.io_owned_clip)
+
+    @property
+    def silent_frames(self) -> int:
+        """
+        Number of frames of the native data in granules of silence,
+        which the mixer skips
+        """
+        return amio._native.AudioClip_get_silent_frames(self.io_owned_clip)
+
+    @property
+    def stream_underruns(self) -> int:
+        """
+        For a clip streamed from a file, the number of times its data
+        wasn't loaded in time for playback; -1 for other clips
+        """
+        return amio._native.AudioClip_get_stream_underruns(self.io_owned_clip)
+
+    def get_overview(
+        self,
+        frames_per_point: int,
+        start_frame: int = 0,
+        num_points: Optional[int] = None,
+    ) -> np.ndarray:
+        """
+        Summarize the native data for drawing a waveform. Return an array
+        of OVERVIEW_DTYPE, where every point holds the smallest and the largest
+        sample and the RMS of frames_per_point frames (over all channels),
+        from start_frame up to the end of the clip or num_points points.
+        The points are served from a pyramid of summaries kept along with
+        the native data, so the cost depends on the number of points rather
+        than the number of frames. Points of at least 64 frames cover the whole
+        bins of the pyramid they overlap, so they may reach a bit further.
+        """
+        chunks = []
+        while num_points is None or num_points > 0:
+            count = _MAX_OVERVIEW_POINTS
+            if num_points is not None:
+                count = min(count, num_points)
+            arr = bytearray(OVERVIEW_DTYPE.itemsize * count)
+            received = amio._native.AudioClip_get_overview(
+                self.io_owned_clip, start_frame, frames_per_point, arr
+            )
+            if received < 0:
+                raise ValueError("No overview of this clip in the given range")
+            chunks.append(np.frombuffer(arr, OVERVIEW_DTYPE, received))
+            if received < count:
+                break
+            start_frame += received * frames_per_point
+            if num_points is not None:
+                num_points -= received
+        return np.concatenate(chunks) if chunks else np.zeros(0, OVERVIEW_DTYPE)
+
+    def updated(self, frame: int, data: np.ndarray) -> ImmutableAudioClip:
+        """
+        Return a new clip, with the frames starting at frame replaced by data,
+        a float NumPy array of shape (length_in_frames, channel_count).
+        Only the blocks of native data that the frames overlap are converted
+        and stored anew, the rest is shared with this clip, which is left
+        unchanged (it may still be played by the current playspec).
+        """
+        samples = _native_float_samples(data)
+        if len(samples) == 0:
+            return self
+        if samples.dtype == np.float32:
+            update = amio._native.AudioClip_init_updated_from_float32
+        else:
+            update = amio._native.AudioClip_init_updated_from_float64
+        clip_id = update(self.io_owned_clip, frame, samples)
+        if clip_id < 0:
+            raise ValueError("Frames out of the clip bounds")
+        clip = ImmutableAudioClip.__new__(ImmutableAudioClip)
+        clip.jack_client = self.jack_client
+        clip.io_owned_clip = clip_id
+        return clip
+
+    def resampled(self, frame_rate: float) -> ImmutableAudioClip:
+        """
+        Return a copy of the clip resampled to frame_rate by the native
+        windowed-sinc resampler, in the same storage format. The frame rates
+        must be whole numbers, like all the common ones.
+        """
+        clip_id = amio._native.AudioClip_init_resampled(
+            self.io_owned_clip, frame_rate
+        )
+        if clip_id < 0:
+            raise ValueError("Unsupported frame rate conversion")
+        clip = ImmutableAudioClip.__new__(ImmutableAudioClip)
+        clip.jack_client = self.jack_client
+        clip.io_owned_clip = clip_id
+        return clip
+
     def use_as_playspec_entry(
         self, n, frame_a, frame_b, play_at_frame, repeat_interval, gain_l, gain_r
     ):
@@ -55,6 +279,45 @@ class ImmutableAudioClip:
         )
 
 
+ClipStoreStats = namedtuple(
+    "ClipStoreStats",
+    "num_clips clip_bytes num_buffers stored_bytes resident_bytes "
+    "num_spilled_buffers spilled_bytes",
+)
+
+
+def get_clip_store_stats() -> ClipStoreStats:
+    """
+    Memory usage of the native clips: the number of clips and the total size
+    of their data, the number of distinct blocks of data actually stored
+    and their total size, the size of the blocks in memory, and the number
+    and size of the blocks spilled to disk.
+    """
+    return ClipStoreStats(
+        amio._native.AudioClip_get_num_clips(),
+        amio._native.clip_store_get_clip_bytes(),
+        amio._native.clip_store_get_num_buffers(),
+        amio._native.clip_store_get_stored_bytes(),
+        amio._native.clip_store_get_resident_bytes(),
+        amio._native.clip_store_get_num_spilled_buffers(),
+        amio._native.clip_store_get_spilled_bytes(),
+    )
+
+
+def set_clip_memory_budget(
+    budget: Optional[int], spill_directory: Optional[str] = None
+) -> None:
+    """
+    Limit the memory taken by the data of native clips to budget bytes
+    (None for no limit). When it's exceeded, the data of clips that aren't
+    used by any playspec is spilled to a file in spill_directory (by default,
+    the temporary directory), least recently used first. It's read back
+    in the background when the clip is used in a playspec again, and the
+    clip plays silence until then.
+    """
+    amio._native.AudioClip_set_memory_budget(budget or 0, spill_directory)
+
+
 class AudioClip:
     """
     A class aggregating NumPy array representing audio data and its sample rate.
@@ -76,6 +339,11 @@ class AudioClip:
             raise ValueError("Incorrect array shape (must be 1D or 2D)")
         self.frame_rate = frame_rate
         self._immutable_clip_data: Optional[bytes] = None
+        # Native clips uploaded to each interface, reused while not writeable
+        self._immutable_clips: Dict[Any, ImmutableAudioClip] = {}
+        # Interfaces whose native clip was resampled to their frame rate
+        self._resampled_immutable_clips: Set[Any] = set()
+        self._native_format = SAMPLE_FORMAT_INT16
 
     def __len__(self):
         return self._array.shape[0]
@@ -107,7 +375,33 @@ class AudioClip:
         """
         self._array.flags.writeable = value
         if value:
-            self._immutable_clip_data = None  # invalidate cached value
+            # invalidate cached values
+            self._immutable_clip_data = None
+            self._immutable_clips = {}
+            self._resampled_immutable_clips = set()
+
+    @property
+    def native_format(self) -> int:
+        """
+        Format in which the clip is stored by the native code for playback,
+        one of SAMPLE_FORMAT_*. SAMPLE_FORMAT_INT16 takes the least memory,
+        SAMPLE_FORMAT_INT24 and SAMPLE_FORMAT_FLOAT32 preserve more
+        of the precision of the array. The default is SAMPLE_FORMAT_INT16.
+        """
+        return self._native_format
+
+    @native_format.setter
+    def native_format(self, value: int):
+        if value not in (
+            SAMPLE_FORMAT_INT16,
+            SAMPLE_FORMAT_FLOAT32,
+            SAMPLE_FORMAT_INT24,
+        ):
+            raise ValueError("Unknown sample format")
+        if value != self._native_format:
+            self._native_format = value
+            self._immutable_clips = {}
+            self._resampled_immutable_clips = set()
 
     @property
     def array(self) -> np.ndarray:
@@ -141,6 +435,26 @@ class AudioClip:
             self._immutable_clip_data = calculated  # cache the result
         return calculated
 
+    def get_cached_immutable_clip(self, interface) -> Optional[ImmutableAudioClip]:
+        """
+        Return the native clip previously uploaded to the interface, if the data
+        hasn't been allowed to change since.
+        """
+        return self._immutable_clips.get(interface)
+
+    def cache_immutable_clip(
+        self, interface, clip: ImmutableAudioClip, resampled: bool = False
+    ) -> None:
+        """
+        Remember the native clip uploaded to the interface, if the data isn't
+        allowed to change. A resampled clip can't be updated by overwrite,
+        since its frames don't correspond to the frames of this clip.
+        """
+        if not self._array.flags.writeable:
+            self._immutable_clips[interface] = clip
+            if resampled:
+                self._resampled_immutable_clips.add(interface)
+
     def channel(self, channel_number: int) -> AudioClip:
         return AudioClip(self._array[:, channel_number], self.frame_rate)
 
@@ -157,12 +471,16 @@ class AudioClip:
         the whole patch_clip is put onto this audio clip, but this can be
         changed by specifying boundaries with clip_a and clip_b.
         This method operates in-place and doesn't return anything.
+        It can be used even if the clip isn't writeable, in which case
+        the native clips already uploaded to interfaces are updated,
+        instead of being uploaded again.
         :param patch_clip: Audio clip to put to overwrite existing content.
         :param position: Position in frames at which to put the clip.
         :param clip_a: Starting frame of the patch clip.
         :param clip_b: End frame of the patch clip.
         :param extend_to_fit: If True, the clip will be resized if too small
-        to contain the clip being inserted.
+        to contain the clip being inserted. Only writeable clips can be resized;
+        ValueError is raised otherwise.
         """
         assert patch_clip.channels == self.channels
         if clip_b == -1:
@@ -177,14 +495,30 @@ class AudioClip:
             return
         if position + inserted_length > len(self):
             if extend_to_fit:
+                if not self.writeable:
+                    raise ValueError("Can't extend a clip that isn't writeable")
                 self.resize(position + inserted_length)
             else:
                 to_cut = position + inserted_length - len(self)
                 inserted_length -= to_cut
                 clip_b -= to_cut
-        self._array[position : position + inserted_length, :] = patch_clip._array[
-            clip_a:clip_b, :
-        ]
+        region = slice(position, position + inserted_length)
+        if self.writeable:
+            self._array[region, :] = patch_clip._array[clip_a:clip_b, :]
+            return
+        # Native clips uploaded so far are updated rather than uploaded again,
+        # at a cost proportional to the overwritten region. Resampled ones
+        # are dropped and uploaded again when needed.
+        self._array.flags.writeable = True
+        self._array[region, :] = patch_clip._array[clip_a:clip_b, :]
+        self._array.flags.writeable = False
+        self._immutable_clip_data = None
+        self._immutable_clips = {
+            interface: clip.updated(position, self._array[region])
+            for interface, clip in self._immutable_clips.items()
+            if interface not in self._resampled_immutable_clips
+        }
+        self._resampled_immutable_clips = set()
 
     def resampled_if_needed(
         self, required_frame_rate: float, epsilon: float = 0.1
@@ -229,23 +563,22 @@ class AudioClip:
         num_fragments = int(self._array.shape[0] // metering_window)
         if num_fragments < 1:
             num_fragments = 1
-        fragments = np.array_split(self._array, num_fragments)
-
-        def clamp(value):
-            return min(max(-127, value), 127)
-
-        rms = np.array(
-            [
-                clamp(factor_to_dB(np.sqrt(np.mean(fragment ** 2))))
-                for fragment in fragments
-            ],
-            np.int8,
-        )
-        peak = np.array(
-            [clamp(factor_to_dB(np.max(np.abs(fragment)))) for fragment in fragments],
-            np.int8,
-        )
-        return num_fragments, rms, peak
+        # Fragments as in np.array_split, each summarized in a single pass
+        length, channels = self._array.shape
+        fragment_lengths = np.full(num_fragments, length // num_fragments)
+        fragment_lengths[: length % num_fragments] += 1
+        starts = np.concatenate(([0], np.cumsum(fragment_lengths)[:-1]))
+        squares = np.add.reduceat(self._array ** 2, starts).sum(axis=1)
+        peaks = np.maximum.reduceat(np.abs(self._array), starts).max(axis=1)
+
+        def to_dB(factors):
+            with np.errstate(divide="ignore"):
+                levels = 20.0 * np.log10(factors)
+            levels[factors <= sys.float_info.min] = -np.inf
+            return np.clip(levels, -127, 127).astype(np.int8)
+
+        rms = to_dB(np.sqrt(squares / (fragment_lengths * channels)))
+        return num_fragments, rms, to_dB(peaks)
 
     def resize(self, new_length: int) -> None:
         """
@@ -0,0 +1,133 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "interface.h"
+
+void capture_ring_init(struct CaptureRing *ring)
+{
+    /* Runs on the Python thread */
+
+    ring->samples = NULL;
+    ring->length = 0;
+    ring->write_frame = 0;
+    ring->release_frame = 0;
+    ring->drained_frame = 0;
+    ring->spans_buffer = malloc(
+        CAPTURE_SPAN_QUEUE_SIZE * sizeof(struct CaptureSpan));
+    PaUtil_InitializeRingBuffer(
+        &ring->spans,
+        sizeof(struct CaptureSpan),
+        CAPTURE_SPAN_QUEUE_SIZE,
+        ring->spans_buffer);
+    ring->overruns = 0;
+}
+
+void capture_ring_destroy(struct CaptureRing *ring)
+{
+    /* Runs on the Python thread */
+
+    /* The samples belong to Python */
+    free(ring->spans_buffer);
+}
+
+void capture_ring_write(
+    struct CaptureRing *ring,
+    jack_nframes_t nframes,
+    const jack_default_audio_sample_t *port_l,
+    const jack_default_audio_sample_t *port_r,
+    int playspec_id,
+    int starting_frame,
+    int was_transport_rolling)
+{
+    /* Runs on the I/O thread */
+
+    jack_default_audio_sample_t *samples =
+        __atomic_load_n(&ring->samples, __ATOMIC_ACQUIRE);
+    if (!samples || nframes == 0)
+        return;
+
+    /* Pairs with the release in iface_drain_capture */
+    int64_t used = ring->write_frame
+        - __atomic_load_n(&ring->release_frame, __ATOMIC_ACQUIRE);
+    if ((int64_t)nframes > ring->length - used
+            || PaUtil_GetRingBufferWriteAvailable(&ring->spans) < 1) {
+        __atomic_add_fetch(&ring->overruns, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* The period may wrap around the end of the ring */
+    int offset = ring->write_frame % ring->length;
+    for (jack_nframes_t i = 0; i < nframes; ++i) {
+        samples[2 * offset + 0] = port_l[i];
+        samples[2 * offset + 1] = port_r[i];
+        if (++offset == ring->length)
+            offset = 0;
+    }
+
+    struct CaptureSpan span;
+    span.capture_frame = ring->write_frame;
+    span.frames = nframes;
+    span.playspec_id = playspec_id;
+    span.starting_frame = starting_frame;
+    span.was_transport_rolling = was_transport_rolling;
+    ring->write_frame += nframes;
+
+    /* The ring buffer makes the samples visible before the span */
+    PaUtil_WriteRingBuffer(&ring->spans, &span, 1);
+}
+
+bool iface_set_capture_buffer(int interface_id, char *bytearray, int n)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return false;
+
+    struct CaptureRing *ring = &interface->capture;
+    int length = n / (2 * sizeof(jack_default_audio_sample_t));
+    if (ring->samples || length < 1)
+        return false;
+
+    ring->length = length;
+    __atomic_store_n(
+        &ring->samples, (jack_default_audio_sample_t *)bytearray,
+        __ATOMIC_RELEASE);
+    return true;
+}
+
+int iface_drain_capture(int interface_id, char *bytearray, int n)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return 0;
+
+    /* Python is done with the frames of the previous drain */
+    struct CaptureRing *ring = &interface->capture;
+    __atomic_store_n(
+        &ring->release_frame, ring->drained_frame, __ATOMIC_RELEASE);
+
+    int count = PaUtil_ReadRingBuffer(
+        &ring->spans, bytearray, n / sizeof(struct CaptureSpan));
+    if (count > 0) {
+        const struct CaptureSpan *last =
+            (const struct CaptureSpan *)bytearray + count - 1;
+        ring->drained_frame = last->capture_frame + last->frames;
+    }
+    return count;
+}
+
+int iface_get_capture_overruns(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return -1;
+
+    return __atomic_load_n(&interface->capture.overruns, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,97 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <jack/jack.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pa_ringbuffer.h"
+
+/* Ring buffer implementation requires this to be a power of two! */
+#define CAPTURE_SPAN_QUEUE_SIZE 4096
+
+/*
+ * Input frames captured in one period, with the state of the interface
+ * at its start. Matches CAPTURE_SPAN_DTYPE in native_interface.py.
+ */
+struct CaptureSpan
+{
+    /*
+     * Number of frames captured before the span. The span starts
+     * at this frame modulo the length of the capture ring.
+     */
+    int64_t capture_frame;
+
+    int frames;
+    int playspec_id;
+    int starting_frame;
+    int was_transport_rolling;
+};
+
+/*
+ * The capture ring holds the input frames received by the I/O thread until
+ * the Python thread drains them. The channel-interleaved stereo samples
+ * are kept in a buffer owned by Python, which reads them in place through
+ * a NumPy view; the spans describing them are passed in a ring buffer.
+ *
+ * A drain returns all the spans captured since the previous one, and
+ * releases the frames of the previous one for the I/O thread to overwrite.
+ * Periods that don't fit in the ring are dropped and counted as overruns.
+ */
+struct CaptureRing
+{
+    /* Stereo frames; NULL until the Python thread sets the buffer */
+    jack_default_audio_sample_t *samples;
+    int length;  /* in frames */
+
+    /* Only accessible from the I/O thread: number of frames captured */
+    int64_t write_frame;
+
+    /* Number of frames the I/O thread may overwrite, set by Python */
+    int64_t release_frame;
+
+    /* Only accessible from the Python thread: end of the drained spans */
+    int64_t drained_frame;
+
+    PaUtilRingBuffer spans;
+    struct CaptureSpan *spans_buffer;
+
+    /* Number of periods that were dropped */
+    int overruns;
+};
+
+/* API for Python code */
+
+/*
+ * Set the buffer of stereo float frames that input is captured to.
+ * The buffer must stay valid until the interface is closed. Returns false
+ * if there is no such interface or the buffer was set already.
+ */
+bool iface_set_capture_buffer(int interface_id, char *bytearray, int n);
+
+/*
+ * Release the frames of the spans drained before, and fill the bytearray
+ * with the spans captured since then (struct CaptureSpan). Returns
+ * the number of spans.
+ */
+int iface_drain_capture(int interface_id, char *bytearray, int n);
+
+/* Number of periods of input that were dropped since the ring was full */
+int iface_get_capture_overruns(int interface_id);
+
+/* API for C code */
+
+void capture_ring_init(struct CaptureRing *ring);
+void capture_ring_destroy(struct CaptureRing *ring);
+
+/* Capture the input of a period of any length */
+void capture_ring_write(
+    struct CaptureRing *ring,
+    jack_nframes_t nframes,
+    const jack_default_audio_sample_t *port_l,
+    const jack_default_audio_sample_t *port_r,
+    int playspec_id,
+    int starting_frame,
+    int was_transport_rolling);
+
+#endif
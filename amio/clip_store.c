@@ -0,0 +1,598 @@
+#include "clip_store.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLIP_STORE_BUCKETS 1024
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+
+static struct ClipData *buckets[CLIP_STORE_BUCKETS];
+static struct
+{
+    size_t clip_bytes;
+    int num_buffers;
+    size_t stored_bytes;
+    size_t resident_bytes;
+    int num_spilled_buffers;
+    size_t spilled_bytes;
+} stats;
+
+/* A free range of the spill file */
+struct SpillExtent
+{
+    int64_t offset;
+    size_t size;
+};
+
+static struct
+{
+    long long budget;
+    char *directory;
+
+    /* -1 until a buffer is spilled for the first time */
+    int fd;
+    int64_t file_size;
+
+    struct SpillExtent *free_extents;
+    int num_free_extents;
+    int free_extents_capacity;
+} spill = {0, NULL, -1, 0, NULL, 0, 0};
+
+/* Incremented on every marking, to tell how recently buffers were used */
+static unsigned tick;
+
+struct BufferList
+{
+    struct ClipData **buffers;
+    int count;
+    int capacity;
+};
+
+/*
+ * Buffers that the stream reader thread is asked to read back. The queue
+ * is protected by the mutex, which the reader also holds while it reads
+ * a buffer and publishes it, so a buffer that isn't queued anymore is
+ * in memory.
+ */
+static pthread_mutex_t page_in_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct BufferList page_in_queue;
+
+/*
+ * The buffers with page_in_requested set: the queued ones, and the ones
+ * read back but not accounted for yet. Only used on the Python thread.
+ */
+static struct BufferList page_in_requests;
+
+static inline uint64_t rotate_left(uint64_t x, int bits)
+{
+    return x << bits | x >> (64 - bits);
+}
+
+static inline uint64_t load_word(const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t word)
+{
+    acc += word * HASH_PRIME_2;
+    return rotate_left(acc, 31) * HASH_PRIME_1;
+}
+
+/*
+ * A fast non-cryptographic hash, in the spirit of xxHash. Clip data
+ * is hashed in 32-byte blocks, by four independent lanes, so that
+ * the multiplications of the lanes can overlap.
+ */
+static uint64_t hash_bytes(const void *bytes, size_t size)
+{
+    const uint8_t *p = bytes;
+    const uint8_t *end = p + size;
+
+    uint64_t lanes[4] = {
+        HASH_PRIME_1 + HASH_PRIME_2, HASH_PRIME_2, 0, -HASH_PRIME_1};
+    for (; end - p >= 32; p += 32) {
+        for (int i = 0; i < 4; ++i)
+            lanes[i] = hash_round(lanes[i], load_word(p + 8 * i));
+    }
+
+    uint64_t hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7)
+        + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+    hash += size;
+
+    for (; end - p >= 8; p += 8) {
+        hash ^= hash_round(0, load_word(p));
+        hash = rotate_left(hash, 27) * HASH_PRIME_1 + HASH_PRIME_3;
+    }
+    for (; p < end; ++p) {
+        hash ^= *p * HASH_PRIME_3;
+        hash = rotate_left(hash, 11) * HASH_PRIME_1;
+    }
+
+    /* Make every bit of the input affect every bit of the hash */
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static bool open_spill_file()
+{
+    if (spill.fd >= 0)
+        return true;
+
+    const char *directory = spill.directory;
+    if (!directory)
+        directory = getenv("TMPDIR");
+    if (!directory)
+        directory = "/tmp";
+
+    size_t size = strlen(directory) + sizeof("/amio-spill-XXXXXX");
+    char *path = malloc(size);
+    snprintf(path, size, "%s/amio-spill-XXXXXX", directory);
+    spill.fd = mkstemp(path);
+
+    /* The file is removed when it's closed, even if the process crashes */
+    if (spill.fd >= 0)
+        unlink(path);
+    free(path);
+    return spill.fd >= 0;
+}
+
+static void remove_free_extent(int i)
+{
+    spill.free_extents[i] = spill.free_extents[--spill.num_free_extents];
+}
+
+static int64_t allocate_extent(size_t size)
+{
+    for (int i = 0; i < spill.num_free_extents; ++i) {
+        struct SpillExtent *extent = &spill.free_extents[i];
+        if (extent->size < size)
+            continue;
+        int64_t offset = extent->offset;
+        extent->offset += size;
+        extent->size -= size;
+        if (!extent->size)
+            remove_free_extent(i);
+        return offset;
+    }
+
+    int64_t offset = spill.file_size;
+    spill.file_size += size;
+    return offset;
+}
+
+static void free_extent(int64_t offset, size_t size)
+{
+    /* Merge with the adjacent free extents */
+    for (int i = 0; i < spill.num_free_extents;) {
+        struct SpillExtent *extent = &spill.free_extents[i];
+        if (extent->offset + (int64_t)extent->size == offset) {
+            offset = extent->offset;
+            size += extent->size;
+            remove_free_extent(i);
+        } else if (offset + (int64_t)size == extent->offset) {
+            size += extent->size;
+            remove_free_extent(i);
+        } else {
+            ++i;
+        }
+    }
+
+    if (offset + (int64_t)size == spill.file_size) {
+        /* Give the space back; it's reused even if truncating fails */
+        spill.file_size = offset;
+        int result = ftruncate(spill.fd, offset);
+        (void)result;
+        return;
+    }
+
+    if (spill.num_free_extents == spill.free_extents_capacity) {
+        spill.free_extents_capacity = spill.free_extents_capacity
+            ? 2 * spill.free_extents_capacity : 16;
+        spill.free_extents = realloc(
+            spill.free_extents,
+            spill.free_extents_capacity * sizeof(struct SpillExtent));
+    }
+    struct SpillExtent *extent = &spill.free_extents[spill.num_free_extents++];
+    extent->offset = offset;
+    extent->size = size;
+}
+
+static bool spill_buffer(struct ClipData *data)
+{
+    if (!open_spill_file())
+        return false;
+
+    int64_t offset = allocate_extent(data->size);
+    size_t done = 0;
+    while (done < data->size) {
+        ssize_t n = pwrite(
+            spill.fd, (char *)data->bytes + done, data->size - done,
+            offset + done);
+        if (n <= 0) {
+            /* Most likely the disk is full: keep the buffer in memory */
+            free_extent(offset, data->size);
+            return false;
+        }
+        done += n;
+    }
+
+    free(data->bytes);
+    data->bytes = NULL;
+    data->spill_offset = offset;
+
+    stats.resident_bytes -= data->size;
+    ++stats.num_spilled_buffers;
+    stats.spilled_bytes += data->size;
+    return true;
+}
+
+static void * read_spilled(const struct ClipData *data)
+{
+    char *bytes = malloc(data->size);
+    size_t done = 0;
+    while (done < data->size) {
+        ssize_t n = pread(
+            spill.fd, bytes + done, data->size - done,
+            data->spill_offset + done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    memset(bytes + done, 0, data->size - done);
+    return bytes;
+}
+
+/* Account for a buffer that was read back into memory */
+static void paged_in(struct ClipData *data)
+{
+    free_extent(data->spill_offset, data->size);
+    data->spill_offset = -1;
+    data->last_used = tick;
+
+    stats.resident_bytes += data->size;
+    --stats.num_spilled_buffers;
+    stats.spilled_bytes -= data->size;
+}
+
+static void push_buffer(struct BufferList *list, struct ClipData *data)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 16;
+        list->buffers = realloc(
+            list->buffers, list->capacity * sizeof(struct ClipData *));
+    }
+    list->buffers[list->count++] = data;
+}
+
+static void remove_buffer(struct BufferList *list, struct ClipData *data)
+{
+    for (int i = 0; i < list->count; ++i) {
+        if (list->buffers[i] == data) {
+            list->buffers[i] = list->buffers[--list->count];
+            return;
+        }
+    }
+}
+
+/*
+ * Take a page-in request back from the stream reader if it hasn't read
+ * the buffer yet, and account for the buffer if it has
+ */
+static void settle_page_in(struct ClipData *data)
+{
+    if (!data->page_in_requested)
+        return;
+
+    pthread_mutex_lock(&page_in_mutex);
+    remove_buffer(&page_in_queue, data);
+    pthread_mutex_unlock(&page_in_mutex);
+
+    remove_buffer(&page_in_requests, data);
+    data->page_in_requested = false;
+    if (data->bytes)
+        paged_in(data);
+}
+
+/* Account for the buffers that the stream reader read back so far */
+static void settle_page_ins()
+{
+    for (int i = 0; i < page_in_requests.count;) {
+        struct ClipData *data = page_in_requests.buffers[i];
+        if (__atomic_load_n(&data->bytes, __ATOMIC_ACQUIRE))
+            settle_page_in(data);
+        else
+            ++i;
+    }
+}
+
+void clip_store_page_in(struct ClipData *data)
+{
+    /* Runs on the Python thread */
+
+    settle_page_in(data);
+    if (data->bytes)
+        return;
+
+    /* The I/O thread may be waiting for the buffer already */
+    __atomic_store_n(&data->bytes, read_spilled(data), __ATOMIC_RELEASE);
+    paged_in(data);
+}
+
+bool clip_store_request_page_in(struct ClipData *data)
+{
+    /* Runs on the Python thread */
+
+    if (data->page_in_requested || data->bytes)
+        return false;
+
+    data->page_in_requested = true;
+    push_buffer(&page_in_requests, data);
+
+    pthread_mutex_lock(&page_in_mutex);
+    push_buffer(&page_in_queue, data);
+    pthread_mutex_unlock(&page_in_mutex);
+    return true;
+}
+
+void clip_store_read_requested()
+{
+    /* Runs on the stream reader thread */
+
+    /* The Python thread may take requests back between the reads */
+    while (true) {
+        pthread_mutex_lock(&page_in_mutex);
+        if (!page_in_queue.count) {
+            pthread_mutex_unlock(&page_in_mutex);
+            return;
+        }
+
+        /* The Python thread leaves a queued buffer and its extent alone */
+        struct ClipData *data = page_in_queue.buffers[--page_in_queue.count];
+        void *bytes = read_spilled(data);
+
+        /* Pairs with the loads of the I/O thread and settle_page_ins */
+        __atomic_store_n(&data->bytes, bytes, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&page_in_mutex);
+    }
+}
+
+static struct ClipData * find(uint64_t hash, const void *bytes, size_t size)
+{
+    struct ClipData *data = buckets[hash % CLIP_STORE_BUCKETS];
+    for (; data; data = data->next) {
+        if (data->hash != hash || data->size != size)
+            continue;
+
+        /* It's about to be shared, most likely by a clip being played */
+        clip_store_page_in(data);
+        if (memcmp(data->bytes, bytes, size) == 0)
+            return data;
+    }
+    return NULL;
+}
+
+static struct ClipData * share(struct ClipData *data)
+{
+    ++data->refcount;
+    stats.clip_bytes += data->size;
+    return data;
+}
+
+static struct ClipData * insert(uint64_t hash, void *bytes, size_t size)
+{
+    struct ClipData *data = malloc(sizeof(struct ClipData));
+    data->hash = hash;
+    data->size = size;
+    data->bytes = bytes;
+    data->spill_offset = -1;
+    data->page_in_requested = false;
+    data->refcount = 0;
+    data->in_use = false;
+    data->last_used = tick;
+
+    struct ClipData **bucket = &buckets[hash % CLIP_STORE_BUCKETS];
+    data->next = *bucket;
+    *bucket = data;
+
+    ++stats.num_buffers;
+    stats.stored_bytes += size;
+    stats.resident_bytes += size;
+    return share(data);
+}
+
+struct ClipData * clip_store_add_copy(const void *bytes, size_t size)
+{
+    /* Runs on the Python thread */
+
+    uint64_t hash = hash_bytes(bytes, size);
+    struct ClipData *existing = find(hash, bytes, size);
+    if (existing)
+        return share(existing);
+
+    void *copy = malloc(size);
+    memcpy(copy, bytes, size);
+    return insert(hash, copy, size);
+}
+
+struct ClipData * clip_store_add(void *bytes, size_t size)
+{
+    /* Runs on the Python thread */
+
+    uint64_t hash = hash_bytes(bytes, size);
+    struct ClipData *existing = find(hash, bytes, size);
+    if (existing) {
+        free(bytes);
+        return share(existing);
+    }
+
+    return insert(hash, bytes, size);
+}
+
+void clip_store_retain(struct ClipData *data)
+{
+    /* Runs on the Python thread */
+
+    share(data);
+}
+
+void clip_store_release(struct ClipData *data)
+{
+    /* Runs on the Python thread */
+
+    stats.clip_bytes -= data->size;
+    if (--data->refcount > 0)
+        return;
+
+    settle_page_in(data);
+
+    struct ClipData **link = &buckets[data->hash % CLIP_STORE_BUCKETS];
+    while (*link != data)
+        link = &(*link)->next;
+    *link = data->next;
+
+    --stats.num_buffers;
+    stats.stored_bytes -= data->size;
+    if (data->bytes) {
+        stats.resident_bytes -= data->size;
+        free(data->bytes);
+    } else {
+        --stats.num_spilled_buffers;
+        stats.spilled_bytes -= data->size;
+        free_extent(data->spill_offset, data->size);
+    }
+    free(data);
+}
+
+void clip_store_set_memory_budget(
+    long long budget, const char *spill_directory)
+{
+    /* Runs on the Python thread */
+
+    spill.budget = budget > 0 ? budget : 0;
+
+    /* Only used when the spill file is created */
+    free(spill.directory);
+    spill.directory = spill_directory ? strdup(spill_directory) : NULL;
+}
+
+bool clip_store_over_budget()
+{
+    /* Runs on the Python thread */
+
+    settle_page_ins();
+    return spill.budget && stats.resident_bytes > (size_t)spill.budget;
+}
+
+void clip_store_begin_marking()
+{
+    /* Runs on the Python thread */
+
+    ++tick;
+    for (int i = 0; i < CLIP_STORE_BUCKETS; ++i) {
+        for (struct ClipData *data = buckets[i]; data; data = data->next)
+            data->in_use = false;
+    }
+}
+
+void clip_store_use(struct ClipData *data)
+{
+    /* Runs on the Python thread */
+
+    data->in_use = true;
+    data->last_used = tick;
+}
+
+static int compare_last_used(const void *a, const void *b)
+{
+    const struct ClipData *x = *(struct ClipData * const *)a;
+    const struct ClipData *y = *(struct ClipData * const *)b;
+
+    /* The difference is right even if the tick wrapped around */
+    int difference = (int)(x->last_used - y->last_used);
+    return (difference > 0) - (difference < 0);
+}
+
+void clip_store_spill_unused()
+{
+    /* Runs on the Python thread */
+
+    if (!clip_store_over_budget())
+        return;
+
+    int num_candidates = 0;
+    struct ClipData **candidates = malloc(
+        stats.num_buffers * sizeof(struct ClipData *));
+    for (int i = 0; i < CLIP_STORE_BUCKETS; ++i) {
+        for (struct ClipData *data = buckets[i]; data; data = data->next) {
+            if (!data->page_in_requested && data->bytes && !data->in_use)
+                candidates[num_candidates++] = data;
+        }
+    }
+
+    /* Least recently used first */
+    qsort(candidates, num_candidates, sizeof(struct ClipData *),
+        compare_last_used);
+    for (int i = 0; i < num_candidates && clip_store_over_budget(); ++i) {
+        if (!spill_buffer(candidates[i]))
+            break;
+    }
+    free(candidates);
+}
+
+long long clip_store_get_clip_bytes()
+{
+    /* Runs on the Python thread */
+
+    return stats.clip_bytes;
+}
+
+int clip_store_get_num_buffers()
+{
+    /* Runs on the Python thread */
+
+    return stats.num_buffers;
+}
+
+long long clip_store_get_stored_bytes()
+{
+    /* Runs on the Python thread */
+
+    return stats.stored_bytes;
+}
+
+long long clip_store_get_resident_bytes()
+{
+    /* Runs on the Python thread */
+
+    settle_page_ins();
+    return stats.resident_bytes;
+}
+
+int clip_store_get_num_spilled_buffers()
+{
+    /* Runs on the Python thread */
+
+    settle_page_ins();
+    return stats.num_spilled_buffers;
+}
+
+long long clip_store_get_spilled_bytes()
+{
+    /* Runs on the Python thread */
+
+    settle_page_ins();
+    return stats.spilled_bytes;
+}
@@ -0,0 +1,138 @@
+#ifndef CLIP_STORE_H
+#define CLIP_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The clip store holds the blocks of sample data of native clips. Identical
+ * blocks share a single buffer: incoming data is hashed, and if a buffer
+ * with the same hash and the same bytes already exists, its reference count
+ * is incremented instead of storing another copy. This is common with loops,
+ * silence, samples used on many tracks, and versions of an updated clip.
+ *
+ * The buffers don't know the format of the samples they hold, so clips
+ * of different formats or channel counts may share a buffer as well.
+ *
+ * The store is only accessed from the Python thread. The I/O thread reads
+ * buffers through clips, which release their buffer when they're destroyed,
+ * after the I/O thread stopped using them.
+ *
+ * If a memory budget is set, buffers that no playspec uses are spilled
+ * to a file when the buffers in memory exceed it, least recently used first
+ * (see gc.c). When a playspec using them is compiled, the stream reader
+ * thread reads them back in the background, and the I/O thread plays
+ * silence until it's done (see clip_store_request_page_in).
+ */
+struct ClipData
+{
+    uint64_t hash;
+    size_t size;  /* in bytes */
+
+    /*
+     * NULL while the buffer is spilled. Set by the stream reader thread
+     * if it reads the buffer back (see clip_store_request_page_in).
+     */
+    void *bytes;
+
+    /* Position of a spilled buffer in the spill file */
+    int64_t spill_offset;
+
+    /* Whether the stream reader was asked to read the buffer back */
+    bool page_in_requested;
+
+    /* Number of clip blocks that use this buffer */
+    int refcount;
+
+    /*
+     * Whether a playspec uses the buffer, so it can't be spilled,
+     * and when it was last used, as set by clip_store_use
+     */
+    bool in_use;
+    unsigned last_used;
+
+    /* Next buffer in the same hash bucket */
+    struct ClipData *next;
+};
+
+/* API for Python code */
+
+/* Total size of the data of all clips, counting shared buffers every time */
+long long clip_store_get_clip_bytes();
+
+/* Number of distinct buffers and their total size */
+int clip_store_get_num_buffers();
+long long clip_store_get_stored_bytes();
+
+/*
+ * Size of the buffers that are in memory, and the number and size
+ * of the buffers that are spilled
+ */
+long long clip_store_get_resident_bytes();
+int clip_store_get_num_spilled_buffers();
+long long clip_store_get_spilled_bytes();
+
+/* API for C code */
+
+/*
+ * Limit the size of the buffers in memory to the given number of bytes
+ * (0 for no limit). Spilled buffers are written to an unlinked file
+ * in the given directory, or in TMPDIR if it's NULL.
+ */
+void clip_store_set_memory_budget(
+    long long budget, const char *spill_directory);
+
+/*
+ * Store a copy of the bytes, or share an existing buffer with the same
+ * contents. The bytes aren't copied in the latter case.
+ */
+struct ClipData * clip_store_add_copy(const void *bytes, size_t size);
+
+/*
+ * Store the bytes, which must have been allocated with malloc. The store
+ * takes ownership of them, and frees them right away if an existing buffer
+ * with the same contents is shared instead.
+ */
+struct ClipData * clip_store_add(void *bytes, size_t size);
+
+/* Add a reference to a stored buffer */
+void clip_store_retain(struct ClipData *data);
+
+/* Release a reference, freeing the buffer if it was the last one */
+void clip_store_release(struct ClipData *data);
+
+/*
+ * Read a spilled buffer back into memory right away, unless it's in memory
+ * or the stream reader already read it back
+ */
+void clip_store_page_in(struct ClipData *data);
+
+/*
+ * Ask the stream reader thread to read a spilled buffer back. Returns true
+ * if the buffer was spilled and not requested yet, in which case the caller
+ * has to wake the reader (see stream_wake_reader). The spill file stays
+ * reserved for the buffer until the Python thread notices that it was read.
+ */
+bool clip_store_request_page_in(struct ClipData *data);
+
+/*
+ * Read back the buffers requested by clip_store_request_page_in.
+ * Runs on the stream reader thread.
+ */
+void clip_store_read_requested();
+
+/* Whether the buffers in memory exceed the budget */
+bool clip_store_over_budget();
+
+/*
+ * Spilling buffers: clip_store_begin_marking forgets which buffers are used,
+ * clip_store_use marks the buffers used by playspecs, and then
+ * clip_store_spill_unused spills the least recently used of the others
+ * until the buffers in memory fit in the budget.
+ */
+void clip_store_begin_marking();
+void clip_store_use(struct ClipData *data);
+void clip_store_spill_unused();
+
+#endif
@@ -1,10 +1,53 @@
 #include "communication.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "interface.h"
 #include "string.h"
 
+/* Slot of the I/O thread queue at the given offset from the write index */
+static struct Task * io_thread_queue_slot(
+    struct Interface *interface, ring_buffer_size_t offset)
+{
+    /* Runs on the Python thread */
+
+    void *data1, *data2;
+    ring_buffer_size_t size1, size2;
+    PaUtil_GetRingBufferWriteRegions(
+        &interface->io_thread_queue, offset + 1,
+        &data1, &size1, &data2, &size2);
+    if (offset < size1)
+        return (struct Task *)data1 + offset;
+    return (struct Task *)data2 + (offset - size1);
+}
+
+static bool post_task_to_io_thread(
+    struct Interface *interface, const struct Task *msg)
+{
+    /* Runs on the Python thread */
+
+    if (interface->io_transaction_size < 0)
+        return PaUtil_WriteRingBuffer(&interface->io_thread_queue, msg, 1) > 0;
+
+    /* Once a message is refused, the rest of the transaction is too */
+    if (interface->io_transaction_failed)
+        return false;
+
+    /* The first slot is kept for the header of the transaction */
+    ring_buffer_size_t offset = interface->io_transaction_size + 1;
+    if (PaUtil_GetRingBufferWriteAvailable(&interface->io_thread_queue)
+            <= offset) {
+        interface->io_transaction_failed = true;
+        return false;
+    }
+
+    *io_thread_queue_slot(interface, offset) = *msg;
+    ++interface->io_transaction_size;
+    return true;
+}
+
 bool post_task_with_ptr_to_py_thread(
         struct Interface *interface, PyThreadCallable callable, void *arg_ptr) {
     struct Task msg;
@@ -18,7 +61,7 @@ bool post_task_with_ptr_to_io_thread(
     struct Task msg;
     msg.callable.io_thread_callable = callable;
     msg.arg.pointer = arg_ptr;
-    return PaUtil_WriteRingBuffer(&interface->io_thread_queue, &msg, 1) > 0;
+    return post_task_to_io_thread(interface, &msg);
 }
 
 bool post_task_with_int_to_py_thread(
@@ -34,47 +77,149 @@ bool post_task_with_int_to_io_thread(
     struct Task msg;
     msg.callable.io_thread_callable = callable;
     msg.arg.integer = arg_int;
-    return PaUtil_WriteRingBuffer(&interface->io_thread_queue, &msg, 1) > 0;
+    return post_task_to_io_thread(interface, &msg);
+}
+
+bool iface_begin_transaction(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface || interface->io_transaction_size >= 0)
+        return false;
+
+    interface->io_transaction_size = 0;
+    return true;
+}
+
+/*
+ * Close the open transaction without making its messages visible
+ * to the I/O thread, undoing what posting them did
+ */
+static void discard_transaction(struct Interface *interface)
+{
+    /* Runs on the Python thread */
+
+    for (int i = interface->io_transaction_size; i > 0; --i)
+        py_thread_withdraw_task(interface, io_thread_queue_slot(interface, i));
+
+    interface->io_transaction_size = -1;
+    interface->io_transaction_failed = false;
 }
 
-bool write_log(struct Interface *state, char *s)
+int iface_commit_transaction(int interface_id)
 {
-    int len = strlen(s);
-    return PaUtil_WriteRingBuffer(&state->log_queue, s, len) == len;
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface || interface->io_transaction_size < 0)
+        return -1;
+
+    if (interface->io_transaction_failed) {
+        discard_transaction(interface);
+        return -1;
+    }
+
+    int size = interface->io_transaction_size;
+    interface->io_transaction_size = -1;
+    if (size == 0)
+        return 0;
+
+    struct Task *header = io_thread_queue_slot(interface, 0);
+    header->callable.io_thread_callable = io_thread_transaction;
+    header->arg.integer = size;
+
+    /* The header and all the messages become visible at once */
+    PaUtil_AdvanceRingBufferWriteIndex(&interface->io_thread_queue, size + 1);
+    return size;
 }
 
-void iface_get_logs(int interface_id, char *bytearray, int n)
+void iface_abort_transaction(int interface_id)
 {
     /* Runs on the Python thread */
 
     struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface || interface->io_transaction_size < 0)
+        return;
 
-    char buf[LOG_QUEUE_SIZE];
-    int to_read = LOG_QUEUE_SIZE < (n-1) ? LOG_QUEUE_SIZE : (n-1);
-    int actually_read;
+    discard_transaction(interface);
+}
 
-    actually_read = PaUtil_ReadRingBuffer(&interface->log_queue, buf, to_read);
-    memcpy(bytearray, buf, actually_read);
-    bytearray[actually_read] = '\0';
+void io_thread_transaction(
+    struct Interface *state,
+    struct Driver *driver,
+    void *driver_handle,
+    union TaskArgument arg)
+{
+    /* Runs on the I/O thread */
 }
 
-bool write_input_samples(
-    struct Interface *interface, struct InputChunk *input_chunk)
+bool wakeup_init(struct Interface *interface)
 {
-    return PaUtil_WriteRingBuffer(
-        &interface->input_chunk_queue, input_chunk, 1) == 1;
+    /* Runs on the Python thread */
+
+    interface->wakeup_pending = 0;
+    interface->frames_since_wakeup = 0;
+    if (pipe(interface->wakeup_fds)) {
+        interface->wakeup_fds[0] = interface->wakeup_fds[1] = -1;
+        return false;
+    }
+
+    /* The I/O thread must never block on the pipe */
+    for (int i = 0; i < 2; ++i) {
+        fcntl(interface->wakeup_fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(interface->wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
 }
 
-bool iface_begin_reading_input_chunk(int interface_id)
+void wakeup_destroy(struct Interface *interface)
 {
     /* Runs on the Python thread */
 
-    struct Interface *interface = get_interface_by_id(interface_id);
+    for (int i = 0; i < 2; ++i) {
+        if (interface->wakeup_fds[i] >= 0)
+            close(interface->wakeup_fds[i]);
+    }
+}
 
-    if (PaUtil_ReadRingBuffer(
-            &interface->input_chunk_queue, &input_chunk_being_read, 1) == 1) {
-        return 1;
-    } else {
-        return 0;
+void wake_python_thread(struct Interface *interface)
+{
+    /* Runs on the I/O thread */
+
+    interface->frames_since_wakeup = 0;
+    if (__atomic_exchange_n(&interface->wakeup_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    /* A non-blocking write of a byte, which can't fill the pipe */
+    char byte = 0;
+    if (write(interface->wakeup_fds[1], &byte, 1) < 0) {
+        /* Nothing to do; the Python thread will be woken next time */
+        __atomic_store_n(&interface->wakeup_pending, 0, __ATOMIC_RELEASE);
     }
 }
+
+int iface_get_wakeup_fd(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return -1;
+
+    return interface->wakeup_fds[0];
+}
+
+void iface_acknowledge_wakeup(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return;
+
+    char bytes[16];
+    while (read(interface->wakeup_fds[0], bytes, sizeof(bytes)) > 0)
+        ;
+    __atomic_store_n(&interface->wakeup_pending, 0, __ATOMIC_RELEASE);
+}
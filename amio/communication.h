@@ -6,7 +6,6 @@
 #include <stdio.h>
 
 #include "driver.h"
-#include "input_chunk.h"
 #include "pa_ringbuffer.h"
 
 struct Interface;
@@ -41,8 +40,18 @@ struct Task
 
 /* Ring buffer implementation requires these to be powers of two! */
 #define THREAD_QUEUE_SIZE 2048
-#define LOG_QUEUE_SIZE 65536
-#define INPUT_CLIP_QUEUE_SIZE 2048
+
+/*
+ * Most messages the I/O thread processes in a period, not counting
+ * the rest of a transaction it started processing
+ */
+#define IO_THREAD_MESSAGES_PER_PERIOD 64
+
+/*
+ * Routine updates, such as captured input, wake the Python thread
+ * at most once per this many frames
+ */
+#define WAKEUP_INTERVAL_FRAMES 1024
 
 bool post_task_with_ptr_to_py_thread(
     struct Interface *interface, PyThreadCallable callable, void *arg_ptr);
@@ -52,11 +61,56 @@ bool post_task_with_int_to_py_thread(
     struct Interface *interface, PyThreadCallable callable, int arg_int);
 bool post_task_with_int_to_io_thread(
     struct Interface *interface, IoThreadCallable callable, int arg_int);
-bool write_log(struct Interface *state, char *s);
-void iface_get_logs(int interface_id, char *bytearray, int n);
 
-bool write_input_samples(
-    struct Interface *interface, struct InputChunk *input_chunk);
-bool iface_begin_reading_input_chunk(int interface_id);
+/*
+ * Messages posted to the I/O thread during a transaction aren't visible
+ * to it until the transaction is committed. Then they are all processed
+ * in the same period, so that they take effect at the same frame.
+ * A transaction is applied whole or not at all: once a message doesn't
+ * fit in the queue, it and the rest of the transaction are refused,
+ * and the transaction is discarded when committed.
+ */
+bool iface_begin_transaction(int interface_id);
+
+/*
+ * Make the messages of the transaction visible to the I/O thread. Returns
+ * the number of messages, or -1 if there is no transaction or a message
+ * was refused, in which case the transaction is discarded.
+ */
+int iface_commit_transaction(int interface_id);
+
+/*
+ * Discard the messages of the transaction, undoing what posting them did
+ * on the Python thread, e.g. scheduling a playspec
+ */
+void iface_abort_transaction(int interface_id);
+
+/*
+ * Header of a transaction in the I/O thread queue; the number of messages
+ * that follow it is its argument. It does nothing by itself.
+ */
+void io_thread_transaction(
+    struct Interface *state,
+    struct Driver *driver,
+    void *driver_handle,
+    union TaskArgument arg);
+
+/*
+ * The Python thread waits on a pipe for the I/O thread to post something
+ * to it. A wakeup stays pending until the Python thread acknowledges it,
+ * so the I/O thread writes to the pipe at most once per acknowledgement.
+ */
+bool wakeup_init(struct Interface *interface);
+void wakeup_destroy(struct Interface *interface);
+void wake_python_thread(struct Interface *interface);
+
+/* File descriptor that becomes readable when the Python thread is woken */
+int iface_get_wakeup_fd(int interface_id);
+
+/*
+ * Clear the pending wakeup. Must be called before processing the queues,
+ * so that anything posted while they are processed wakes the thread again.
+ */
+void iface_acknowledge_wakeup(int interface_id);
 
 #endif
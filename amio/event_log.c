@@ -0,0 +1,93 @@
+#include "event_log.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "interface.h"
+
+void event_log_init(struct EventLog *log)
+{
+    /* Runs on the Python thread */
+
+    log->records_buffer = malloc(EVENT_LOG_SIZE * sizeof(struct LogRecord));
+    PaUtil_InitializeRingBuffer(
+        &log->records,
+        sizeof(struct LogRecord),
+        EVENT_LOG_SIZE,
+        log->records_buffer);
+    log->dropped = 0;
+}
+
+void event_log_destroy(struct EventLog *log)
+{
+    /* Runs on the Python thread */
+
+    free(log->records_buffer);
+}
+
+bool log_event(
+    struct Interface *interface,
+    enum LogEvent event,
+    int position,
+    int64_t value,
+    const char *text)
+{
+    /* Runs on the I/O thread */
+
+    struct EventLog *log = &interface->log;
+
+    void *data1, *data2;
+    ring_buffer_size_t size1, size2;
+    if (PaUtil_GetRingBufferWriteRegions(
+            &log->records, 1, &data1, &size1, &data2, &size2) < 1) {
+        __atomic_add_fetch(&log->dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    /* The record is written in place, and published by the write index */
+    struct LogRecord *record = data1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record->event = event;
+    record->position = position;
+    record->value = value;
+
+    int length = 0;
+    if (text) {
+        while (length < LOG_RECORD_TEXT_SIZE - 1 && text[length]) {
+            record->text[length] = text[length];
+            ++length;
+        }
+    }
+
+    /* The rest is cleared, since Python reads the text as a fixed size */
+    while (length < LOG_RECORD_TEXT_SIZE)
+        record->text[length++] = '\0';
+
+    PaUtil_AdvanceRingBufferWriteIndex(&log->records, 1);
+    return true;
+}
+
+int iface_get_log_records(int interface_id, char *bytearray, int n)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return 0;
+
+    return PaUtil_ReadRingBuffer(
+        &interface->log.records, bytearray, n / sizeof(struct LogRecord));
+}
+
+int iface_get_dropped_log_records(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return -1;
+
+    return __atomic_load_n(&interface->log.dropped, __ATOMIC_RELAXED);
+}
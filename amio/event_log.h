@@ -0,0 +1,94 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pa_ringbuffer.h"
+
+struct Interface;
+
+/* Ring buffer implementation requires this to be a power of two! */
+#define EVENT_LOG_SIZE 1024
+
+/* Longest text of a record, including the terminating null character */
+#define LOG_RECORD_TEXT_SIZE 40
+
+/* Events that are logged. Must match LOG_EVENTS in native_interface.py. */
+enum LogEvent
+{
+    LOG_EVENT_MIXER_KERNELS,            /* text: name of the kernels */
+    LOG_EVENT_WAKEUP_PIPE_FAILED,
+    LOG_EVENT_SET_PLAYSPEC,             /* value: playspec ID */
+    LOG_EVENT_SET_PLAYSPEC_PATCH,       /* value: patch ID */
+    LOG_EVENT_SET_POSITION,             /* value: new position */
+    LOG_EVENT_SET_TRANSPORT_STATE,      /* value: whether it's rolling */
+    LOG_EVENT_JACK_OPEN_FAILED,         /* value: JACK status */
+    LOG_EVENT_JACK_SERVER_FAILED,
+    LOG_EVENT_JACK_SERVER_STARTED,
+    LOG_EVENT_JACK_NAME_ASSIGNED,       /* text: client name */
+    LOG_EVENT_JACK_NO_MORE_PORTS,
+    LOG_EVENT_JACK_ACTIVATE_FAILED,
+    LOG_EVENT_JACK_NO_CAPTURE_PORTS,
+    LOG_EVENT_JACK_NO_PLAYBACK_PORTS,
+    LOG_EVENT_JACK_CONNECT_INPUT_FAILED,
+    LOG_EVENT_JACK_CONNECT_OUTPUT_FAILED,
+};
+
+/* A logged event. Matches LOG_RECORD_DTYPE in native_interface.py. */
+struct LogRecord
+{
+    /* CLOCK_MONOTONIC time of the event, in nanoseconds */
+    int64_t time_ns;
+
+    int event;
+
+    /* Frame of the playspec when the event happened, or -1 */
+    int position;
+
+    int64_t value;
+
+    /* Null-terminated, cut to fit */
+    char text[LOG_RECORD_TEXT_SIZE];
+};
+
+/*
+ * Records are written by the I/O thread, or by the Python thread before
+ * the I/O thread starts, and read by the Python thread. Writing a record
+ * takes no locks and never blocks, so it's allowed on the I/O thread.
+ * Records that don't fit are dropped and counted.
+ */
+struct EventLog
+{
+    PaUtilRingBuffer records;
+    struct LogRecord *records_buffer;
+
+    /* Number of records that were dropped */
+    int dropped;
+};
+
+/* API for Python code */
+
+/*
+ * Fill the bytearray with the oldest records not read yet
+ * (struct LogRecord). Returns the number of records.
+ */
+int iface_get_log_records(int interface_id, char *bytearray, int n);
+
+/* Number of records dropped since the log was full */
+int iface_get_dropped_log_records(int interface_id);
+
+/* API for C code */
+
+void event_log_init(struct EventLog *log);
+void event_log_destroy(struct EventLog *log);
+
+/* The text may be NULL */
+bool log_event(
+    struct Interface *interface,
+    enum LogEvent event,
+    int position,
+    int64_t value,
+    const char *text);
+
+#endif
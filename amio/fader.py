@@ -1,5 +1,9 @@
 import math
 import sys
+from typing import Optional, TYPE_CHECKING
+
+if TYPE_CHECKING:
+    from amio.interface import Interface
 
 
 # amplitude factor | power factor | power gain
@@ -26,6 +30,31 @@ class Fader:
     def __init__(self, vol_dB: float = 0.0, pan: float = 0.0):
         self._vol_factor = dB_to_factor(vol_dB)
         self._pan = pan
+        self._mute = False
+        self._solo = False
+        self._interface: Optional["Interface"] = None
+        self._param_slot = -1
+
+    def attach(self, interface: "Interface", param_slot: int) -> None:
+        """
+        Make the fader control a slot of the interface parameter table.
+        From now on, every change of the fader is written to the slot,
+        so it affects the playspec entries that reference the slot
+        without resending the playspec.
+        """
+        self._interface = interface
+        self._param_slot = param_slot
+        self._update_param_slot()
+
+    def _update_param_slot(self) -> None:
+        if self._interface is not None:
+            self._interface.set_param_slot(
+                self._param_slot,
+                self.left_gain_factor,
+                self.right_gain_factor,
+                self._mute,
+                self._solo,
+            )
 
     @property
     def vol_dB(self) -> float:
@@ -34,6 +63,7 @@ class Fader:
     @vol_dB.setter
     def vol_dB(self, value_dB: float):
         self._vol_factor = dB_to_factor(value_dB)
+        self._update_param_slot()
 
     @property
     def vol_factor(self) -> float:
@@ -42,6 +72,7 @@ class Fader:
     @vol_factor.setter
     def vol_factor(self, value_factor: float):
         self._vol_factor = value_factor
+        self._update_param_slot()
 
     @property
     def pan(self) -> float:
@@ -51,6 +82,25 @@ class Fader:
     def pan(self, value: float):
         assert -1 <= value <= 1
         self._pan = value
+        self._update_param_slot()
+
+    @property
+    def mute(self) -> bool:
+        return self._mute
+
+    @mute.setter
+    def mute(self, value: bool):
+        self._mute = value
+        self._update_param_slot()
+
+    @property
+    def solo(self) -> bool:
+        return self._solo
+
+    @solo.setter
+    def solo(self, value: bool):
+        self._solo = value
+        self._update_param_slot()
 
     @property
     def left_gain_factor(self) -> float:
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 
 #include "audio_clip.h"
+#include "clip_store.h"
 #include "interface.h"
 
 static void prepare(int audio_clip_id)
@@ -28,13 +29,37 @@ static void mark_clips_from_playspec(
     }
 }
 
+static void mark_clips_from_patch(
+    struct PlayspecPatch *patch, int interface_id)
+{
+    if (!patch)
+        return;
+
+    /* Entries replaced by the patch are used until it's applied */
+    for (int i = 0; i < patch->num_patched_entries; ++i) {
+        struct PatchedEntry *patched = &patch->patched_entries[i];
+        if (patched->added)
+            continue;
+        struct AudioClip *clip = get_audio_clip_by_id(
+            patched->entry.audio_clip_id);
+        if (clip) {
+            clip->referenced_by_io_thread[iface_get_key(interface_id)] = true;
+        }
+    }
+}
+
 static void mark(int interface_id)
 {
     struct Interface *interface = get_interface_by_id(interface_id);
     mark_clips_from_playspec(
         interface->py_thread_current_playspec, interface_id);
-    mark_clips_from_playspec(
-        interface->py_thread_pending_playspec, interface_id);
+    struct PlayspecQueue *scheduled = &interface->py_thread_scheduled_playspecs;
+    for (int i = 0; i < scheduled->count; ++i) {
+        mark_clips_from_playspec(
+            playspec_queue_at(scheduled, i), interface_id);
+    }
+    mark_clips_from_patch(
+        interface->py_thread_pending_patch, interface_id);
 }
 
 static void sweep(int audio_clip_id)
@@ -51,9 +76,39 @@ static void sweep(int audio_clip_id)
     destroy_audio_clip(audio_clip_id);
 }
 
+static void use_blocks(int audio_clip_id)
+{
+    struct AudioClip *clip = get_audio_clip_by_id(audio_clip_id);
+
+    /* Blocks of streaming clips aren't in the clip store */
+    if (clip->stream)
+        return;
+
+    for (int i = 0; i < MAX_INTERFACES; ++i) {
+        if (clip->referenced_by_io_thread[i]) {
+            for (int j = 0; j < clip->num_blocks; ++j)
+                clip_store_use(clip->blocks[j]);
+            return;
+        }
+    }
+}
+
 void gc_audio_clips()
 {
     for_each_audio_clip(prepare);
     for_each_interface(mark);
     for_each_audio_clip(sweep);
+    gc_enforce_clip_memory_budget();
+}
+
+void gc_enforce_clip_memory_budget()
+{
+    if (!clip_store_over_budget())
+        return;
+
+    clip_store_begin_marking();
+    for_each_audio_clip(prepare);
+    for_each_interface(mark);
+    for_each_audio_clip(use_blocks);
+    clip_store_spill_unused();
 }
@@ -3,4 +3,10 @@
 
 void gc_audio_clips();
 
+/*
+ * If the clip data in memory exceeds the memory budget, spill the data
+ * of the clips that aren't used by any playspec, least recently used first
+ */
+void gc_enforce_clip_memory_budget();
+
 #endif
@@ -8,6 +8,8 @@
 #include "gc.h"
 #include "mixer.h"
 #include "pool.h"
+#include "render_list.h"
+#include "stream.h"
 
 #include "jack_driver.h"
 
@@ -45,6 +47,45 @@ void for_each_interface(void (*callback)(int interface_id))
     pool_for_each(pool, callback);
 }
 
+static void playspec_queue_init(struct PlayspecQueue *queue)
+{
+    queue->first = 0;
+    queue->count = 0;
+}
+
+struct Playspec * playspec_queue_at(struct PlayspecQueue *queue, int i)
+{
+    return queue->playspecs[(queue->first + i) % MAX_SCHEDULED_PLAYSPECS];
+}
+
+static void playspec_queue_push(
+    struct PlayspecQueue *queue, struct Playspec *playspec)
+{
+    assert(queue->count < MAX_SCHEDULED_PLAYSPECS);
+
+    int i = (queue->first + queue->count) % MAX_SCHEDULED_PLAYSPECS;
+    queue->playspecs[i] = playspec;
+    ++queue->count;
+}
+
+static struct Playspec * playspec_queue_pop(struct PlayspecQueue *queue)
+{
+    assert(queue->count > 0);
+
+    struct Playspec *result = queue->playspecs[queue->first];
+    queue->first = (queue->first + 1) % MAX_SCHEDULED_PLAYSPECS;
+    --queue->count;
+    return result;
+}
+
+static struct Playspec * playspec_queue_pop_last(struct PlayspecQueue *queue)
+{
+    assert(queue->count > 0);
+
+    --queue->count;
+    return playspec_queue_at(queue, queue->count);
+}
+
 int create_interface(struct Driver *driver, const char *client_name)
 {
     /* Runs on the Python thread */
@@ -52,6 +93,13 @@ int create_interface(struct Driver *driver, const char *client_name)
     ensure_pool_initialized();
 
     struct Interface *interface = malloc(sizeof(struct Interface));
+
+    /* Allocated first, so that a failure has nothing else to undo */
+    if (!mix_buffer_create(&interface->mix_buffer)) {
+        free(interface);
+        return -1;
+    }
+
     interface->id = pool_put(pool, interface);
     interface->driver = driver;
     interface->driver_state = driver->create_state_object(
@@ -61,9 +109,6 @@ int create_interface(struct Driver *driver, const char *client_name)
         THREAD_QUEUE_SIZE * sizeof(struct Task));
     interface->io_thread_queue_buffer = malloc(
         THREAD_QUEUE_SIZE * sizeof(struct Task));
-    interface->log_queue_buffer = malloc(LOG_QUEUE_SIZE * sizeof(char));
-    interface->input_chunk_queue_buffer = malloc(
-        INPUT_CLIP_QUEUE_SIZE * sizeof(struct InputChunk));
 
     PaUtil_InitializeRingBuffer(
         &interface->python_thread_queue,
@@ -75,27 +120,41 @@ int create_interface(struct Driver *driver, const char *client_name)
         sizeof(struct Task),
         THREAD_QUEUE_SIZE,
         interface->io_thread_queue_buffer);
-    PaUtil_InitializeRingBuffer(
-        &interface->log_queue,
-        sizeof(char),
-        LOG_QUEUE_SIZE,
-        interface->log_queue_buffer);
-    PaUtil_InitializeRingBuffer(
-        &interface->input_chunk_queue,
-        sizeof(struct InputChunk),
-        INPUT_CLIP_QUEUE_SIZE,
-        interface->input_chunk_queue_buffer);
+    event_log_init(&interface->log);
+    interface->io_transaction_size = -1;
+    interface->io_transaction_failed = false;
+    capture_ring_init(&interface->capture);
+    if (!wakeup_init(interface))
+        log_event(interface, LOG_EVENT_WAKEUP_PIPE_FAILED, -1, 0, NULL);
+
+    mixer_init();
+    log_event(
+        interface, LOG_EVENT_MIXER_KERNELS, -1, 0, mixer_get_kernels_name());
 
     interface->py_thread_current_playspec = create_empty_playspec();
-    interface->py_thread_pending_playspec = NULL;
+    playspec_queue_init(&interface->py_thread_scheduled_playspecs);
+    interface->py_thread_pending_patch = NULL;
 
     interface->current_playspec = interface->py_thread_current_playspec;
-    interface->pending_playspec = NULL;
-
-    interface->last_reported_frame_rate = -1;
-    interface->last_reported_is_transport_rolling = false;
-    interface->last_reported_position = -1;
-
+    playspec_queue_init(&interface->scheduled_playspecs);
+    interface->pending_patch = NULL;
+    interface->applied_patch = NULL;
+    interface->period_frames = 0;
+    interface->segment_offset_in_period = 0;
+    interface->num_applied_playspecs = 0;
+    interface->stream_position = 0;
+    interface->stream_cycles = 0;
+    interface->stream_underruns = 0;
+    param_table_init(&interface->params);
+
+    interface->frame_rate = -1;
+    transport_init(&interface->transport);
+
+    interface->playspec_reports = NULL;
+    interface->num_playspec_reports = 0;
+    interface->playspec_reports_capacity = 0;
+
+    stream_add_interface(interface);
     driver->init(interface->driver_state);
     return interface->id;
 }
@@ -114,90 +173,155 @@ void iface_close(int interface_id)
     struct Interface *interface = get_interface_by_id(interface_id);
 
     interface->driver->destroy(interface->driver_state);
-    free(interface->input_chunk_queue_buffer);
-    free(interface->log_queue_buffer);
+    stream_forget_interface(interface);
+    mix_buffer_destroy(&interface->mix_buffer);
+    capture_ring_destroy(&interface->capture);
+    wakeup_destroy(interface);
+    event_log_destroy(&interface->log);
     free(interface->io_thread_queue_buffer);
     free(interface->python_thread_queue_buffer);
+    free(interface->playspec_reports);
 }
 
-static int py_thread_on_playspec_applied(
-    struct Interface *interface, union TaskArgument arg)
+static void add_playspec_report(
+    struct Interface *interface, int playspec_id, bool was_used)
 {
     /* Runs on the Python thread */
 
-    struct Playspec *old_playspec = interface->py_thread_current_playspec;
-    struct Playspec *new_playspec = arg.pointer;
+    if (interface->num_playspec_reports
+            == interface->playspec_reports_capacity) {
+        int capacity = interface->playspec_reports_capacity
+            ? 2 * interface->playspec_reports_capacity : 16;
+        interface->playspec_reports = realloc(
+            interface->playspec_reports,
+            capacity * sizeof(struct PlayspecReport));
+        interface->playspec_reports_capacity = capacity;
+    }
 
-    assert(old_playspec != new_playspec);
+    struct PlayspecReport *report =
+        &interface->playspec_reports[interface->num_playspec_reports++];
+    report->id = playspec_id;
+    report->was_used = was_used;
+}
 
-    if (old_playspec) {
-        free(old_playspec->entries);
-        free(old_playspec);
-    }
+static int py_thread_on_playspecs_applied(
+    struct Interface *interface, union TaskArgument arg)
+{
+    /* Runs on the Python thread */
+
+    /*
+     * The given number of playspecs was taken from the front of the queue,
+     * in order, and the last of them is now the current playspec
+     */
+    for (int i = 0; i < arg.integer; ++i) {
+        struct Playspec *old_playspec = interface->py_thread_current_playspec;
+        struct Playspec *new_playspec = playspec_queue_pop(
+            &interface->py_thread_scheduled_playspecs);
+
+        assert(old_playspec != new_playspec);
 
-    assert(new_playspec == interface->py_thread_pending_playspec);
+        if (old_playspec)
+            destroy_playspec(old_playspec);
 
-    interface->py_thread_current_playspec = new_playspec;
-    interface->py_thread_pending_playspec = NULL;
+        interface->py_thread_current_playspec = new_playspec;
+        add_playspec_report(
+            interface, new_playspec->id, !new_playspec->was_superseded);
+    }
 
+    stream_update_demand(interface);
     gc_audio_clips();
     return PY_QUEUE_PROCESSING_RESULT_PLAYSPEC_APPLIED;
 }
 
-static int py_thread_receive_current_pos(
+static int py_thread_on_patch_applied(
     struct Interface *interface, union TaskArgument arg)
 {
     /* Runs on the Python thread */
 
-    interface->last_reported_position = arg.integer;
-    return 0;
-}
+    struct PlayspecPatch *patch = arg.pointer;
 
-static int py_thread_receive_transport_state(
-    struct Interface *interface, union TaskArgument arg)
-{
-    /* Runs on the Python thread */
+    assert(patch == interface->py_thread_pending_patch);
 
-    interface->last_reported_is_transport_rolling = arg.integer;
-    return 0;
+    interface->py_thread_pending_patch = NULL;
+    add_playspec_report(interface, patch->id, true);
+    destroy_playspec_patch(patch);
+
+    stream_update_demand(interface);
+    gc_audio_clips();
+    return PY_QUEUE_PROCESSING_RESULT_PLAYSPEC_APPLIED;
 }
 
-static int apply_pending_playspec_if_needed(
+static int apply_scheduled_playspecs_if_needed(
     struct Interface *state,
-    int frame_in_playspec,
-    int start_from_offset)
+    int frame_in_playspec)
 {
     /* Runs on the I/O thread */
 
-    struct Playspec *old_playspec = state->current_playspec;
-    struct Playspec *new_playspec = state->pending_playspec;
+    bool applied_any = false;
+
+    /*
+     * Several playspecs may be due at the same time. All of them are
+     * applied back to back, and all but the last one are superseded.
+     */
+    while (state->scheduled_playspecs.count) {
+        struct Playspec *old_playspec = state->current_playspec;
+        struct Playspec *new_playspec =
+            playspec_queue_at(&state->scheduled_playspecs, 0);
 
-    if (!new_playspec)
-        return frame_in_playspec;  /* nothing to do */
+        assert(old_playspec != new_playspec);
 
-    assert(old_playspec != new_playspec);
+        if (old_playspec && frame_in_playspec < new_playspec->insert_at)
+            break;  /* We should wait and change the playspec later */
 
-    if (old_playspec && frame_in_playspec < new_playspec->insert_at)
-        return frame_in_playspec;  /* We should wait and change the playspec later */
+        /* Either there is no current playspec, or we already hit insert_at */
+
+        /* If we're late, skip the frames we missed in the new playspec */
+        int start_from_offset = 0;
+        if (frame_in_playspec > new_playspec->insert_at)
+            start_from_offset = frame_in_playspec - new_playspec->insert_at;
+
+        playspec_queue_pop(&state->scheduled_playspecs);
+        state->current_playspec = new_playspec;
+        frame_in_playspec = new_playspec->start_from + start_from_offset;
+        ++state->num_applied_playspecs;
+
+        /* Update reference indicators */
+        if (old_playspec) {
+            old_playspec->referenced_by_native_code = false;
+            if (applied_any)
+                old_playspec->was_superseded = true;
+        }
+        new_playspec->referenced_by_native_code = true;
+        applied_any = true;
+    }
 
-    /* Either there is no current playspec, or we already hit insert_at */
+    return frame_in_playspec;
+}
 
-    state->current_playspec = state->pending_playspec;
-    state->pending_playspec = NULL;
-    frame_in_playspec = new_playspec->start_from + start_from_offset;
+/* Notify the Python thread about the playspecs applied in this period */
+static void report_applied_playspecs(struct Interface *state)
+{
+    /* Runs on the I/O thread */
 
-    /* Update reference indicators */
-    if (old_playspec)
-        old_playspec->referenced_by_native_code = false;
-    new_playspec->referenced_by_native_code = true;
+    if (!state->num_applied_playspecs)
+        return;
 
-    /* Notify the Python thread that the playspec was applied */
-    if (!post_task_with_ptr_to_py_thread(
-        state, py_thread_on_playspec_applied, new_playspec)) {
-        // TODO handle failure
+    /* If the queue is full, try again in the next period */
+    if (post_task_with_int_to_py_thread(
+            state, py_thread_on_playspecs_applied,
+            state->num_applied_playspecs)) {
+        state->num_applied_playspecs = 0;
+        wake_python_thread(state);
     }
+}
 
-    return frame_in_playspec;
+/* Log an event at the position where the current period started */
+static void io_thread_log(
+    struct Interface *state, enum LogEvent event, int64_t value)
+{
+    /* Runs on the I/O thread */
+
+    log_event(state, event, state->transport.snapshot.position, value, NULL);
 }
 
 static void io_thread_set_playspec(
@@ -206,8 +330,61 @@ static void io_thread_set_playspec(
 {
     /* Runs on the I/O thread */
 
-    write_log(state, "I/O thread: Got MSG_SET_PLAYSPEC\n");
-    state->pending_playspec = arg.pointer;
+    struct Playspec *playspec = arg.pointer;
+    io_thread_log(state, LOG_EVENT_SET_PLAYSPEC, playspec->id);
+    playspec_queue_push(&state->scheduled_playspecs, playspec);
+}
+
+/* Notify the Python thread about the patch applied, if any */
+static void report_applied_patch(struct Interface *state)
+{
+    /* Runs on the I/O thread */
+
+    if (!state->applied_patch)
+        return;
+
+    /* If the queue is full, try again in the next period */
+    if (post_task_with_ptr_to_py_thread(
+            state, py_thread_on_patch_applied, state->applied_patch)) {
+        state->applied_patch = NULL;
+        wake_python_thread(state);
+    }
+}
+
+static void apply_pending_patch_if_needed(
+    struct Interface *state,
+    int frame_in_playspec)
+{
+    /* Runs on the I/O thread */
+
+    struct PlayspecPatch *patch = state->pending_patch;
+
+    if (!patch)
+        return;
+
+    if (frame_in_playspec < patch->apply_at)
+        return;
+
+    assert(patch->playspec == state->current_playspec);
+
+    apply_playspec_patch(patch);
+    state->pending_patch = NULL;
+
+    /* The Python thread accepts no patch until this one is reported */
+    assert(!state->applied_patch);
+    state->applied_patch = patch;
+    report_applied_patch(state);
+}
+
+static void io_thread_set_playspec_patch(
+    struct Interface *state, struct Driver *driver,
+    void *driver_handle, union TaskArgument arg)
+{
+    /* Runs on the I/O thread */
+
+    struct PlayspecPatch *patch = arg.pointer;
+    io_thread_log(state, LOG_EVENT_SET_PLAYSPEC_PATCH, patch->id);
+    state->pending_patch = patch;
 }
 
 static void io_thread_set_pos(
@@ -216,7 +393,7 @@ static void io_thread_set_pos(
 {
     /* Runs on the I/O thread */
 
-    write_log(state, "I/O thread: Got MSG_SET_POS\n");
+    io_thread_log(state, LOG_EVENT_SET_POSITION, arg.integer);
     driver->set_position(driver_handle, arg.integer);
 }
 
@@ -226,7 +403,7 @@ static void io_thread_set_transport_state(
 {
     /* Runs on the I/O thread */
 
-    write_log(state, "I/O thread: Got MSG_SET_TRANSPORT_STATE\n");
+    io_thread_log(state, LOG_EVENT_SET_TRANSPORT_STATE, arg.integer);
     driver->set_is_transport_rolling(driver_handle, arg.integer);
 }
 
@@ -237,10 +414,22 @@ static void process_messages_on_jack_queue(
 {
     /* Runs on the I/O thread */
 
+    /* A transaction is processed whole, even beyond the budget */
+    int budget = IO_THREAD_MESSAGES_PER_PERIOD;
+    int transaction_left = 0;
     struct Task message;
-    if (PaUtil_ReadRingBuffer(&state->io_thread_queue, &message, 1) > 0) {
-        message.callable.io_thread_callable(
-            state, driver, driver_handle, message.arg);
+    while ((budget > 0 || transaction_left > 0)
+            && PaUtil_ReadRingBuffer(&state->io_thread_queue, &message, 1)) {
+        if (transaction_left > 0)
+            --transaction_left;
+        else
+            --budget;
+
+        if (message.callable.io_thread_callable == io_thread_transaction)
+            transaction_left = message.arg.integer;
+        else
+            message.callable.io_thread_callable(
+                state, driver, driver_handle, message.arg);
     }
 }
 
@@ -260,54 +449,206 @@ int iface_process_messages_on_python_queue(int interface_id)
     return 0;
 }
 
-static void mix_playspec_entry_into_jack_ports_at(
-    struct PlayspecEntry *entry,
-    jack_default_audio_sample_t *port_l,
-    jack_default_audio_sample_t *port_r,
+/* Division rounding towards negative infinity (for positive divisors) */
+static int floor_div(int a, int b)
+{
+    int q = a / b;
+    if (a % b < 0)
+        --q;
+    return q;
+}
+
+/* Gains of a row at the given frame of the row and position in the period */
+static void row_gains_at(
+    struct Interface *state,
+    struct RenderList *list,
+    int row,
+    const struct ParamSlot *slot,
+    int frame_in_row,
+    int position_in_period,
+    float *gain_l,
+    float *gain_r)
+{
+    /* Runs on the I/O thread */
+
+    float fade = render_list_fade_gain(&list->fades[row], frame_in_row);
+    *gain_l = list->gain_l[row] * fade;
+    *gain_r = list->gain_r[row] * fade;
+
+    if (slot) {
+        float slot_gain_l, slot_gain_r;
+        param_slot_gains_at(
+            slot, (float)position_in_period / state->period_frames,
+            &slot_gain_l, &slot_gain_r);
+        *gain_l *= slot_gain_l;
+        *gain_r *= slot_gain_r;
+    }
+}
+
+/*
+ * Mix a row whose gains change over the mixed frames, because of its fades
+ * or because the gains of its parameter slot ramp during the period.
+ * The frames are split into segments at the ends of the fades and at least
+ * every fades->segment_frames frames, and each segment is mixed with
+ * a linear ramp between the exact gains of its first and last frame.
+ * A linear fade or a slot ramp alone is then reproduced exactly.
+ */
+static void mix_render_row_enveloped(
+    struct Interface *state,
+    struct RenderList *list,
+    int row,
+    const struct ParamSlot *slot,
+    int offset,
+    const char *data,
+    int frame_in_row,
+    int frames)
+{
+    /* Runs on the I/O thread */
+
+    const struct RowFades *fades = &list->fades[row];
+    int fade_in_end = fades->in - fades->offset;
+    int fade_out_start = fades->length - fades->out - fades->offset;
+    int frame_size = list->frame_size[row];
+    int end = frame_in_row + frames;
+
+    while (frame_in_row < end) {
+        int segment_end = frame_in_row + fades->segment_frames;
+        if (segment_end > end)
+            segment_end = end;
+        if (frame_in_row < fade_in_end && segment_end > fade_in_end)
+            segment_end = fade_in_end;
+        if (frame_in_row < fade_out_start && segment_end > fade_out_start)
+            segment_end = fade_out_start;
+
+        int n = segment_end - frame_in_row;
+        int position = state->segment_offset_in_period + offset;
+
+        float first_l, first_r, last_l, last_r;
+        row_gains_at(
+            state, list, row, slot, frame_in_row, position,
+            &first_l, &first_r);
+        row_gains_at(
+            state, list, row, slot, segment_end - 1, position + n - 1,
+            &last_l, &last_r);
+
+        float step_l = n > 1 ? (last_l - first_l) / (n - 1) : 0.0f;
+        float step_r = n > 1 ? (last_r - first_r) / (n - 1) : 0.0f;
+
+        mix_samples_ramped(
+            &state->mix_buffer,
+            offset,
+            list->kernel[row],
+            data,
+            list->channels[row],
+            n,
+            first_l,
+            first_r,
+            step_l,
+            step_r);
+
+        data += n * frame_size;
+        offset += n;
+        frame_in_row = segment_end;
+    }
+}
+
+/* Whether frames [a, b) of a row overlap any of its fades */
+static bool overlaps_fades(const struct RowFades *fades, int a, int b)
+{
+    if (fades->in && a < fades->in - fades->offset)
+        return true;
+    if (fades->out && b > fades->length - fades->out - fades->offset)
+        return true;
+    return false;
+}
+
+static void mix_render_row_at(
+    struct Interface *state,
+    struct RenderList *list,
+    int row,
     int a_in_playspec,
     int frame_in_playspec,
     int frames_to_copy)
 {
     /* Runs on the I/O thread */
 
-    struct AudioClip *clip = get_audio_clip_by_id(entry->audio_clip_id);
+    int b_in_playspec = a_in_playspec + list->length[row];
+    int skipped = 0;
+
+    /* Clamp playspec positions */
+    if (a_in_playspec < frame_in_playspec) {
+        skipped = frame_in_playspec - a_in_playspec;
+        a_in_playspec = frame_in_playspec;
+    }
+    if (b_in_playspec > frame_in_playspec + frames_to_copy)
+        b_in_playspec = frame_in_playspec + frames_to_copy;
 
-    if (!clip)
+    if (a_in_playspec >= b_in_playspec)
         return;
 
-    int a_in_clip = entry->clip_frame_a;
-    int b_in_clip = entry->clip_frame_b;
+    int offset = a_in_playspec - frame_in_playspec;
+    int frames = b_in_playspec - a_in_playspec;
+    float gain_l = list->gain_l[row];
+    float gain_r = list->gain_r[row];
+
+    const struct ParamSlot *slot = NULL;
+    if (list->param_slot[row] >= 0) {
+        slot = &state->params.slots[list->param_slot[row]];
+        if (!param_slot_is_ramping(slot)
+                && slot->end_gain_l == 0.0 && slot->end_gain_r == 0.0)
+            return;  /* muted */
+    }
 
-    int b_in_playspec = a_in_playspec + (b_in_clip - a_in_clip);
+    bool enveloped = (slot && param_slot_is_ramping(slot))
+        || overlaps_fades(&list->fades[row], skipped, skipped + frames);
 
-    /* Clamp playspec positions */
-    if (a_in_playspec < frame_in_playspec) {
-        int delta = frame_in_playspec - a_in_playspec;
-        a_in_playspec += delta;
-        a_in_clip += delta;
-    }
-    if (b_in_playspec > frame_in_playspec + frames_to_copy) {
-        int delta = b_in_playspec - (frame_in_playspec + frames_to_copy);
-        b_in_playspec -= delta;
-        b_in_clip -= delta;
+    if (slot) {
+        gain_l *= slot->end_gain_l;
+        gain_r *= slot->end_gain_r;
     }
 
-    if (a_in_playspec < b_in_playspec && a_in_playspec < frame_in_playspec + frames_to_copy) {
-        int delta = a_in_playspec - frame_in_playspec;
-        add_clip_data_to_jack_port(
-            port_l + delta, port_r + delta,
-            clip,
-            a_in_clip,
-            b_in_clip,
-            entry->gain_l,
-            entry->gain_r);
+    /* The frames may span several blocks of clip data */
+    while (frames > 0) {
+        int n;
+        const char *data = render_list_row_data(list, row, skipped, &n);
+        if (n > frames)
+            n = frames;
+
+        /* Silent granules of the clip add nothing */
+        bool silent;
+        n = render_list_row_silence_run(list, row, skipped, n, &silent);
+
+        if (silent) {
+            /* Nothing to mix */
+        } else if (!data) {
+            /*
+             * A block of a streaming clip that isn't loaded, or spilled data
+             * that isn't read back yet: play silence
+             */
+            stream_report_underrun(state, list->clip[row]);
+        } else if (enveloped) {
+            mix_render_row_enveloped(
+                state, list, row, slot, offset, data, skipped, n);
+        } else {
+            mix_samples(
+                &state->mix_buffer,
+                offset,
+                list->kernel[row],
+                data,
+                list->channels[row],
+                n,
+                gain_l,
+                gain_r);
+        }
+
+        offset += n;
+        skipped += n;
+        frames -= n;
     }
 }
 
-static void mix_playspec_into_jack_ports(
+static void mix_playspec_into_mix_buffer(
     struct Interface *state,
-    jack_default_audio_sample_t *port_l,
-    jack_default_audio_sample_t *port_r,
     int frame_in_playspec,
     int frames_to_copy)
 {
@@ -319,36 +660,41 @@ static void mix_playspec_into_jack_ports(
     if (frames_to_copy == 0)
         return;
 
-    for (int entry_number = 0;
-         entry_number < state->current_playspec->num_entries;
-         ++entry_number) {
-        struct PlayspecEntry *entry = &state->current_playspec->entries[entry_number];
+    struct RenderList *list = state->current_playspec->render_list;
+
+    /* Non-repeating rows: only the ones found by the time indices */
+    render_list_update_active_rows(list, frame_in_playspec, frames_to_copy);
+    for (int i = 0; i < list->num_active_rows; ++i) {
+        int row = list->active_rows[i];
+        if (!list->enabled[row])
+            continue;
+        mix_render_row_at(
+            state, list, row, list->start[row],
+            frame_in_playspec, frames_to_copy);
+    }
 
-        if (entry->repeat_interval == 0) {
-            /* No repetitions. */
+    /* Periodic rows */
+    int end_frame = frame_in_playspec + frames_to_copy;
+    for (int i = 0; i < list->num_periodic_rows; ++i) {
+        int row = list->periodic_rows[i];
+        if (!list->enabled[row])
+            continue;
+        int interval = list->repeat_interval[row];
+        int start = list->start[row];
 
-            mix_playspec_entry_into_jack_ports_at(
-                entry, port_l, port_r, entry->play_at_frame,
+        /*
+         * Repetitions k for which the row overlaps the range, that is:
+         * start + k * interval + length > frame_in_playspec
+         * and start + k * interval < end_frame
+         */
+        int first = floor_div(
+            frame_in_playspec - list->length[row] - start, interval) + 1;
+        int last = floor_div(end_frame - 1 - start, interval);
+
+        for (int k = first; k <= last; ++k) {
+            mix_render_row_at(
+                state, list, row, start + k * interval,
                 frame_in_playspec, frames_to_copy);
-        } else {
-            /* Periodic playspec entry. */
-
-            /* Make sure 0 <= play_at_frame < repeat_interval */
-            int frame = entry->play_at_frame;
-            int interval = entry->repeat_interval;
-            int play_at_frame = frame - (frame / interval * interval);
-
-            /* Find the last repetition that falls into the range */
-            int end_frame = frame_in_playspec + frames_to_copy;
-            int a_in_playspec = end_frame / interval * interval + play_at_frame;
-
-            int clip_length = entry->clip_frame_b - entry->clip_frame_a;
-            while (a_in_playspec + clip_length >= frame_in_playspec) {
-                mix_playspec_entry_into_jack_ports_at(
-                    entry, port_l, port_r, a_in_playspec,
-                    frame_in_playspec, frames_to_copy);
-                a_in_playspec -= interval;
-            }
         }
     }
 }
@@ -363,19 +709,9 @@ void process_input_with_buffers(
 {
     /* Runs on the I/O thread */
 
-    struct InputChunk clip;
-    jack_nframes_t clip_i;
-    jack_nframes_t buffer_i = 0;
-    while (buffer_i < nframes) {
-        clip.playspec_id = interface->current_playspec->id;
-        clip.starting_frame = starting_frame + buffer_i;
-        clip.was_transport_rolling = transport_state;
-        for (clip_i = 0; clip_i < INPUT_CLIP_LENGTH / 2; ++clip_i, ++buffer_i) {
-            clip.samples[2 * clip_i + 0] = port_l[buffer_i];
-            clip.samples[2 * clip_i + 1] = port_r[buffer_i];
-        }
-        write_input_samples(interface, &clip);
-    }
+    capture_ring_write(
+        &interface->capture, nframes, port_l, port_r,
+        interface->current_playspec->id, starting_frame, transport_state);
 }
 
 jack_nframes_t process_output_with_buffers(
@@ -388,92 +724,224 @@ jack_nframes_t process_output_with_buffers(
 {
     /* Runs on the I/O thread */
 
-    post_task_with_int_to_py_thread(
-        state, py_thread_receive_current_pos, frame_in_playspec);
-    post_task_with_int_to_py_thread(
-        state, py_thread_receive_transport_state, is_transport_rolling?1:0);
-
-    clear_jack_port(port_l, port_r, nframes);
+    struct TransportSnapshot snapshot;
+    snapshot.period = state->transport.snapshot.period + 1;
+    snapshot.frame_rate = state->frame_rate;
+    snapshot.position = frame_in_playspec;
+    snapshot.is_transport_rolling = is_transport_rolling ? 1 : 0;
+    snapshot.playspec_id = state->current_playspec->id;
+    transport_publish(&state->transport, &snapshot);
+
+    /* The input captured so far isn't urgent */
+    state->frames_since_wakeup += nframes;
+    if (state->frames_since_wakeup >= WAKEUP_INTERVAL_FRAMES)
+        wake_python_thread(state);
+
+    param_table_begin_period(&state->params);
+    state->period_frames = nframes;
+
+    /*
+     * Tell the stream reader where playback is, and that the blocks
+     * it evicted before this period are no longer in use
+     */
+    __atomic_store_n(
+        &state->stream_position, frame_in_playspec, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&state->stream_cycles, 1, __ATOMIC_SEQ_CST);
 
     if (!is_transport_rolling) {
-        int start_from_offset = 0;
-        if (state->pending_playspec
-                && frame_in_playspec > state->pending_playspec->insert_at)
-            start_from_offset =
-                frame_in_playspec - state->pending_playspec->insert_at;
-        frame_in_playspec = apply_pending_playspec_if_needed(
-            state, frame_in_playspec, start_from_offset);
+        clear_jack_port(port_l, port_r, nframes);
+
+        frame_in_playspec = apply_scheduled_playspecs_if_needed(
+            state, frame_in_playspec);
+        apply_pending_patch_if_needed(state, frame_in_playspec);
+        report_applied_playspecs(state);
+        report_applied_patch(state);
         process_messages_on_jack_queue(
             state, state->driver, state->driver_state);
         return frame_in_playspec;
     }
 
+    /*
+     * The period is mixed in blocks that fit into the mix buffer.
+     * Every block is written to the port buffers exactly once.
+     */
     jack_nframes_t frames_copied = 0;
     while (frames_copied < nframes) {
-        int frames_to_copy = nframes - frames_copied;
-        int start_from_offset = 0;
+        jack_nframes_t block_start = frames_copied;
+        jack_nframes_t block_end = nframes;
+        if (block_end - block_start > MIX_BUFFER_FRAMES)
+            block_end = block_start + MIX_BUFFER_FRAMES;
+
+        while (frames_copied < block_end) {
+            int frames_to_copy = block_end - frames_copied;
+
+            /*
+             * Apply the pending patch if we've reached it. Otherwise,
+             * stop copying where it should be applied.
+             */
+            apply_pending_patch_if_needed(state, frame_in_playspec);
+            if (state->pending_patch) {
+                int ahead_by =
+                    state->pending_patch->apply_at - frame_in_playspec;
+                if (frames_to_copy > ahead_by)
+                    frames_to_copy = ahead_by;
+            }
 
-        /*
-         * Check if we'll hit the playspec change in this clip.
-         * If yes, limit the number of frames to copy.
-         */
-        if (state->pending_playspec) {
-            int ahead_by =
-                state->pending_playspec->insert_at - frame_in_playspec;
-            if (frames_to_copy > ahead_by)
-                frames_to_copy = ahead_by;
-            if (frames_to_copy < 0) {
-                start_from_offset = -frames_to_copy;
-                frames_to_copy = 0;
+            /*
+             * Check if we'll hit the next playspec change in this clip.
+             * If yes, limit the number of frames to copy.
+             */
+            if (state->scheduled_playspecs.count) {
+                struct Playspec *next_playspec =
+                    playspec_queue_at(&state->scheduled_playspecs, 0);
+                int ahead_by = next_playspec->insert_at - frame_in_playspec;
+                if (frames_to_copy > ahead_by)
+                    frames_to_copy = ahead_by;
+                if (frames_to_copy < 0)
+                    frames_to_copy = 0;
             }
+
+            state->segment_offset_in_period = frames_copied;
+            mix_buffer_begin_segment(
+                &state->mix_buffer,
+                frames_copied - block_start,
+                frames_to_copy);
+            mix_playspec_into_mix_buffer(
+                state,
+                frame_in_playspec,
+                frames_to_copy);
+            mix_buffer_end_segment(&state->mix_buffer);
+            frames_copied += frames_to_copy;
+            frame_in_playspec += frames_to_copy;
+
+            frame_in_playspec = apply_scheduled_playspecs_if_needed(
+                state, frame_in_playspec);
         }
 
-        mix_playspec_into_jack_ports(
-            state,
-            port_l + frames_copied,
-            port_r + frames_copied,
-            frame_in_playspec,
-            frames_to_copy);
-        frames_copied += frames_to_copy;
-        frame_in_playspec += frames_to_copy;
-
-        frame_in_playspec = apply_pending_playspec_if_needed(
-            state, frame_in_playspec, start_from_offset);
+        mix_buffer_store(
+            &state->mix_buffer,
+            port_l + block_start,
+            port_r + block_start,
+            block_end - block_start);
     }
-    clamp_jack_port(port_l, port_r, nframes);
 
+    report_applied_playspecs(state);
+    report_applied_patch(state);
     process_messages_on_jack_queue(state, state->driver, state->driver_state);
 
     return frame_in_playspec;
 }
 
-int iface_set_playspec(int interface_id)
+static int submit_playspec(
+    struct Interface *interface, struct Playspec *playspec)
 {
     /* Runs on the Python thread */
 
-    struct Interface *interface = get_interface_by_id(interface_id);
-    struct Playspec *playspec = get_built_playspec();
+    struct PlayspecQueue *scheduled = &interface->py_thread_scheduled_playspecs;
 
-    if (interface->py_thread_pending_playspec)
+    if (scheduled->count == MAX_SCHEDULED_PLAYSPECS
+            || interface->py_thread_pending_patch) {
+        destroy_playspec(playspec);
         return -1;
+    }
 
-    interface->py_thread_pending_playspec = playspec;
+    playspec->render_list = compile_render_list(playspec);
 
     if (!post_task_with_ptr_to_io_thread(
             interface, io_thread_set_playspec, playspec)) {
-        interface->py_thread_pending_playspec = NULL;
+        destroy_playspec(playspec);
         return -1;
     }
 
+    playspec_queue_push(scheduled, playspec);
+    stream_update_demand(interface);
+
     return playspec->id;
 }
 
+int iface_set_playspec(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    return submit_playspec(interface, get_built_playspec());
+}
+
+int iface_apply_playspec_patch(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    struct PlayspecPatch *patch = get_built_playspec_patch();
+
+    if (!patch)
+        return -1;
+
+    if (patch->playspec != interface->py_thread_current_playspec
+            || interface->py_thread_scheduled_playspecs.count
+            || interface->py_thread_pending_patch) {
+        undo_playspec_patch(patch);
+        destroy_playspec_patch(patch);
+        return -1;
+    }
+
+    if (!playspec_patch_fits(patch)) {
+        /*
+         * The render list has no room for the new rows.
+         * Rebuild the whole playspec instead.
+         */
+        struct Playspec *playspec = copy_playspec(
+            patch->playspec, patch->apply_at, patch->apply_at);
+        undo_playspec_patch(patch);
+        destroy_playspec_patch(patch);
+        return submit_playspec(interface, playspec);
+    }
+
+    patch->id = allocate_playspec_id();
+    interface->py_thread_pending_patch = patch;
+
+    if (!post_task_with_ptr_to_io_thread(
+            interface, io_thread_set_playspec_patch, patch)) {
+        interface->py_thread_pending_patch = NULL;
+        undo_playspec_patch(patch);
+        destroy_playspec_patch(patch);
+        return -1;
+    }
+
+    stream_update_demand(interface);
+    return patch->id;
+}
+
+void py_thread_withdraw_task(
+    struct Interface *interface, const struct Task *task)
+{
+    /* Runs on the Python thread */
+
+    IoThreadCallable callable = task->callable.io_thread_callable;
+
+    if (callable == io_thread_set_playspec) {
+        /* Messages are withdrawn in reverse, so it's the last one scheduled */
+        struct Playspec *playspec = playspec_queue_pop_last(
+            &interface->py_thread_scheduled_playspecs);
+        assert(playspec == task->arg.pointer);
+        destroy_playspec(playspec);
+        stream_update_demand(interface);
+    } else if (callable == io_thread_set_playspec_patch) {
+        struct PlayspecPatch *patch = task->arg.pointer;
+        assert(patch == interface->py_thread_pending_patch);
+        interface->py_thread_pending_patch = NULL;
+        undo_playspec_patch(patch);
+        destroy_playspec_patch(patch);
+        stream_update_demand(interface);
+    }
+}
+
 int iface_get_frame_rate(int interface_id)
 {
     /* Runs on the Python thread */
 
     struct Interface *interface = get_interface_by_id(interface_id);
-    return interface->last_reported_frame_rate;
+    return interface->frame_rate;
 }
 
 int iface_get_position(int interface_id)
@@ -481,7 +949,9 @@ int iface_get_position(int interface_id)
     /* Runs on the Python thread */
 
     struct Interface *interface = get_interface_by_id(interface_id);
-    return interface->last_reported_position;
+    struct TransportSnapshot snapshot;
+    transport_read(&interface->transport, &snapshot);
+    return snapshot.position;
 }
 
 void iface_set_position(int interface_id, int position)
@@ -497,7 +967,23 @@ int iface_get_transport_rolling(int interface_id)
     /* Runs on the Python thread */
 
     struct Interface *interface = get_interface_by_id(interface_id);
-    return interface->last_reported_is_transport_rolling;
+    struct TransportSnapshot snapshot;
+    transport_read(&interface->transport, &snapshot);
+    return snapshot.is_transport_rolling;
+}
+
+void iface_set_param_slot(
+    int interface_id,
+    int slot,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    param_table_set(&interface->params, slot, gain_l, gain_r, mute, solo);
 }
 
 void iface_set_transport_rolling(int interface_id, int rolling)
@@ -517,9 +1003,39 @@ int iface_get_current_playspec_id(int interface_id)
     if (!interface)
         return -1;
 
-    struct Playspec *playspec = interface->current_playspec;
-    if (!playspec)
-        return -1;
+    /* The I/O thread swaps the current playspec and patches change its id */
+    struct TransportSnapshot snapshot;
+    transport_read(&interface->transport, &snapshot);
+    return snapshot.playspec_id;
+}
 
-    return playspec->id;
+int iface_get_stream_underruns(int interface_id)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    return __atomic_load_n(&interface->stream_underruns, __ATOMIC_RELAXED);
+}
+
+int iface_get_playspec_reports(int interface_id, char *bytearray, int n)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+
+    int count = n / sizeof(struct PlayspecReport);
+    if (count > interface->num_playspec_reports)
+        count = interface->num_playspec_reports;
+
+    memcpy(bytearray, interface->playspec_reports,
+        count * sizeof(struct PlayspecReport));
+
+    /* Keep the reports that didn't fit for the next call */
+    memmove(interface->playspec_reports,
+        interface->playspec_reports + count,
+        (interface->num_playspec_reports - count)
+            * sizeof(struct PlayspecReport));
+    interface->num_playspec_reports -= count;
+
+    return count;
 }
@@ -2,13 +2,47 @@
 #define AUDIO_IO_H
 
 #include <jack/jack.h>
+#include <stdint.h>
 
+#include "capture.h"
 #include "communication.h"
 #include "driver.h"
+#include "event_log.h"
+#include "mixer.h"
+#include "param_table.h"
 #include "playspec.h"
+#include "playspec_patch.h"
+#include "transport.h"
 
 #define MAX_INTERFACES 32
 
+/*
+ * Maximum number of playspecs that can be scheduled on an interface
+ * (set, but not yet applied) at the same time
+ */
+#define MAX_SCHEDULED_PLAYSPECS 16
+
+/*
+ * Outcome of a scheduled playspec or patch, reported to Python.
+ * A playspec that was replaced by the next scheduled one at the same
+ * frame at which it was applied was never used.
+ */
+struct PlayspecReport
+{
+    int32_t id;
+    int32_t was_used;
+};
+
+/*
+ * Fixed-size FIFO of scheduled playspecs, in the order they were set
+ */
+struct PlayspecQueue
+{
+    struct Playspec *playspecs[MAX_SCHEDULED_PLAYSPECS];
+    int first;
+    int count;
+};
+
 /*
  * Data that is tied to every instantiated interface.
  */
@@ -20,16 +54,42 @@ struct Interface
      * the I/O thread potentially may want to access.
      */
     struct Playspec *py_thread_current_playspec;
-    struct Playspec *py_thread_pending_playspec;
+    struct PlayspecQueue py_thread_scheduled_playspecs;
+    struct PlayspecPatch *py_thread_pending_patch;
 
     /* Only accessible from the I/O thread */
     struct Playspec *current_playspec;
-    struct Playspec *pending_playspec;
+    struct PlayspecQueue scheduled_playspecs;
+    struct PlayspecPatch *pending_patch;
+    struct MixBuffer mix_buffer;
+
+    /*
+     * Patch that was applied, but not yet reported to the Python thread
+     * because its queue was full. It's reported again in the next period.
+     */
+    struct PlayspecPatch *applied_patch;
 
-    /* Only accessible from the Python thread */
-    int last_reported_frame_rate;
-    bool last_reported_is_transport_rolling;
-    int last_reported_position;
+    /* Length of the current period, and where the current segment starts */
+    int period_frames;
+    int segment_offset_in_period;
+
+    /*
+     * Number of playspecs taken from scheduled_playspecs since
+     * the last report to the Python thread. They are reported in one
+     * message, at most once per period.
+     */
+    int num_applied_playspecs;
+
+    /* Set by the driver before it starts the I/O thread */
+    int frame_rate;
+
+    /* Published by the I/O thread at the start of every period */
+    struct PublishedTransport transport;
+
+    /* Outcomes of playspecs and patches not yet collected by Python */
+    struct PlayspecReport *playspec_reports;
+    int num_playspec_reports;
+    int playspec_reports_capacity;
 
     /*
      * Python thread queue - used for passing messages
@@ -46,24 +106,53 @@ struct Interface
     struct Task *io_thread_queue_buffer;
 
     /*
-     * Ring buffer containing characters that were scheduled by the I/O thread
-     * to be printed on the Python thread.
+     * Only accessible from the Python thread: number of messages posted
+     * in the open transaction, or -1 if there is none, and whether
+     * a message of the transaction was refused, so that it's discarded
+     */
+    int io_transaction_size;
+    bool io_transaction_failed;
+
+    /* Events logged by the I/O thread, to be logged by the Python thread */
+    struct EventLog log;
+
+    /*
+     * Pipe through which the I/O thread wakes the Python thread, whether
+     * a wakeup wasn't acknowledged yet, and the frames processed since
+     * the last wakeup (only accessible from the I/O thread)
      */
-    PaUtilRingBuffer log_queue;
-    char *log_queue_buffer;
+    int wakeup_fds[2];
+    int wakeup_pending;
+    int frames_since_wakeup;
 
     /*
-     * Ring buffer containing input samples that were received by the JACK
-     * thread from the audio interface. Read by the Python thread.
+     * Input samples that were received by the JACK thread from the audio
+     * interface. Read by the Python thread.
      */
-    PaUtilRingBuffer input_chunk_queue;
-    struct InputChunk *input_chunk_queue_buffer;
+    struct CaptureRing capture;
+
+    /*
+     * Shared with the stream reader thread: the playspec frame at the start
+     * of the current period, ahead of which streaming clips are prefetched,
+     * and the number of periods started, by which the reader knows when
+     * the I/O thread can no longer use the blocks it evicted
+     */
+    int stream_position;
+    unsigned stream_cycles;
+
+    /* Number of times a block of a streaming clip wasn't loaded in time */
+    int stream_underruns;
+
+    /* Gains of tracks or groups, shared by the Python and I/O threads */
+    struct ParamTable params;
 
     /* Driver talks to audio system such as ALSA, PulseAudio, JACK */
     struct Driver *driver;
     void *driver_state;
 };
 
+struct Playspec * playspec_queue_at(struct PlayspecQueue *queue, int i);
+
 struct Interface * get_interface_by_id(int id);
 
 int iface_get_key(int interface_id);
@@ -76,6 +165,13 @@ int create_jack_interface(const char *client_name);
 
 void iface_close(int interface_id);
 
+/*
+ * Undo what posting the message to the I/O thread did on the Python
+ * thread, for a message of a discarded transaction
+ */
+void py_thread_withdraw_task(
+    struct Interface *interface, const struct Task *task);
+
 #define PY_QUEUE_PROCESSING_RESULT_NOTHING 0
 #define PY_QUEUE_PROCESSING_RESULT_PLAYSPEC_APPLIED 1
 int iface_process_messages_on_python_queue(int interface_id);
@@ -97,11 +193,29 @@ jack_nframes_t process_output_with_buffers(
     jack_default_audio_sample_t *port_r);
 
 int iface_set_playspec(int interface_id);
+int iface_apply_playspec_patch(int interface_id);
 int iface_get_frame_rate(int interface_id);
 int iface_get_position(int interface_id);
 void iface_set_position(int interface_id, int position);
 int iface_get_transport_rolling(int interface_id);
 void iface_set_transport_rolling(int interface_id, int rolling);
 int iface_get_current_playspec_id(int interface_id);
+void iface_set_param_slot(
+    int interface_id,
+    int slot,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo);
+
+/* Number of times a block of a streaming clip wasn't loaded in time */
+int iface_get_stream_underruns(int interface_id);
+
+/*
+ * Copy the outcomes of applied playspecs and patches into the bytearray,
+ * as struct PlayspecReport, and forget them. Returns the number of reports
+ * copied.
+ */
+int iface_get_playspec_reports(int interface_id, char *bytearray, int n);
 
 #endif
@@ -1,7 +1,8 @@
 from amio.audio_clip import InputAudioChunk
-from amio.playspec import Playspec
+from amio.playspec import AnyPlayspec, PlayspecPatch
 from collections import deque, namedtuple
-from typing import Callable, Dict, Optional
+from contextlib import contextmanager
+from typing import Callable, Dict, Iterator, List, Optional
 
 InputChunkCallback = Callable[[InputAudioChunk], None]
 PlayspecChangeCallback = Callable[[bool], None]
@@ -15,10 +16,30 @@ def _notify_all(*callbacks):
     return do_notify
 
 
+class TransportSnapshot(
+    namedtuple(
+        "TransportSnapshot",
+        "period frame_rate position is_transport_rolling playspec_id",
+    )
+):
+    """
+    State of the transport at the start of the latest period, all of it
+    captured at the same time. The period is a counter of periods.
+    """
+
+
 class PlayspecChange(
     namedtuple("PlayspecChange", "playspec insert_at start_from callback")
 ):
-    pass
+    def submit(self, interface: "Interface") -> Optional[int]:
+        return interface._set_current_playspec(
+            self.playspec, self.insert_at, self.start_from
+        )
+
+
+class PlayspecPatchChange(namedtuple("PlayspecPatchChange", "patch apply_at callback")):
+    def submit(self, interface: "Interface") -> Optional[int]:
+        return interface._apply_playspec_patch(self.patch, self.apply_at)
 
 
 class Interface:
@@ -27,9 +48,15 @@ class Interface:
         self._input_chunk_callback = None
         self._submitted_playspec_callbacks: Dict[int, PlayspecChangeCallback] = {}
         self._pending_playspecs = deque()
+        # IDs of the playspec changes submitted in the open transaction
+        self._transaction_playspec_ids: Optional[List[int]] = None
 
     @property
     def input_chunk_callback(self) -> InputChunkCallback:
+        """
+        Function called with every chunk of captured input. The chunk
+        belongs to the callback, which may keep it.
+        """
         return self._input_chunk_callback
 
     @input_chunk_callback.setter
@@ -38,21 +65,45 @@ class Interface:
 
     def schedule_playspec_change(
         self,
-        playspec: Playspec,
+        playspec: AnyPlayspec,
         insert_at: int,
         start_from: int,
         callback: Optional[PlayspecChangeCallback],
     ):
+        self._schedule_change(PlayspecChange(playspec, insert_at, start_from, callback))
+
+    def schedule_playspec_patch(
+        self,
+        patch: PlayspecPatch,
+        apply_at: int,
+        callback: Optional[PlayspecChangeCallback],
+    ):
+        """
+        Change the entries of the current playspec at the given frame
+        of the playspec. The callback is called like for a playspec change.
+        """
+        self._schedule_change(PlayspecPatchChange(patch, apply_at, callback))
+
+    def _schedule_change(self, change) -> None:
         if self.is_closed():
             raise ValueError("Operation on a closed AMIO interface")
-        playspec_id = self._set_current_playspec(playspec, insert_at, start_from)
+        transaction_ids = self._transaction_playspec_ids
+        if self._pending_playspecs:
+            if transaction_ids is not None:
+                raise ValueError("Playspec change can't wait in a transaction")
+            # Changes must be applied in order
+            self._pending_playspecs.append(change)
+            return
+        playspec_id = change.submit(self)
         if playspec_id is None:
-            self._pending_playspecs.append(
-                PlayspecChange(playspec, insert_at, start_from, callback)
-            )
+            if transaction_ids is not None:
+                raise ValueError("Playspec change can't wait in a transaction")
+            self._pending_playspecs.append(change)
         else:
-            if callback:
-                self._submitted_playspec_callbacks[playspec_id] = callback
+            if change.callback:
+                self._submitted_playspec_callbacks[playspec_id] = change.callback
+            if transaction_ids is not None:
+                transaction_ids.append(playspec_id)
 
     def secs_to_frame(self, seconds: float) -> int:
         return int(self.get_frame_rate() * seconds)
@@ -78,8 +129,45 @@ class Interface:
     def set_transport_rolling(self, rolling: bool) -> None:
         raise NotImplementedError
 
+    def get_transport_snapshot(self) -> TransportSnapshot:
+        raise NotImplementedError
+
+    @contextmanager
+    def transaction(self) -> Iterator[None]:
+        """
+        Apply the commands given in the with block, e.g. set_position,
+        schedule_playspec_change and set_transport_rolling, in the same
+        period. A playspec change that would have to wait for the previous
+        ones raises ValueError instead. If the with block raises, or the
+        commands don't all fit in the queue of the I/O thread, none of them
+        is applied, and the callbacks of the playspec changes aren't called.
+        """
+        yield
+
+    def set_param_slot(
+        self,
+        slot: int,
+        gain_l: float,
+        gain_r: float,
+        mute: bool = False,
+        solo: bool = False,
+    ) -> None:
+        """
+        Set the gains of a slot of the parameter table. They apply to all
+        playspec entries with this param_slot, in addition to the gains
+        of the entries. If any slot is soloed, entries that reference other
+        slots are muted. The change takes effect within a period, without
+        resending the playspec.
+        """
+        raise NotImplementedError
+
     def _set_current_playspec(
-        self, playspec: Playspec, insert_at: int, start_from: int
+        self, playspec: AnyPlayspec, insert_at: int, start_from: int
+    ) -> Optional[int]:
+        raise NotImplementedError
+
+    def _apply_playspec_patch(
+        self, patch: PlayspecPatch, apply_at: int
     ) -> Optional[int]:
         raise NotImplementedError
 
@@ -98,18 +186,29 @@ class Interface:
             self._input_chunk_callback(data)
 
     def _retry_setting_playspec_if_needed(self) -> None:
+        # Changes waiting from before must not join an open transaction
+        if self._transaction_playspec_ids is not None:
+            return
         while self._pending_playspecs:
-            playspec = self._pending_playspecs.popleft()
-            playspec_id = self._set_current_playspec(
-                playspec.playspec, playspec.insert_at, playspec.start_from
-            )
+            change = self._pending_playspecs.popleft()
+            playspec_id = change.submit(self)
             if playspec_id is None:
-                self._pending_playspecs.appendleft(playspec)
+                self._pending_playspecs.appendleft(change)
                 # We need to wait for the next opportunity
                 break
             else:
-                if playspec.callback:
-                    self._submitted_playspec_callbacks[playspec_id] = playspec.callback
+                if change.callback:
+                    self._submitted_playspec_callbacks[playspec_id] = change.callback
+
+    def _on_playspec_reported(self, playspec_id: int, was_used: bool):
+        """
+        Notify about the outcome of a single playspec or patch. Playspecs
+        that were replaced by the next scheduled one before playing any frame
+        are reported as not used.
+        """
+        callback = self._submitted_playspec_callbacks.pop(playspec_id, None)
+        if callback:
+            callback(was_used)
 
     def _on_playspec_applied(self, playspec_id: int):
         for i in list(self._submitted_playspec_callbacks.keys()):
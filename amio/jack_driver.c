@@ -57,7 +57,8 @@ static void * jack_create_state_object(
 static void jack_destroy(void *driver_state)
 {
     struct JackDriverState *state = driver_state;
-    jack_client_close(state->client);
+    if (state->client)
+        jack_client_close(state->client);
     free(state);
 }
 
@@ -139,25 +140,28 @@ static void jack_iface_init(void *driver_state)
     state->client = jack_client_open(
         state->client_name, options, &status, NULL);
     if (state->client == NULL) {
-        write_log(state->interface, "jack_client_open() failed\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_OPEN_FAILED, -1, status, NULL);
         if (status & JackServerFailed) {
-            write_log(state->interface, "Unable to connect to JACK server\n");
+            log_event(
+                state->interface, LOG_EVENT_JACK_SERVER_FAILED, -1, 0, NULL);
         }
         iface_close(state->interface->id);
         return;
     }
     if (status & JackServerStarted) {
-        write_log(state->interface, "JACK server started\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_SERVER_STARTED, -1, 0, NULL);
     }
     if (status & JackNameNotUnique) {
         state->client_name =
             jack_get_client_name(state->client);
-        write_log(state->interface, "Unique name assigned: ");
-        write_log(state->interface, state->client_name);
-        write_log(state->interface, "\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_NAME_ASSIGNED, -1, 0,
+            state->client_name);
     }
 
-    state->interface->last_reported_frame_rate = jack_get_sample_rate(
+    state->interface->frame_rate = jack_get_sample_rate(
         state->client);
 
     jack_set_process_callback(
@@ -176,7 +180,8 @@ static void jack_iface_init(void *driver_state)
 
     if ((state->input_port_l == NULL)
             || (state->input_port_r == NULL)) {
-        write_log(state->interface, "No more JACK ports available\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_NO_MORE_PORTS, -1, 0, NULL);
         iface_close(state->interface->id);
         return;
     }
@@ -193,13 +198,15 @@ static void jack_iface_init(void *driver_state)
 
     if ((state->output_port_l == NULL)
             || (state->output_port_r == NULL)) {
-        write_log(state->interface, "No more JACK ports available\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_NO_MORE_PORTS, -1, 0, NULL);
         iface_close(state->interface->id);
         return;
     }
 
     if (jack_activate(state->client)) {
-        write_log(state->interface, "Cannot activate JACK client\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_ACTIVATE_FAILED, -1, 0, NULL);
         iface_close(state->interface->id);
         return;
     }
@@ -207,19 +214,24 @@ static void jack_iface_init(void *driver_state)
     ports = jack_get_ports(state->client, NULL, NULL,
                            JackPortIsPhysical|JackPortIsOutput);
     if (ports == NULL) {
-        write_log(state->interface, "No physical capture ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_NO_CAPTURE_PORTS, -1, 0, NULL);
         iface_close(state->interface->id);
         return;
     }
 
     if (jack_connect(state->client,
             ports[0], jack_port_name(state->input_port_l))) {
-        write_log(state->interface, "Cannot connect input ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_CONNECT_INPUT_FAILED,
+            -1, 0, NULL);
     }
 
     if (jack_connect(state->client,
             ports[1], jack_port_name(state->input_port_r))) {
-        write_log(state->interface, "Cannot connect input ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_CONNECT_INPUT_FAILED,
+            -1, 0, NULL);
     }
 
     /*
@@ -237,19 +249,24 @@ static void jack_iface_init(void *driver_state)
     ports = jack_get_ports(state->client, NULL, NULL,
                            JackPortIsPhysical|JackPortIsInput);
     if (ports == NULL) {
-        write_log(state->interface, "No physical playback ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_NO_PLAYBACK_PORTS, -1, 0, NULL);
         iface_close(state->interface->id);
         return;
     }
 
     if (jack_connect(state->client,
             jack_port_name(state->output_port_l), ports[0])) {
-        write_log(state->interface, "Cannot connect output ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_CONNECT_OUTPUT_FAILED,
+            -1, 0, NULL);
     }
 
     if (jack_connect(state->client,
             jack_port_name(state->output_port_r), ports[1])) {
-        write_log(state->interface, "Cannot connect output ports\n");
+        log_event(
+            state->interface, LOG_EVENT_JACK_CONNECT_OUTPUT_FAILED,
+            -1, 0, NULL);
     }
 
     /*
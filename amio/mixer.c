@@ -1,71 +1,1767 @@
 #include "mixer.h"
 
-void add_clip_data_to_jack_port(
-    jack_default_audio_sample_t *port_l,
-    jack_default_audio_sample_t *port_r,
-    struct AudioClip *clip,
-    int pos_a,
-    int pos_b,
-    float gain_l,
-    float gain_r)
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AMIO_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Kernels are written as templates taking an extra "add" flag. The flag
+ * is a compile-time constant in every instantiation, so the compiler
+ * generates separate "add" and "set" loops without a branch inside.
+ * All kernels take the same arguments, even those they don't need.
+ */
+
+#define MIX_KERNEL_ARGS(sample_type) \
+    jack_default_audio_sample_t *acc_l, \
+    jack_default_audio_sample_t *acc_r, \
+    const sample_type *data, \
+    int channels, \
+    int frames, \
+    float gain_l, \
+    float gain_r
+
+#define DEFINE_MIX_KERNELS(template, add_kernel, set_kernel, attributes) \
+    attributes static void add_kernel(MIX_KERNEL_ARGS(void)) \
+    { \
+        template(acc_l, acc_r, data, channels, frames, gain_l, gain_r, true); \
+    } \
+    attributes static void set_kernel(MIX_KERNEL_ARGS(void)) \
+    { \
+        template(acc_l, acc_r, data, channels, frames, gain_l, gain_r, false); \
+    }
+
+#define MIX_RAMP_KERNEL_ARGS(sample_type) \
+    MIX_KERNEL_ARGS(sample_type), \
+    float step_l, \
+    float step_r
+
+#define DEFINE_MIX_RAMP_KERNELS(template, add_kernel, set_kernel, attributes) \
+    attributes static void add_kernel(MIX_RAMP_KERNEL_ARGS(void)) \
+    { \
+        template( \
+            acc_l, acc_r, data, channels, frames, \
+            gain_l, gain_r, step_l, step_r, true); \
+    } \
+    attributes static void set_kernel(MIX_RAMP_KERNEL_ARGS(void)) \
+    { \
+        template( \
+            acc_l, acc_r, data, channels, frames, \
+            gain_l, gain_r, step_l, step_r, false); \
+    }
+
+/* Scalar kernels, used when no vector instruction set is available */
+
+static inline __attribute__((always_inline)) void mix_mono_scalar(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
 {
-    if (pos_a >= pos_b)
-        return;
+    (void)channels;
 
-    if (pos_a < 0) {
-        port_l += (-pos_a);
-        port_r += (-pos_a);
-        pos_a = 0;
+    for (int i = 0; i < frames; ++i) {
+        float sample = data[i];
+        if (add) {
+            acc_l[i] += sample * gain_l;
+            acc_r[i] += sample * gain_r;
+        } else {
+            acc_l[i] = sample * gain_l;
+            acc_r[i] = sample * gain_r;
+        }
     }
+}
+
+static inline __attribute__((always_inline)) void mix_stereo_scalar(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    (void)channels;
 
-    if (pos_b > clip->length) {
-        pos_b = clip->length;
+    for (int i = 0; i < frames; ++i) {
+        if (add) {
+            acc_l[i] += data[2 * i + 0] * gain_l;
+            acc_r[i] += data[2 * i + 1] * gain_r;
+        } else {
+            acc_l[i] = data[2 * i + 0] * gain_l;
+            acc_r[i] = data[2 * i + 1] * gain_r;
+        }
     }
+}
 
-    /* Clip data is -32768 to +32767, while port data is -1 to +1 */
-    gain_l /= 32768.0;
-    gain_r /= 32768.0;
+/* Mono clip with equal gains: one multiply per sample for both sides */
+static inline __attribute__((always_inline)) void mix_mono_equal_scalar(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    (void)channels;
+    (void)gain_r;
 
-    if (clip->channels >= 2) {
-        for (int n = pos_a * clip->channels;
-                 n < pos_b * clip->channels;
-                 n += clip->channels) {
-            *port_l++ += clip->data[n + 0] * gain_l;
-            *port_r++ += clip->data[n + 1] * gain_r;
+    for (int i = 0; i < frames; ++i) {
+        float sample = data[i] * gain_l;
+        if (add) {
+            acc_l[i] += sample;
+            acc_r[i] += sample;
+        } else {
+            acc_l[i] = sample;
+            acc_r[i] = sample;
         }
-    } else if (clip->channels == 1) {
-        for (int n = pos_a; n < pos_b; ++n) {
-            *port_l++ += clip->data[n] * gain_l;
-            *port_r++ += clip->data[n] * gain_r;
+    }
+}
+
+/* More than two channels: only the first two channels are played */
+static inline __attribute__((always_inline)) void mix_multichannel_scalar(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += channels) {
+        if (add) {
+            acc_l[i] += data[0] * gain_l;
+            acc_r[i] += data[1] * gain_r;
+        } else {
+            acc_l[i] = data[0] * gain_l;
+            acc_r[i] = data[1] * gain_r;
         }
     }
 }
 
-void clear_jack_port(
+static inline __attribute__((always_inline)) void mix_mono_float_scalar(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        if (add) {
+            acc_l[i] += data[i] * gain_l;
+            acc_r[i] += data[i] * gain_r;
+        } else {
+            acc_l[i] = data[i] * gain_l;
+            acc_r[i] = data[i] * gain_r;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void mix_stereo_float_scalar(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        if (add) {
+            acc_l[i] += data[2 * i + 0] * gain_l;
+            acc_r[i] += data[2 * i + 1] * gain_r;
+        } else {
+            acc_l[i] = data[2 * i + 0] * gain_l;
+            acc_r[i] = data[2 * i + 1] * gain_r;
+        }
+    }
+}
+
+/*
+ * Packed 24-bit samples are stored least significant byte first. Loading
+ * them into the upper three bytes of a 32-bit integer and shifting right
+ * sign-extends them.
+ */
+static inline __attribute__((always_inline)) int32_t load_int24(
+    const uint8_t *p)
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 24) >> 8;
+}
+
+static inline __attribute__((always_inline)) void mix_mono_int24_scalar(
+    MIX_KERNEL_ARGS(uint8_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        float sample = load_int24(data + 3 * i);
+        if (add) {
+            acc_l[i] += sample * gain_l;
+            acc_r[i] += sample * gain_r;
+        } else {
+            acc_l[i] = sample * gain_l;
+            acc_r[i] = sample * gain_r;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void mix_stereo_int24_scalar(
+    MIX_KERNEL_ARGS(uint8_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        if (add) {
+            acc_l[i] += load_int24(data + 6 * i + 0) * gain_l;
+            acc_r[i] += load_int24(data + 6 * i + 3) * gain_r;
+        } else {
+            acc_l[i] = load_int24(data + 6 * i + 0) * gain_l;
+            acc_r[i] = load_int24(data + 6 * i + 3) * gain_r;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void mix_multichannel_int24_scalar(
+    MIX_KERNEL_ARGS(uint8_t), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += 3 * channels) {
+        if (add) {
+            acc_l[i] += load_int24(data + 0) * gain_l;
+            acc_r[i] += load_int24(data + 3) * gain_r;
+        } else {
+            acc_l[i] = load_int24(data + 0) * gain_l;
+            acc_r[i] = load_int24(data + 3) * gain_r;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void mix_multichannel_float_scalar(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += channels) {
+        if (add) {
+            acc_l[i] += data[0] * gain_l;
+            acc_r[i] += data[1] * gain_r;
+        } else {
+            acc_l[i] = data[0] * gain_l;
+            acc_r[i] = data[1] * gain_r;
+        }
+    }
+}
+
+DEFINE_MIX_KERNELS(mix_mono_scalar, add_mono_scalar, set_mono_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_mono_equal_scalar, add_mono_equal_scalar, set_mono_equal_scalar, )
+DEFINE_MIX_KERNELS(mix_stereo_scalar, add_stereo_scalar, set_stereo_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_multichannel_scalar, add_multichannel_scalar,
+    set_multichannel_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_mono_float_scalar, add_mono_float_scalar, set_mono_float_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_stereo_float_scalar, add_stereo_float_scalar,
+    set_stereo_float_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_multichannel_float_scalar, add_multichannel_float_scalar,
+    set_multichannel_float_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_mono_int24_scalar, add_mono_int24_scalar, set_mono_int24_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_stereo_int24_scalar, add_stereo_int24_scalar,
+    set_stereo_int24_scalar, )
+DEFINE_MIX_KERNELS(
+    mix_multichannel_int24_scalar, add_multichannel_int24_scalar,
+    set_multichannel_int24_scalar, )
+
+/*
+ * Scalar ramp kernels. The gain of every frame is computed from its index
+ * instead of being accumulated, so that rounding errors don't build up.
+ */
+
+static inline __attribute__((always_inline)) void accumulate_scalar(
+    jack_default_audio_sample_t *acc, float value, const bool add)
+{
+    if (add)
+        *acc += value;
+    else
+        *acc = value;
+}
+
+static inline __attribute__((always_inline)) void ramp_mono_scalar(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        float sample = data[i];
+        accumulate_scalar(acc_l + i, sample * (gain_l + i * step_l), add);
+        accumulate_scalar(acc_r + i, sample * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_stereo_scalar(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        accumulate_scalar(
+            acc_l + i, data[2 * i + 0] * (gain_l + i * step_l), add);
+        accumulate_scalar(
+            acc_r + i, data[2 * i + 1] * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_multichannel_scalar(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += channels) {
+        accumulate_scalar(acc_l + i, data[0] * (gain_l + i * step_l), add);
+        accumulate_scalar(acc_r + i, data[1] * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_mono_float_scalar(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        accumulate_scalar(acc_l + i, data[i] * (gain_l + i * step_l), add);
+        accumulate_scalar(acc_r + i, data[i] * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_stereo_float_scalar(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        accumulate_scalar(
+            acc_l + i, data[2 * i + 0] * (gain_l + i * step_l), add);
+        accumulate_scalar(
+            acc_r + i, data[2 * i + 1] * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_multichannel_float_scalar(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += channels) {
+        accumulate_scalar(acc_l + i, data[0] * (gain_l + i * step_l), add);
+        accumulate_scalar(acc_r + i, data[1] * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_mono_int24_scalar(
+    MIX_RAMP_KERNEL_ARGS(uint8_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        float sample = load_int24(data + 3 * i);
+        accumulate_scalar(acc_l + i, sample * (gain_l + i * step_l), add);
+        accumulate_scalar(acc_r + i, sample * (gain_r + i * step_r), add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_stereo_int24_scalar(
+    MIX_RAMP_KERNEL_ARGS(uint8_t), const bool add)
+{
+    (void)channels;
+
+    for (int i = 0; i < frames; ++i) {
+        accumulate_scalar(
+            acc_l + i, load_int24(data + 6 * i + 0) * (gain_l + i * step_l),
+            add);
+        accumulate_scalar(
+            acc_r + i, load_int24(data + 6 * i + 3) * (gain_r + i * step_r),
+            add);
+    }
+}
+
+static inline __attribute__((always_inline)) void ramp_multichannel_int24_scalar(
+    MIX_RAMP_KERNEL_ARGS(uint8_t), const bool add)
+{
+    for (int i = 0; i < frames; ++i, data += 3 * channels) {
+        accumulate_scalar(
+            acc_l + i, load_int24(data + 0) * (gain_l + i * step_l), add);
+        accumulate_scalar(
+            acc_r + i, load_int24(data + 3) * (gain_r + i * step_r), add);
+    }
+}
+
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_scalar, ramp_add_mono_scalar, ramp_set_mono_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_scalar, ramp_add_stereo_scalar, ramp_set_stereo_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_multichannel_scalar, ramp_add_multichannel_scalar,
+    ramp_set_multichannel_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_float_scalar, ramp_add_mono_float_scalar,
+    ramp_set_mono_float_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_float_scalar, ramp_add_stereo_float_scalar,
+    ramp_set_stereo_float_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_multichannel_float_scalar, ramp_add_multichannel_float_scalar,
+    ramp_set_multichannel_float_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_int24_scalar, ramp_add_mono_int24_scalar,
+    ramp_set_mono_int24_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_int24_scalar, ramp_add_stereo_int24_scalar,
+    ramp_set_stereo_int24_scalar, )
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_multichannel_int24_scalar, ramp_add_multichannel_int24_scalar,
+    ramp_set_multichannel_int24_scalar, )
+
+static void store_clamped_scalar(
+    jack_default_audio_sample_t *port,
+    const jack_default_audio_sample_t *acc,
+    int frames)
+{
+    /*
+     * Written like maxps and minps, so that the compiler can use them
+     * instead of branches, and NaN becomes -1 as in the SIMD kernels
+     */
+    for (int i = 0; i < frames; ++i) {
+        float sample = acc[i];
+        sample = sample > -1.0f ? sample : -1.0f;
+        sample = sample < 1.0f ? sample : 1.0f;
+        port[i] = sample;
+    }
+}
+
+/* The comparisons are written so that NaN fails them and is clamped */
+static void convert_float32_scalar(
+    int16_t *dst, const float *src, int samples)
+{
+    for (int i = 0; i < samples; ++i) {
+        float sample = src[i] * 32767.0f;
+        sample = sample >= -32767.0f ? sample : -32767.0f;
+        sample = sample <= 32767.0f ? sample : 32767.0f;
+        dst[i] = (int16_t)sample;
+    }
+}
+
+static void convert_float64_scalar(
+    int16_t *dst, const double *src, int samples)
+{
+    for (int i = 0; i < samples; ++i) {
+        double sample = src[i] * 32767.0;
+        sample = sample >= -32767.0 ? sample : -32767.0;
+        sample = sample <= 32767.0 ? sample : 32767.0;
+        dst[i] = (int16_t)sample;
+    }
+}
+
+static void convert_float32_to_int24_scalar(
+    uint8_t *dst, const float *src, int samples)
+{
+    /* A float has too few mantissa bits for the product to be exact */
+    for (int i = 0; i < samples; ++i, dst += 3) {
+        double sample = src[i] * 8388607.0;
+        sample = sample >= -8388607.0 ? sample : -8388607.0;
+        sample = sample <= 8388607.0 ? sample : 8388607.0;
+        int32_t value = (int32_t)sample;
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+    }
+}
+
+static void convert_float64_to_int24_scalar(
+    uint8_t *dst, const double *src, int samples)
+{
+    for (int i = 0; i < samples; ++i, dst += 3) {
+        double sample = src[i] * 8388607.0;
+        sample = sample >= -8388607.0 ? sample : -8388607.0;
+        sample = sample <= 8388607.0 ? sample : 8388607.0;
+        int32_t value = (int32_t)sample;
+        dst[0] = value;
+        dst[1] = value >> 8;
+        dst[2] = value >> 16;
+    }
+}
+
+static void convert_float64_to_float32_scalar(
+    float *dst, const double *src, int samples)
+{
+    for (int i = 0; i < samples; ++i)
+        dst[i] = src[i];
+}
+
+static float dot_scalar(const float *a, const float *b, int n)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static const struct MixKernels scalar_kernels = {
+    .name = "scalar",
+    .mono = {
+        add_mono_scalar, set_mono_scalar,
+        ramp_add_mono_scalar, ramp_set_mono_scalar},
+    .mono_equal = {
+        add_mono_equal_scalar, set_mono_equal_scalar,
+        ramp_add_mono_scalar, ramp_set_mono_scalar},
+    .stereo = {
+        add_stereo_scalar, set_stereo_scalar,
+        ramp_add_stereo_scalar, ramp_set_stereo_scalar},
+    .multichannel = {
+        add_multichannel_scalar, set_multichannel_scalar,
+        ramp_add_multichannel_scalar, ramp_set_multichannel_scalar},
+    .mono_float = {
+        add_mono_float_scalar, set_mono_float_scalar,
+        ramp_add_mono_float_scalar, ramp_set_mono_float_scalar},
+    .stereo_float = {
+        add_stereo_float_scalar, set_stereo_float_scalar,
+        ramp_add_stereo_float_scalar, ramp_set_stereo_float_scalar},
+    .multichannel_float = {
+        add_multichannel_float_scalar, set_multichannel_float_scalar,
+        ramp_add_multichannel_float_scalar,
+        ramp_set_multichannel_float_scalar},
+    .mono_int24 = {
+        add_mono_int24_scalar, set_mono_int24_scalar,
+        ramp_add_mono_int24_scalar, ramp_set_mono_int24_scalar},
+    .stereo_int24 = {
+        add_stereo_int24_scalar, set_stereo_int24_scalar,
+        ramp_add_stereo_int24_scalar, ramp_set_stereo_int24_scalar},
+    .multichannel_int24 = {
+        add_multichannel_int24_scalar, set_multichannel_int24_scalar,
+        ramp_add_multichannel_int24_scalar,
+        ramp_set_multichannel_int24_scalar},
+    .store_clamped = store_clamped_scalar,
+    .convert_float32 = convert_float32_scalar,
+    .convert_float64 = convert_float64_scalar,
+    .dot = dot_scalar,
+};
+
+#ifdef AMIO_X86
+
+/*
+ * SSE2 kernels.
+ *
+ * A stereo frame of two 16-bit samples fits in a 32-bit lane, with the left
+ * sample in the lower half. Shifting the lane left and then arithmetically
+ * right by 16 bits sign-extends the left sample; shifting right alone does
+ * the same for the right one. This way deinterleaving costs no shuffles.
+ */
+
+#define SSE2 __attribute__((target("sse2")))
+
+static inline __attribute__((always_inline)) SSE2 void accumulate_sse2(
+    jack_default_audio_sample_t *acc, __m128 value, const bool add)
+{
+    if (add)
+        value = _mm_add_ps(_mm_loadu_ps(acc), value);
+    _mm_storeu_ps(acc, value);
+}
+
+static inline __attribute__((always_inline)) SSE2 void mix_mono_sse2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m128 vgain_l = _mm_set1_ps(gain_l);
+    __m128 vgain_r = _mm_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128 lo = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 hi = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(lo, vgain_l), add);
+        accumulate_sse2(acc_l + i + 4, _mm_mul_ps(hi, vgain_l), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(lo, vgain_r), add);
+        accumulate_sse2(acc_r + i + 4, _mm_mul_ps(hi, vgain_r), add);
+    }
+
+    mix_mono_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void mix_stereo_sse2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m128 vgain_l = _mm_set1_ps(gain_l);
+    __m128 vgain_r = _mm_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        __m128 left = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_slli_epi32(x, 16), 16));
+        __m128 right = _mm_cvtepi32_ps(_mm_srai_epi32(x, 16));
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(left, vgain_l), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(right, vgain_r), add);
+    }
+
+    mix_stereo_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void mix_mono_equal_sse2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m128 vgain = _mm_set1_ps(gain_l);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), vgain);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), vgain);
+
+        accumulate_sse2(acc_l + i, lo, add);
+        accumulate_sse2(acc_l + i + 4, hi, add);
+        accumulate_sse2(acc_r + i, lo, add);
+        accumulate_sse2(acc_r + i + 4, hi, add);
+    }
+
+    mix_mono_equal_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void mix_mono_float_sse2(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    __m128 vgain_l = _mm_set1_ps(gain_l);
+    __m128 vgain_r = _mm_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 x = _mm_loadu_ps(data + i);
+        accumulate_sse2(acc_l + i, _mm_mul_ps(x, vgain_l), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(x, vgain_r), add);
+    }
+
+    mix_mono_float_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void mix_stereo_float_sse2(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    __m128 vgain_l = _mm_set1_ps(gain_l);
+    __m128 vgain_r = _mm_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(data + 2 * i);
+        __m128 b = _mm_loadu_ps(data + 2 * i + 4);
+        __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(left, vgain_l), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(right, vgain_r), add);
+    }
+
+    mix_stereo_float_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+DEFINE_MIX_KERNELS(mix_mono_sse2, add_mono_sse2, set_mono_sse2, SSE2)
+DEFINE_MIX_KERNELS(
+    mix_mono_equal_sse2, add_mono_equal_sse2, set_mono_equal_sse2, SSE2)
+DEFINE_MIX_KERNELS(
+    mix_mono_float_sse2, add_mono_float_sse2, set_mono_float_sse2, SSE2)
+DEFINE_MIX_KERNELS(
+    mix_stereo_float_sse2, add_stereo_float_sse2, set_stereo_float_sse2, SSE2)
+DEFINE_MIX_KERNELS(mix_stereo_sse2, add_stereo_sse2, set_stereo_sse2, SSE2)
+
+/*
+ * SSE2 ramp kernels. The gains are computed from a vector of frame indices,
+ * like in the scalar kernels.
+ */
+
+static inline __attribute__((always_inline)) SSE2 __m128 ramp_gains_sse2(
+    float gain, float step, __m128 index)
+{
+    return _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(index, _mm_set1_ps(step)));
+}
+
+static inline __attribute__((always_inline)) SSE2 void ramp_mono_sse2(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128 lo = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 hi = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+        __m128 next_index = _mm_add_ps(index, four);
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(
+            lo, ramp_gains_sse2(gain_l, step_l, index)), add);
+        accumulate_sse2(acc_l + i + 4, _mm_mul_ps(
+            hi, ramp_gains_sse2(gain_l, step_l, next_index)), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(
+            lo, ramp_gains_sse2(gain_r, step_r, index)), add);
+        accumulate_sse2(acc_r + i + 4, _mm_mul_ps(
+            hi, ramp_gains_sse2(gain_r, step_r, next_index)), add);
+
+        index = _mm_add_ps(next_index, four);
+    }
+
+    ramp_mono_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void ramp_stereo_sse2(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        __m128 left = _mm_cvtepi32_ps(
+            _mm_srai_epi32(_mm_slli_epi32(x, 16), 16));
+        __m128 right = _mm_cvtepi32_ps(_mm_srai_epi32(x, 16));
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(
+            left, ramp_gains_sse2(gain_l, step_l, index)), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(
+            right, ramp_gains_sse2(gain_r, step_r, index)), add);
+
+        index = _mm_add_ps(index, four);
+    }
+
+    ramp_stereo_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void ramp_mono_float_sse2(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 x = _mm_loadu_ps(data + i);
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(
+            x, ramp_gains_sse2(gain_l, step_l, index)), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(
+            x, ramp_gains_sse2(gain_r, step_r, index)), add);
+
+        index = _mm_add_ps(index, four);
+    }
+
+    ramp_mono_float_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) SSE2 void ramp_stereo_float_sse2(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(data + 2 * i);
+        __m128 b = _mm_loadu_ps(data + 2 * i + 4);
+        __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+        accumulate_sse2(acc_l + i, _mm_mul_ps(
+            left, ramp_gains_sse2(gain_l, step_l, index)), add);
+        accumulate_sse2(acc_r + i, _mm_mul_ps(
+            right, ramp_gains_sse2(gain_r, step_r, index)), add);
+
+        index = _mm_add_ps(index, four);
+    }
+
+    ramp_stereo_float_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_sse2, ramp_add_mono_sse2, ramp_set_mono_sse2, SSE2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_sse2, ramp_add_stereo_sse2, ramp_set_stereo_sse2, SSE2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_float_sse2, ramp_add_mono_float_sse2,
+    ramp_set_mono_float_sse2, SSE2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_float_sse2, ramp_add_stereo_float_sse2,
+    ramp_set_stereo_float_sse2, SSE2)
+
+SSE2 static void store_clamped_sse2(
+    jack_default_audio_sample_t *port,
+    const jack_default_audio_sample_t *acc,
+    int frames)
+{
+    __m128 lower = _mm_set1_ps(-1.0f);
+    __m128 upper = _mm_set1_ps(1.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        _mm_storeu_ps(port + i, _mm_min_ps(
+            _mm_max_ps(_mm_loadu_ps(acc + i), lower), upper));
+    }
+
+    store_clamped_scalar(port + i, acc + i, frames - i);
+}
+
+/*
+ * _mm_max_ps returns its second operand if either one is NaN, so NaN
+ * is clamped to the lower bound, like in the scalar kernels. The packing
+ * saturates, but the values are already in range.
+ */
+
+SSE2 static void convert_float32_sse2(
+    int16_t *dst, const float *src, int samples)
+{
+    __m128 scale = _mm_set1_ps(32767.0f);
+    __m128 lower = _mm_set1_ps(-32767.0f);
+    __m128 upper = _mm_set1_ps(32767.0f);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lower), upper);
+        b = _mm_min_ps(_mm_max_ps(b, lower), upper);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(
+            _mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+    }
+
+    convert_float32_scalar(dst + i, src + i, samples - i);
+}
+
+SSE2 static void convert_float64_sse2(
+    int16_t *dst, const double *src, int samples)
+{
+    __m128d scale = _mm_set1_pd(32767.0);
+    __m128d lower = _mm_set1_pd(-32767.0);
+    __m128d upper = _mm_set1_pd(32767.0);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i x[4];
+        for (int j = 0; j < 4; ++j) {
+            __m128d v = _mm_mul_pd(_mm_loadu_pd(src + i + 2 * j), scale);
+            v = _mm_min_pd(_mm_max_pd(v, lower), upper);
+            x[j] = _mm_cvttpd_epi32(v);  /* in the lower half */
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(
+            _mm_unpacklo_epi64(x[0], x[1]), _mm_unpacklo_epi64(x[2], x[3])));
+    }
+
+    convert_float64_scalar(dst + i, src + i, samples - i);
+}
+
+SSE2 static float dot_sse2(const float *a, const float *b, int n)
+{
+    __m128 sum = _mm_setzero_ps();
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sum = _mm_add_ps(
+            sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum) + dot_scalar(a + i, b + i, n - i);
+}
+
+static const struct MixKernels sse2_kernels = {
+    .name = "SSE2",
+    .mono = {
+        add_mono_sse2, set_mono_sse2,
+        ramp_add_mono_sse2, ramp_set_mono_sse2},
+    .mono_equal = {
+        add_mono_equal_sse2, set_mono_equal_sse2,
+        ramp_add_mono_sse2, ramp_set_mono_sse2},
+    .stereo = {
+        add_stereo_sse2, set_stereo_sse2,
+        ramp_add_stereo_sse2, ramp_set_stereo_sse2},
+    .multichannel = {
+        add_multichannel_scalar, set_multichannel_scalar,
+        ramp_add_multichannel_scalar, ramp_set_multichannel_scalar},
+    .mono_float = {
+        add_mono_float_sse2, set_mono_float_sse2,
+        ramp_add_mono_float_sse2, ramp_set_mono_float_sse2},
+    .stereo_float = {
+        add_stereo_float_sse2, set_stereo_float_sse2,
+        ramp_add_stereo_float_sse2, ramp_set_stereo_float_sse2},
+    .multichannel_float = {
+        add_multichannel_float_scalar, set_multichannel_float_scalar,
+        ramp_add_multichannel_float_scalar,
+        ramp_set_multichannel_float_scalar},
+    .mono_int24 = {
+        add_mono_int24_scalar, set_mono_int24_scalar,
+        ramp_add_mono_int24_scalar, ramp_set_mono_int24_scalar},
+    .stereo_int24 = {
+        add_stereo_int24_scalar, set_stereo_int24_scalar,
+        ramp_add_stereo_int24_scalar, ramp_set_stereo_int24_scalar},
+    .multichannel_int24 = {
+        add_multichannel_int24_scalar, set_multichannel_int24_scalar,
+        ramp_add_multichannel_int24_scalar,
+        ramp_set_multichannel_int24_scalar},
+    .store_clamped = store_clamped_sse2,
+    .convert_float32 = convert_float32_sse2,
+    .convert_float64 = convert_float64_sse2,
+    .dot = dot_sse2,
+};
+
+/*
+ * AVX2 kernels - the same approach as SSE2, but 8 frames at a time.
+ * Every CPU with AVX2 that we select them for also has FMA, so samples
+ * are multiplied by the gain and added to the accumulator in one step.
+ */
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+static inline __attribute__((always_inline)) AVX2 void accumulate_avx2(
+    jack_default_audio_sample_t *acc, __m256 value, const bool add)
+{
+    if (add)
+        value = _mm256_add_ps(_mm256_loadu_ps(acc), value);
+    _mm256_storeu_ps(acc, value);
+}
+
+static inline __attribute__((always_inline)) AVX2 void accumulate_scaled_avx2(
+    jack_default_audio_sample_t *acc, __m256 x, __m256 gain, const bool add)
+{
+    __m256 value = add
+        ? _mm256_fmadd_ps(x, gain, _mm256_loadu_ps(acc))
+        : _mm256_mul_ps(x, gain);
+    _mm256_storeu_ps(acc, value);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_mono_avx2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+            _mm_loadu_si128((const __m128i *)(data + i))));
+
+        accumulate_scaled_avx2(acc_l + i, x, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, x, vgain_r, add);
+    }
+
+    mix_mono_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_stereo_avx2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(data + 2 * i));
+        __m256 left = _mm256_cvtepi32_ps(
+            _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16));
+        __m256 right = _mm256_cvtepi32_ps(_mm256_srai_epi32(x, 16));
+
+        accumulate_scaled_avx2(acc_l + i, left, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, right, vgain_r, add);
+    }
+
+    mix_stereo_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_mono_equal_avx2(
+    MIX_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m256 vgain = _mm256_set1_ps(gain_l);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+            _mm_loadu_si128((const __m128i *)(data + i)))), vgain);
+
+        accumulate_avx2(acc_l + i, x, add);
+        accumulate_avx2(acc_r + i, x, add);
+    }
+
+    mix_mono_equal_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_mono_float_avx2(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_loadu_ps(data + i);
+        accumulate_scaled_avx2(acc_l + i, x, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, x, vgain_r, add);
+    }
+
+    mix_mono_float_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_stereo_float_avx2(
+    MIX_KERNEL_ARGS(float), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        /*
+         * Shuffling within 128-bit lanes leaves the frames in the order
+         * 0 1 4 5 2 3 6 7; the 64-bit permutation puts them back in order.
+         */
+        __m256 a = _mm256_loadu_ps(data + 2 * i);
+        __m256 b = _mm256_loadu_ps(data + 2 * i + 8);
+        __m256 left = _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+        __m256 right = _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+
+        accumulate_scaled_avx2(acc_l + i, left, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, right, vgain_r, add);
+    }
+
+    mix_stereo_float_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+DEFINE_MIX_KERNELS(mix_mono_avx2, add_mono_avx2, set_mono_avx2, AVX2)
+DEFINE_MIX_KERNELS(
+    mix_mono_equal_avx2, add_mono_equal_avx2, set_mono_equal_avx2, AVX2)
+DEFINE_MIX_KERNELS(
+    mix_mono_float_avx2, add_mono_float_avx2, set_mono_float_avx2, AVX2)
+DEFINE_MIX_KERNELS(
+    mix_stereo_float_avx2, add_stereo_float_avx2, set_stereo_float_avx2, AVX2)
+DEFINE_MIX_KERNELS(mix_stereo_avx2, add_stereo_avx2, set_stereo_avx2, AVX2)
+
+static inline __attribute__((always_inline)) AVX2 __m256 ramp_gains_avx2(
+    float gain, float step, __m256 index)
+{
+    return _mm256_add_ps(
+        _mm256_set1_ps(gain), _mm256_mul_ps(index, _mm256_set1_ps(step)));
+}
+
+#define AVX2_RAMP_INDEX \
+    _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f)
+
+static inline __attribute__((always_inline)) AVX2 void ramp_mono_avx2(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+            _mm_loadu_si128((const __m128i *)(data + i))));
+
+        accumulate_scaled_avx2(acc_l + i, x, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(acc_r + i, x, ramp_gains_avx2(gain_r, step_r, index), add);
+
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_mono_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void ramp_stereo_avx2(
+    MIX_RAMP_KERNEL_ARGS(int16_t), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(data + 2 * i));
+        __m256 left = _mm256_cvtepi32_ps(
+            _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16));
+        __m256 right = _mm256_cvtepi32_ps(_mm256_srai_epi32(x, 16));
+
+        accumulate_scaled_avx2(acc_l + i, left, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(acc_r + i, right, ramp_gains_avx2(gain_r, step_r, index), add);
+
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_stereo_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void ramp_mono_float_avx2(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_loadu_ps(data + i);
+
+        accumulate_scaled_avx2(acc_l + i, x, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(acc_r + i, x, ramp_gains_avx2(gain_r, step_r, index), add);
+
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_mono_float_scalar(
+        acc_l + i, acc_r + i, data + i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void ramp_stereo_float_avx2(
+    MIX_RAMP_KERNEL_ARGS(float), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        /* Deinterleaved in the same way as in mix_stereo_float_avx2 */
+        __m256 a = _mm256_loadu_ps(data + 2 * i);
+        __m256 b = _mm256_loadu_ps(data + 2 * i + 8);
+        __m256 left = _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+        __m256 right = _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+
+        accumulate_scaled_avx2(acc_l + i, left, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(acc_r + i, right, ramp_gains_avx2(gain_r, step_r, index), add);
+
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_stereo_float_scalar(
+        acc_l + i, acc_r + i, data + 2 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_avx2, ramp_add_mono_avx2, ramp_set_mono_avx2, AVX2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_avx2, ramp_add_stereo_avx2, ramp_set_stereo_avx2, AVX2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_float_avx2, ramp_add_mono_float_avx2,
+    ramp_set_mono_float_avx2, AVX2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_float_avx2, ramp_add_stereo_float_avx2,
+    ramp_set_stereo_float_avx2, AVX2)
+
+/*
+ * 24-bit samples are unpacked with a byte shuffle into the upper three bytes
+ * of 32-bit lanes, and sign-extended with an arithmetic shift. The shuffle
+ * works within 128-bit lanes, so each lane is loaded separately. The loads
+ * read up to 4 bytes past the samples they use, so the loops stop early
+ * enough not to read past the end of the run.
+ */
+
+static inline __attribute__((always_inline)) AVX2 __m256 load_int24_avx2(
+    const uint8_t *lo, const uint8_t *hi, __m256i shuffle)
+{
+    __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i *)lo)),
+        _mm_loadu_si128((const __m128i *)hi), 1);
+    return _mm256_cvtepi32_ps(
+        _mm256_srai_epi32(_mm256_shuffle_epi8(x, shuffle), 8));
+}
+
+/* Four consecutive samples of every lane */
+#define INT24_SHUFFLE_MONO \
+    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+
+/* Two stereo frames of every lane, as L0 L1 R0 R1 */
+#define INT24_SHUFFLE_STEREO \
+    -1, 0, 1, 2, -1, 6, 7, 8, -1, 3, 4, 5, -1, 9, 10, 11
+
+static inline __attribute__((always_inline)) AVX2 void load_mono_int24_avx2(
+    const uint8_t *data, __m256 *x)
+{
+    __m256i shuffle = _mm256_setr_epi8(
+        INT24_SHUFFLE_MONO, INT24_SHUFFLE_MONO);
+    *x = load_int24_avx2(data, data + 12, shuffle);
+}
+
+static inline __attribute__((always_inline)) AVX2 void load_stereo_int24_avx2(
+    const uint8_t *data, __m256 *left, __m256 *right)
+{
+    __m256i shuffle = _mm256_setr_epi8(
+        INT24_SHUFFLE_STEREO, INT24_SHUFFLE_STEREO);
+
+    /* Frames 0 1 2 3 and 4 5 6 7, as L0 L1 R0 R1 | L2 L3 R2 R3 */
+    __m256d a = _mm256_castps_pd(load_int24_avx2(data, data + 12, shuffle));
+    __m256d b = _mm256_castps_pd(
+        load_int24_avx2(data + 24, data + 36, shuffle));
+
+    /* Left: L0 L1 L4 L5 | L2 L3 L6 L7, then put in order */
+    *left = _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_unpacklo_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+    *right = _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_unpackhi_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_mono_int24_avx2(
+    MIX_KERNEL_ARGS(uint8_t), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 10 <= frames; i += 8) {
+        __m256 x;
+        load_mono_int24_avx2(data + 3 * i, &x);
+        accumulate_scaled_avx2(acc_l + i, x, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, x, vgain_r, add);
+    }
+
+    mix_mono_int24_scalar(
+        acc_l + i, acc_r + i, data + 3 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void mix_stereo_int24_avx2(
+    MIX_KERNEL_ARGS(uint8_t), const bool add)
+{
+    __m256 vgain_l = _mm256_set1_ps(gain_l);
+    __m256 vgain_r = _mm256_set1_ps(gain_r);
+
+    int i = 0;
+    for (; i + 9 <= frames; i += 8) {
+        __m256 left, right;
+        load_stereo_int24_avx2(data + 6 * i, &left, &right);
+        accumulate_scaled_avx2(acc_l + i, left, vgain_l, add);
+        accumulate_scaled_avx2(acc_r + i, right, vgain_r, add);
+    }
+
+    mix_stereo_int24_scalar(
+        acc_l + i, acc_r + i, data + 6 * i, channels, frames - i,
+        gain_l, gain_r, add);
+}
+
+DEFINE_MIX_KERNELS(
+    mix_mono_int24_avx2, add_mono_int24_avx2, set_mono_int24_avx2, AVX2)
+DEFINE_MIX_KERNELS(
+    mix_stereo_int24_avx2, add_stereo_int24_avx2, set_stereo_int24_avx2, AVX2)
+
+static inline __attribute__((always_inline)) AVX2 void ramp_mono_int24_avx2(
+    MIX_RAMP_KERNEL_ARGS(uint8_t), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 10 <= frames; i += 8) {
+        __m256 x;
+        load_mono_int24_avx2(data + 3 * i, &x);
+        accumulate_scaled_avx2(
+            acc_l + i, x, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(
+            acc_r + i, x, ramp_gains_avx2(gain_r, step_r, index), add);
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_mono_int24_scalar(
+        acc_l + i, acc_r + i, data + 3 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+static inline __attribute__((always_inline)) AVX2 void ramp_stereo_int24_avx2(
+    MIX_RAMP_KERNEL_ARGS(uint8_t), const bool add)
+{
+    __m256 index = AVX2_RAMP_INDEX;
+    __m256 eight = _mm256_set1_ps(8.0f);
+
+    int i = 0;
+    for (; i + 9 <= frames; i += 8) {
+        __m256 left, right;
+        load_stereo_int24_avx2(data + 6 * i, &left, &right);
+        accumulate_scaled_avx2(
+            acc_l + i, left, ramp_gains_avx2(gain_l, step_l, index), add);
+        accumulate_scaled_avx2(
+            acc_r + i, right, ramp_gains_avx2(gain_r, step_r, index), add);
+        index = _mm256_add_ps(index, eight);
+    }
+
+    ramp_stereo_int24_scalar(
+        acc_l + i, acc_r + i, data + 6 * i, channels, frames - i,
+        gain_l + i * step_l, gain_r + i * step_r, step_l, step_r, add);
+}
+
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_mono_int24_avx2, ramp_add_mono_int24_avx2,
+    ramp_set_mono_int24_avx2, AVX2)
+DEFINE_MIX_RAMP_KERNELS(
+    ramp_stereo_int24_avx2, ramp_add_stereo_int24_avx2,
+    ramp_set_stereo_int24_avx2, AVX2)
+
+AVX2 static void store_clamped_avx2(
+    jack_default_audio_sample_t *port,
+    const jack_default_audio_sample_t *acc,
+    int frames)
+{
+    __m256 lower = _mm256_set1_ps(-1.0f);
+    __m256 upper = _mm256_set1_ps(1.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        _mm256_storeu_ps(port + i, _mm256_min_ps(
+            _mm256_max_ps(_mm256_loadu_ps(acc + i), lower), upper));
+    }
+
+    store_clamped_scalar(port + i, acc + i, frames - i);
+}
+
+/*
+ * Packing works within 128-bit lanes, so the 64-bit permutation puts
+ * the packed samples back in order.
+ */
+
+AVX2 static void convert_float32_avx2(
+    int16_t *dst, const float *src, int samples)
+{
+    __m256 scale = _mm256_set1_ps(32767.0f);
+    __m256 lower = _mm256_set1_ps(-32767.0f);
+    __m256 upper = _mm256_set1_ps(32767.0f);
+
+    int i = 0;
+    for (; i + 16 <= samples; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+        a = _mm256_min_ps(_mm256_max_ps(a, lower), upper);
+        b = _mm256_min_ps(_mm256_max_ps(b, lower), upper);
+        __m256i packed = _mm256_packs_epi32(
+            _mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+            _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    convert_float32_scalar(dst + i, src + i, samples - i);
+}
+
+AVX2 static void convert_float64_avx2(
+    int16_t *dst, const double *src, int samples)
+{
+    __m256d scale = _mm256_set1_pd(32767.0);
+    __m256d lower = _mm256_set1_pd(-32767.0);
+    __m256d upper = _mm256_set1_pd(32767.0);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m256d a = _mm256_mul_pd(_mm256_loadu_pd(src + i), scale);
+        __m256d b = _mm256_mul_pd(_mm256_loadu_pd(src + i + 4), scale);
+        a = _mm256_min_pd(_mm256_max_pd(a, lower), upper);
+        b = _mm256_min_pd(_mm256_max_pd(b, lower), upper);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(
+            _mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b)));
+    }
+
+    convert_float64_scalar(dst + i, src + i, samples - i);
+}
+
+AVX2 static float dot_avx2(const float *a, const float *b, int n)
+{
+    __m256 sum = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        sum = _mm256_fmadd_ps(
+            _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+    }
+
+    __m128 half = _mm_add_ps(
+        _mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half) + dot_scalar(a + i, b + i, n - i);
+}
+
+static const struct MixKernels avx2_kernels = {
+    .name = "AVX2",
+    .mono = {
+        add_mono_avx2, set_mono_avx2,
+        ramp_add_mono_avx2, ramp_set_mono_avx2},
+    .mono_equal = {
+        add_mono_equal_avx2, set_mono_equal_avx2,
+        ramp_add_mono_avx2, ramp_set_mono_avx2},
+    .stereo = {
+        add_stereo_avx2, set_stereo_avx2,
+        ramp_add_stereo_avx2, ramp_set_stereo_avx2},
+    .multichannel = {
+        add_multichannel_scalar, set_multichannel_scalar,
+        ramp_add_multichannel_scalar, ramp_set_multichannel_scalar},
+    .mono_float = {
+        add_mono_float_avx2, set_mono_float_avx2,
+        ramp_add_mono_float_avx2, ramp_set_mono_float_avx2},
+    .stereo_float = {
+        add_stereo_float_avx2, set_stereo_float_avx2,
+        ramp_add_stereo_float_avx2, ramp_set_stereo_float_avx2},
+    .multichannel_float = {
+        add_multichannel_float_scalar, set_multichannel_float_scalar,
+        ramp_add_multichannel_float_scalar,
+        ramp_set_multichannel_float_scalar},
+    .mono_int24 = {
+        add_mono_int24_avx2, set_mono_int24_avx2,
+        ramp_add_mono_int24_avx2, ramp_set_mono_int24_avx2},
+    .stereo_int24 = {
+        add_stereo_int24_avx2, set_stereo_int24_avx2,
+        ramp_add_stereo_int24_avx2, ramp_set_stereo_int24_avx2},
+    .multichannel_int24 = {
+        add_multichannel_int24_scalar, set_multichannel_int24_scalar,
+        ramp_add_multichannel_int24_scalar,
+        ramp_set_multichannel_int24_scalar},
+    .store_clamped = store_clamped_avx2,
+    .convert_float32 = convert_float32_avx2,
+    .convert_float64 = convert_float64_avx2,
+    .dot = dot_avx2,
+};
+
+#endif  /* AMIO_X86 */
+
+static const struct MixKernels *kernels = &scalar_kernels;
+static pthread_once_t kernels_selected = PTHREAD_ONCE_INIT;
+
+static void select_kernels()
+{
+#ifdef AMIO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels = &avx2_kernels;
+    else if (__builtin_cpu_supports("sse2"))
+        kernels = &sse2_kernels;
+    else
+        kernels = &scalar_kernels;
+#endif
+}
+
+void mixer_init()
+{
+    /* Runs on the Python thread */
+
+    /* The I/O threads of other interfaces may be reading the kernels */
+    pthread_once(&kernels_selected, select_kernels);
+}
+
+const char * mixer_get_kernels_name()
+{
+    return kernels->name;
+}
+
+const struct MixKernelPair * mixer_select_kernel(
+    int format, int channels, bool equal_gains)
+{
+    /* Runs on the Python thread */
+
+    if (format == SAMPLE_FORMAT_FLOAT32) {
+        if (channels == 1)
+            return &kernels->mono_float;
+        if (channels == 2)
+            return &kernels->stereo_float;
+        return &kernels->multichannel_float;
+    }
+
+    if (format == SAMPLE_FORMAT_INT24) {
+        if (channels == 1)
+            return &kernels->mono_int24;
+        if (channels == 2)
+            return &kernels->stereo_int24;
+        return &kernels->multichannel_int24;
+    }
+
+    if (channels == 1)
+        return equal_gains ? &kernels->mono_equal : &kernels->mono;
+    if (channels == 2)
+        return &kernels->stereo;
+    return &kernels->multichannel;
+}
+
+void mixer_convert_float32(
+    int format, void *dst, const float *src, int samples)
+{
+    if (format == SAMPLE_FORMAT_INT16)
+        kernels->convert_float32(dst, src, samples);
+    else if (format == SAMPLE_FORMAT_INT24)
+        convert_float32_to_int24_scalar(dst, src, samples);
+    else
+        memcpy(dst, src, samples * sizeof(float));
+}
+
+void mixer_convert_float64(
+    int format, void *dst, const double *src, int samples)
+{
+    if (format == SAMPLE_FORMAT_INT16)
+        kernels->convert_float64(dst, src, samples);
+    else if (format == SAMPLE_FORMAT_INT24)
+        convert_float64_to_int24_scalar(dst, src, samples);
+    else
+        convert_float64_to_float32_scalar(dst, src, samples);
+}
+
+float mixer_peak(int format, const void *samples, int count)
+{
+    if (format == SAMPLE_FORMAT_FLOAT32) {
+        const float *data = samples;
+        float peak = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            float sample = data[i] < 0.0f ? -data[i] : data[i];
+            if (sample > peak)
+                peak = sample;
+        }
+        return peak;
+    }
+
+    int32_t peak = 0;
+    if (format == SAMPLE_FORMAT_INT24) {
+        const uint8_t *data = samples;
+        for (int i = 0; i < count; ++i) {
+            int32_t sample = abs(load_int24(data + 3 * i));
+            if (sample > peak)
+                peak = sample;
+        }
+    } else {
+        const int16_t *data = samples;
+        for (int i = 0; i < count; ++i) {
+            int32_t sample = abs(data[i]);
+            if (sample > peak)
+                peak = sample;
+        }
+    }
+    return peak * sample_format_scale(format);
+}
+
+float mixer_dot(const float *a, const float *b, int n)
+{
+    return kernels->dot(a, b, n);
+}
+
+void mixer_load_channel(
+    int format,
+    const void *samples,
+    int channels,
+    int channel,
+    float *dst,
+    int frames)
+{
+    float scale = sample_format_scale(format);
+    if (format == SAMPLE_FORMAT_FLOAT32) {
+        const float *data = (const float *)samples + channel;
+        for (int i = 0; i < frames; ++i)
+            dst[i] = data[i * channels];
+    } else if (format == SAMPLE_FORMAT_INT24) {
+        const uint8_t *data = (const uint8_t *)samples + 3 * channel;
+        for (int i = 0; i < frames; ++i)
+            dst[i] = load_int24(data + 3 * i * channels) * scale;
+    } else {
+        const int16_t *data = (const int16_t *)samples + channel;
+        for (int i = 0; i < frames; ++i)
+            dst[i] = data[i * channels] * scale;
+    }
+}
+
+void mixer_summarize(
+    int format,
+    const void *samples,
+    int count,
+    float *min,
+    float *max,
+    float *sum_squares)
+{
+    float scale = sample_format_scale(format);
+    float low = INFINITY;
+    float high = -INFINITY;
+    float sum = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        float sample;
+        if (format == SAMPLE_FORMAT_FLOAT32)
+            sample = ((const float *)samples)[i];
+        else if (format == SAMPLE_FORMAT_INT24)
+            sample = load_int24((const uint8_t *)samples + 3 * i) * scale;
+        else
+            sample = ((const int16_t *)samples)[i] * scale;
+        if (sample < low)
+            low = sample;
+        if (sample > high)
+            high = sample;
+        sum += sample * sample;
+    }
+    *min = low;
+    *max = high;
+    *sum_squares = sum;
+}
+
+bool mix_buffer_create(struct MixBuffer *buffer)
+{
+    /* Runs on the Python thread */
+
+    buffer->segment_start = 0;
+    buffer->segment_end = 0;
+    buffer->segment_initialized = false;
+
+    void *memory = NULL;
+    if (posix_memalign(&memory, 64,
+            2 * MIX_BUFFER_FRAMES * sizeof(jack_default_audio_sample_t))) {
+        buffer->l = NULL;
+        buffer->r = NULL;
+        return false;
+    }
+
+    buffer->l = memory;
+    buffer->r = buffer->l + MIX_BUFFER_FRAMES;
+    return true;
+}
+
+void mix_buffer_destroy(struct MixBuffer *buffer)
+{
+    /* Runs on the Python thread */
+
+    free(buffer->l);
+    buffer->l = NULL;
+    buffer->r = NULL;
+}
+
+static void zero_mix_buffer_range(struct MixBuffer *buffer, int a, int b)
+{
+    if (a >= b)
+        return;
+    memset(buffer->l + a, 0, (b - a) * sizeof(jack_default_audio_sample_t));
+    memset(buffer->r + a, 0, (b - a) * sizeof(jack_default_audio_sample_t));
+}
+
+void mix_buffer_begin_segment(struct MixBuffer *buffer, int start, int frames)
+{
+    assert(start >= 0 && start + frames <= MIX_BUFFER_FRAMES);
+
+    buffer->segment_start = start;
+    buffer->segment_end = start + frames;
+    buffer->segment_initialized = false;
+}
+
+void mix_buffer_end_segment(struct MixBuffer *buffer)
+{
+    /* Nothing was mixed into this segment - it's silent */
+    if (!buffer->segment_initialized)
+        zero_mix_buffer_range(
+            buffer, buffer->segment_start, buffer->segment_end);
+}
+
+/*
+ * Return the accumulator position for frames mixed at the given offset,
+ * and whether they should be added to it. If nothing was mixed into
+ * the segment yet, the parts of it that the frames don't cover are zeroed.
+ */
+static bool mix_buffer_prepare(
+    struct MixBuffer *buffer,
+    int offset,
+    int frames,
+    jack_default_audio_sample_t **acc_l,
+    jack_default_audio_sample_t **acc_r)
+{
+    int start = buffer->segment_start + offset;
+    assert(start >= buffer->segment_start);
+    assert(start + frames <= buffer->segment_end);
+
+    *acc_l = buffer->l + start;
+    *acc_r = buffer->r + start;
+
+    if (buffer->segment_initialized)
+        return true;
+
+    zero_mix_buffer_range(buffer, buffer->segment_start, start);
+    zero_mix_buffer_range(buffer, start + frames, buffer->segment_end);
+    buffer->segment_initialized = true;
+    return false;
+}
+
+void mix_samples(
+    struct MixBuffer *buffer,
+    int offset,
+    const struct MixKernelPair *kernel,
+    const void *data,
+    int channels,
+    int frames,
+    float gain_l,
+    float gain_r)
+{
+    if (frames <= 0)
+        return;
+
+    jack_default_audio_sample_t *acc_l, *acc_r;
+    if (mix_buffer_prepare(buffer, offset, frames, &acc_l, &acc_r))
+        kernel->add(acc_l, acc_r, data, channels, frames, gain_l, gain_r);
+    else
+        kernel->set(acc_l, acc_r, data, channels, frames, gain_l, gain_r);
+}
+
+void mix_samples_ramped(
+    struct MixBuffer *buffer,
+    int offset,
+    const struct MixKernelPair *kernel,
+    const void *data,
+    int channels,
+    int frames,
+    float gain_l,
+    float gain_r,
+    float step_l,
+    float step_r)
+{
+    if (frames <= 0)
+        return;
+
+    jack_default_audio_sample_t *acc_l, *acc_r;
+    if (mix_buffer_prepare(buffer, offset, frames, &acc_l, &acc_r)) {
+        kernel->ramp_add(
+            acc_l, acc_r, data, channels, frames,
+            gain_l, gain_r, step_l, step_r);
+    } else {
+        kernel->ramp_set(
+            acc_l, acc_r, data, channels, frames,
+            gain_l, gain_r, step_l, step_r);
+    }
+}
+
+void mix_buffer_store(
+    struct MixBuffer *buffer,
     jack_default_audio_sample_t *port_l,
     jack_default_audio_sample_t *port_r,
     jack_nframes_t n)
 {
-    for (jack_nframes_t i = 0; i < n; ++i) {
-        *port_l++ = 0.0;
-        *port_r++ = 0.0;
-    }
+    assert(n <= MIX_BUFFER_FRAMES);
+
+    kernels->store_clamped(port_l, buffer->l, n);
+    kernels->store_clamped(port_r, buffer->r, n);
 }
 
-void clamp_jack_port(
+void clear_jack_port(
     jack_default_audio_sample_t *port_l,
     jack_default_audio_sample_t *port_r,
     jack_nframes_t n)
 {
-    for (jack_nframes_t i = 0; i < n; ++i, ++port_l, ++port_r) {
-        if (*port_l >= 1.0)
-            *port_l = 1.0;
-        else if (*port_l <= -1.0)
-            *port_l = -1.0;
-
-        if (*port_r >= 1.0)
-            *port_r = 1.0;
-        else if (*port_r <= -1.0)
-            *port_r = -1.0;
+    for (jack_nframes_t i = 0; i < n; ++i) {
+        *port_l++ = 0.0;
+        *port_r++ = 0.0;
     }
 }
@@ -2,24 +2,260 @@
 #define MIXER_H
 
 #include <jack/jack.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-#include "audio_clip.h"
+/*
+ * Formats of the sample data read by the mixing kernels. 24-bit samples
+ * are packed in 3 bytes, least significant byte first.
+ */
+#define SAMPLE_FORMAT_INT16 0
+#define SAMPLE_FORMAT_FLOAT32 1
+#define SAMPLE_FORMAT_INT24 2
+#define NUM_SAMPLE_FORMATS 3
 
-void add_clip_data_to_jack_port(
-    jack_default_audio_sample_t *port_l,
-    jack_default_audio_sample_t *port_r,
-    struct AudioClip *clip,
-    int pos_a,
-    int pos_b,
+/* Size of a single sample in bytes */
+static inline int sample_format_size(int format)
+{
+    if (format == SAMPLE_FORMAT_FLOAT32)
+        return 4;
+    if (format == SAMPLE_FORMAT_INT24)
+        return 3;
+    return 2;
+}
+
+/* Factor that scales samples of the format to the range [-1.0, 1.0] */
+static inline float sample_format_scale(int format)
+{
+    if (format == SAMPLE_FORMAT_FLOAT32)
+        return 1.0f;
+    if (format == SAMPLE_FORMAT_INT24)
+        return 1.0f / 8388608.0f;
+    return 1.0f / 32768.0f;
+}
+
+/*
+ * A mixing kernel converts a run of clip samples to floats, multiplies
+ * them by the left and right channel gains and writes them to the left
+ * and right accumulator buffers. Mono kernels read one sample per frame,
+ * stereo kernels read interleaved left/right pairs. The gains are expected
+ * to be already scaled to the sample format. The channel count is only
+ * used by the kernel for clips with more than two channels.
+ *
+ * "add" kernels add to what's already in the accumulator, while "set"
+ * kernels overwrite it, so that the first contributing clip doesn't have
+ * to be added to zeros.
+ */
+typedef void (*MixKernel)(
+    jack_default_audio_sample_t *acc_l,
+    jack_default_audio_sample_t *acc_r,
+    const void *data,
+    int channels,
+    int frames,
     float gain_l,
     float gain_r);
 
-void clear_jack_port(
+/*
+ * A ramp kernel works like a mixing kernel, but the gains change linearly
+ * over the run: frame i is multiplied by gain + i * step. It's used for
+ * fades and for gain changes, so that clip data never has to be copied
+ * to apply an envelope.
+ */
+typedef void (*MixRampKernel)(
+    jack_default_audio_sample_t *acc_l,
+    jack_default_audio_sample_t *acc_r,
+    const void *data,
+    int channels,
+    int frames,
+    float gain_l,
+    float gain_r,
+    float step_l,
+    float step_r);
+
+/* Kernels for one sample format and channel layout */
+struct MixKernelPair
+{
+    MixKernel add;
+    MixKernel set;
+    MixRampKernel ramp_add;
+    MixRampKernel ramp_set;
+};
+
+/*
+ * A store kernel copies the accumulator into a port buffer, clamping
+ * the samples to the range [-1.0, 1.0].
+ */
+typedef void (*StoreKernel)(
+    jack_default_audio_sample_t *port,
+    const jack_default_audio_sample_t *acc,
+    int frames);
+
+/*
+ * A convert kernel turns float samples in the range [-1.0, 1.0] into 16-bit
+ * clip samples. Like (x * 32767).clip(-32767, 32767).astype(np.int16)
+ * in NumPy, it scales, clamps and truncates towards zero. NaN becomes -32767.
+ */
+typedef void (*ConvertFloat32Kernel)(
+    int16_t *dst, const float *src, int samples);
+typedef void (*ConvertFloat64Kernel)(
+    int16_t *dst, const double *src, int samples);
+
+/* A dot kernel returns the sum of products of two float vectors */
+typedef float (*DotKernel)(const float *a, const float *b, int n);
+
+struct MixKernels
+{
+    const char *name;
+    struct MixKernelPair mono;
+    struct MixKernelPair mono_equal;  /* mono with gain_l == gain_r */
+    struct MixKernelPair stereo;
+    struct MixKernelPair multichannel;
+    struct MixKernelPair mono_float;
+    struct MixKernelPair stereo_float;
+    struct MixKernelPair multichannel_float;
+    struct MixKernelPair mono_int24;
+    struct MixKernelPair stereo_int24;
+    struct MixKernelPair multichannel_int24;
+    StoreKernel store_clamped;
+    ConvertFloat32Kernel convert_float32;
+    ConvertFloat64Kernel convert_float64;
+    DotKernel dot;
+};
+
+/*
+ * Select the best set of mixing kernels for the CPU we're running on.
+ * Only the first call selects them, so they never change under running
+ * I/O threads.
+ */
+void mixer_init();
+
+const char * mixer_get_kernels_name();
+
+/*
+ * Return the kernel specialized for the given sample format and channel
+ * count. If the left and right gains are known to be always equal,
+ * a faster kernel may be returned.
+ */
+const struct MixKernelPair * mixer_select_kernel(
+    int format, int channels, bool equal_gains);
+
+/*
+ * Convert float samples in the range [-1.0, 1.0] to clip samples
+ * of the given format. Integer formats are scaled, clamped and truncated
+ * like by the convert kernels.
+ */
+void mixer_convert_float32(
+    int format, void *dst, const float *src, int samples);
+void mixer_convert_float64(
+    int format, void *dst, const double *src, int samples);
+
+/*
+ * Largest absolute value of the clip samples of the given format, scaled
+ * to the range [0.0, 1.0]. It's 0.0 only if all samples are zero.
+ */
+float mixer_peak(int format, const void *samples, int count);
+
+/* Sum of products of two float vectors, with the best dot kernel */
+float mixer_dot(const float *a, const float *b, int n);
+
+/*
+ * Read one channel of frames of clip samples of the given format
+ * as floats, scaled to the range [-1.0, 1.0]
+ */
+void mixer_load_channel(
+    int format,
+    const void *samples,
+    int channels,
+    int channel,
+    float *dst,
+    int frames);
+
+/*
+ * Smallest and largest value and the sum of squares of the clip samples
+ * of the given format, scaled to the range [-1.0, 1.0]
+ */
+void mixer_summarize(
+    int format,
+    const void *samples,
+    int count,
+    float *min,
+    float *max,
+    float *sum_squares);
+
+/* Number of frames that the mix buffer holds */
+#define MIX_BUFFER_FRAMES 256
+
+/*
+ * Scratch accumulator that a period is mixed into before being written
+ * to the port buffers. It's small enough to stay in the L1 cache.
+ *
+ * The buffer is filled in segments (a period is split into segments
+ * at the points where the playspec changes). The first clip mixed into
+ * a segment initializes it, and the parts it doesn't cover are zeroed;
+ * every following clip is added.
+ */
+struct MixBuffer
+{
+    jack_default_audio_sample_t *l;
+    jack_default_audio_sample_t *r;
+
+    /* Segment currently being mixed, in frames from the buffer start */
+    int segment_start;
+    int segment_end;
+
+    /* Whether any clip was mixed into the current segment yet */
+    bool segment_initialized;
+};
+
+/* Returns false if the buffer can't be allocated */
+bool mix_buffer_create(struct MixBuffer *buffer);
+void mix_buffer_destroy(struct MixBuffer *buffer);
+
+void mix_buffer_begin_segment(struct MixBuffer *buffer, int start, int frames);
+void mix_buffer_end_segment(struct MixBuffer *buffer);
+
+/*
+ * Mix the given number of frames of sample data into the current segment
+ * with the given kernel, starting at the given offset from the beginning
+ * of the segment.
+ */
+void mix_samples(
+    struct MixBuffer *buffer,
+    int offset,
+    const struct MixKernelPair *kernel,
+    const void *data,
+    int channels,
+    int frames,
+    float gain_l,
+    float gain_r);
+
+/*
+ * Like mix_samples, but the gains ramp linearly from gain_l and gain_r,
+ * changing by step_l and step_r every frame.
+ */
+void mix_samples_ramped(
+    struct MixBuffer *buffer,
+    int offset,
+    const struct MixKernelPair *kernel,
+    const void *data,
+    int channels,
+    int frames,
+    float gain_l,
+    float gain_r,
+    float step_l,
+    float step_r);
+
+/*
+ * Write the first n frames of the mix buffer to the port buffers,
+ * clamping them to the range [-1.0, 1.0].
+ */
+void mix_buffer_store(
+    struct MixBuffer *buffer,
     jack_default_audio_sample_t *port_l,
     jack_default_audio_sample_t *port_r,
     jack_nframes_t n);
 
-void clamp_jack_port(
+void clear_jack_port(
     jack_default_audio_sample_t *port_l,
     jack_default_audio_sample_t *port_r,
     jack_nframes_t n);
@@ -3,6 +3,7 @@
 %include <pybuffer.i>
 
 %pybuffer_binary(char *bytes, int n);
+%pybuffer_binary(char *samples, long long n);
 %pybuffer_mutable_binary(char *bytearray, int n);
 
 %{
@@ -11,38 +12,105 @@
 
 /* AudioClip */
 
-int AudioClip_init(char *bytes, int n, int channels, float framerate);
+int AudioClip_init(char *samples, long long n, int channels, float framerate);
+int AudioClip_init_from_float32(
+    char *samples, long long n, int channels, float framerate, int format);
+int AudioClip_init_from_float64(
+    char *samples, long long n, int channels, float framerate, int format);
+int AudioClip_init_silent(
+    long long length, int channels, float framerate, int format);
+int AudioClip_init_updated_from_float32(
+    int clip_id, long long frame, char *samples, long long n);
+int AudioClip_init_updated_from_float64(
+    int clip_id, long long frame, char *samples, long long n);
+int AudioClip_init_resampled(int clip_id, float framerate);
+int AudioClip_init_streaming(
+    const char *path,
+    long long data_offset,
+    long long length,
+    int channels,
+    float framerate,
+    int format);
+int AudioClip_get_stream_underruns(int clip_id);
+long long AudioClip_get_data_size(int clip_id);
+long long AudioClip_get_shared_data_size(int clip_id);
+long long AudioClip_get_resident_data_size(int clip_id);
+long long AudioClip_get_silent_frames(int clip_id);
+int AudioClip_get_overview(
+    int clip_id,
+    long long start_frame,
+    int frames_per_bin,
+    char *bytearray,
+    int n);
+int AudioClip_get_num_clips();
+void AudioClip_set_memory_budget(
+    long long budget, const char *spill_directory);
 void AudioClip_del(int interface, int clip_id);
 
-/* InputChunk */
+/* Clip store */
+
+long long clip_store_get_clip_bytes();
+int clip_store_get_num_buffers();
+long long clip_store_get_stored_bytes();
+long long clip_store_get_resident_bytes();
+int clip_store_get_num_spilled_buffers();
+long long clip_store_get_spilled_bytes();
+
+/* Capture */
 
-int InputChunk_get_playspec_id();
-int InputChunk_get_starting_frame();
-int InputChunk_get_was_transport_rolling();
-int InputChunk_get_samples(char *bytearray, int n);
+bool iface_set_capture_buffer(int interface_id, char *bytearray, int n);
+int iface_drain_capture(int interface_id, char *bytearray, int n);
+int iface_get_capture_overruns(int interface_id);
 
 /* Playspec */
 
 bool begin_defining_playspec(int size, int insert_at, int start_from);
+void cancel_defining_playspec();
 void set_entry_in_playspec(
     int n,
     int clip_id,
     int clip_frame_a, int clip_frame_b,
     int play_at_frame, int repeat_interval,
     float gain_l, float gain_r);
+int set_entries_in_playspec(char *bytes, int n);
+
+/* PlayspecPatch */
+
+bool begin_defining_playspec_patch(int interface_id, int apply_at);
+void cancel_defining_playspec_patch();
+int add_entry_in_playspec_patch(char *bytes, int n);
+bool replace_entry_in_playspec_patch(int index, char *bytes, int n);
+bool set_entry_gain_in_playspec_patch(int index, float gain_l, float gain_r);
+bool remove_entry_in_playspec_patch(int index);
 
 /* Interface */
 
 int iface_process_messages_on_python_queue(int interface_id);
-void iface_get_logs(int interface_id, char *bytearray, int n);
+int iface_get_log_records(int interface_id, char *bytearray, int n);
+int iface_get_dropped_log_records(int interface_id);
+int iface_get_wakeup_fd(int interface_id);
+void iface_acknowledge_wakeup(int interface_id);
+bool iface_begin_transaction(int interface_id);
+int iface_commit_transaction(int interface_id);
+void iface_abort_transaction(int interface_id);
 int iface_set_playspec(int interface_id);
+int iface_apply_playspec_patch(int interface_id);
 int iface_get_frame_rate(int interface_id);
 int iface_get_position(int interface_id);
 void iface_set_position(int interface_id, int position);
 int iface_get_transport_rolling(int interface_id);
+bool iface_get_transport_snapshot(int interface_id, char *bytearray, int n);
 void iface_set_transport_rolling(int interface_id, int rolling);
+void iface_set_param_slot(
+    int interface_id,
+    int slot,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo);
 int iface_get_current_playspec_id(int interface_id);
-bool iface_begin_reading_input_chunk(int interface_id);
+int iface_get_stream_underruns(int interface_id);
+int iface_get_playspec_reports(int interface_id, char *bytearray, int n);
 void iface_close(int interface_id);
 
 /* drivers */
@@ -53,38 +121,105 @@ int create_jack_interface(const char *client_name);
 
 /* AudioClip */
 
-int AudioClip_init(char *bytes, int n, int channels, float framerate);
+int AudioClip_init(char *samples, long long n, int channels, float framerate);
+int AudioClip_init_from_float32(
+    char *samples, long long n, int channels, float framerate, int format);
+int AudioClip_init_from_float64(
+    char *samples, long long n, int channels, float framerate, int format);
+int AudioClip_init_silent(
+    long long length, int channels, float framerate, int format);
+int AudioClip_init_updated_from_float32(
+    int clip_id, long long frame, char *samples, long long n);
+int AudioClip_init_updated_from_float64(
+    int clip_id, long long frame, char *samples, long long n);
+int AudioClip_init_resampled(int clip_id, float framerate);
+int AudioClip_init_streaming(
+    const char *path,
+    long long data_offset,
+    long long length,
+    int channels,
+    float framerate,
+    int format);
+int AudioClip_get_stream_underruns(int clip_id);
+long long AudioClip_get_data_size(int clip_id);
+long long AudioClip_get_shared_data_size(int clip_id);
+long long AudioClip_get_resident_data_size(int clip_id);
+long long AudioClip_get_silent_frames(int clip_id);
+int AudioClip_get_overview(
+    int clip_id,
+    long long start_frame,
+    int frames_per_bin,
+    char *bytearray,
+    int n);
+int AudioClip_get_num_clips();
+void AudioClip_set_memory_budget(
+    long long budget, const char *spill_directory);
 void AudioClip_del(int interface, int clip_id);
 
-/* InputChunk */
+/* Clip store */
+
+long long clip_store_get_clip_bytes();
+int clip_store_get_num_buffers();
+long long clip_store_get_stored_bytes();
+long long clip_store_get_resident_bytes();
+int clip_store_get_num_spilled_buffers();
+long long clip_store_get_spilled_bytes();
+
+/* Capture */
 
-int InputChunk_get_playspec_id();
-int InputChunk_get_starting_frame();
-int InputChunk_get_was_transport_rolling();
-int InputChunk_get_samples(char *bytearray, int n);
+bool iface_set_capture_buffer(int interface_id, char *bytearray, int n);
+int iface_drain_capture(int interface_id, char *bytearray, int n);
+int iface_get_capture_overruns(int interface_id);
 
 /* Playspec */
 
 bool begin_defining_playspec(int size, int insert_at, int start_from);
+void cancel_defining_playspec();
 void set_entry_in_playspec(
     int n,
     int clip_id,
     int clip_frame_a, int clip_frame_b,
     int play_at_frame, int repeat_interval,
     float gain_l, float gain_r);
+int set_entries_in_playspec(char *bytes, int n);
+
+/* PlayspecPatch */
+
+bool begin_defining_playspec_patch(int interface_id, int apply_at);
+void cancel_defining_playspec_patch();
+int add_entry_in_playspec_patch(char *bytes, int n);
+bool replace_entry_in_playspec_patch(int index, char *bytes, int n);
+bool set_entry_gain_in_playspec_patch(int index, float gain_l, float gain_r);
+bool remove_entry_in_playspec_patch(int index);
 
 /* Interface */
 
 int iface_process_messages_on_python_queue(int interface_id);
-void iface_get_logs(int interface_id, char *bytearray, int n);
+int iface_get_log_records(int interface_id, char *bytearray, int n);
+int iface_get_dropped_log_records(int interface_id);
+int iface_get_wakeup_fd(int interface_id);
+void iface_acknowledge_wakeup(int interface_id);
+bool iface_begin_transaction(int interface_id);
+int iface_commit_transaction(int interface_id);
+void iface_abort_transaction(int interface_id);
 int iface_set_playspec(int interface_id);
+int iface_apply_playspec_patch(int interface_id);
 int iface_get_frame_rate(int interface_id);
 int iface_get_position(int interface_id);
 void iface_set_position(int interface_id, int position);
 int iface_get_transport_rolling(int interface_id);
+bool iface_get_transport_snapshot(int interface_id, char *bytearray, int n);
 void iface_set_transport_rolling(int interface_id, int rolling);
+void iface_set_param_slot(
+    int interface_id,
+    int slot,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo);
 int iface_get_current_playspec_id(int interface_id);
-bool iface_begin_reading_input_chunk(int interface_id);
+int iface_get_stream_underruns(int interface_id);
+int iface_get_playspec_reports(int interface_id, char *bytearray, int n);
 void iface_close(int interface_id);
 
 /* drivers */
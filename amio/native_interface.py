@@ -1,18 +1,91 @@
 import asyncio
 
-from amio.audio_clip import ImmutableAudioClip, InputAudioChunk, AudioClip
+from amio.audio_clip import (
+    AudioClip,
+    ImmutableAudioClip,
+    InputAudioChunk,
+    SAMPLE_FORMAT_SIZES,
+    read_wav_layout,
+)
 import amio._native
-from amio.interface import Interface
-from amio.playspec import Playspec
+from amio.interface import Interface, TransportSnapshot
+from amio.playspec import (
+    AnyPlayspec,
+    PackedPlayspec,
+    Playspec,
+    PlayspecEntry,
+    PlayspecPatch,
+)
+from contextlib import contextmanager
 from datetime import datetime, timezone
 from enum import Enum
 import logging
 import numpy as np
-from typing import List, Optional
+import os
+from typing import Iterator, List, Optional
 
 
 logger = logging.getLogger("amio")
 
+# Must match struct PlayspecReport in interface.h
+PLAYSPEC_REPORT_DTYPE = np.dtype([("id", np.int32), ("was_used", np.int32)])
+
+# Must match struct CaptureSpan and CAPTURE_SPAN_QUEUE_SIZE in capture.h
+CAPTURE_SPAN_DTYPE = np.dtype(
+    [
+        ("capture_frame", np.int64),
+        ("frames", np.int32),
+        ("playspec_id", np.int32),
+        ("starting_frame", np.int32),
+        ("was_transport_rolling", np.int32),
+    ]
+)
+_CAPTURE_SPAN_QUEUE_SIZE = 4096
+
+# Must match struct TransportSnapshot in transport.h
+TRANSPORT_SNAPSHOT_DTYPE = np.dtype(
+    [
+        ("period", np.int64),
+        ("frame_rate", np.int32),
+        ("position", np.int32),
+        ("is_transport_rolling", np.int32),
+        ("playspec_id", np.int32),
+    ]
+)
+
+
+# Must match struct LogRecord in event_log.h
+LOG_RECORD_DTYPE = np.dtype(
+    [
+        ("time_ns", np.int64),
+        ("event", np.int32),
+        ("position", np.int32),
+        ("value", np.int64),
+        ("text", "S40"),
+    ]
+)
+
+# Level and message of every event, by enum LogEvent in event_log.h
+LOG_EVENTS = [
+    (logging.DEBUG, "Mixer: using {text} kernels"),
+    (logging.ERROR, "Unable to create the wakeup pipe"),
+    (logging.DEBUG, "I/O thread: Got playspec {value}"),
+    (logging.DEBUG, "I/O thread: Got playspec patch {value}"),
+    (logging.DEBUG, "I/O thread: Got position {value}"),
+    (logging.DEBUG, "I/O thread: Got transport state {value}"),
+    (logging.ERROR, "jack_client_open() failed, status {value:#x}"),
+    (logging.ERROR, "Unable to connect to JACK server"),
+    (logging.INFO, "JACK server started"),
+    (logging.INFO, "Unique name assigned: {text}"),
+    (logging.ERROR, "No more JACK ports available"),
+    (logging.ERROR, "Cannot activate JACK client"),
+    (logging.ERROR, "No physical capture ports"),
+    (logging.ERROR, "No physical playback ports"),
+    (logging.WARNING, "Cannot connect input ports"),
+    (logging.WARNING, "Cannot connect output ports"),
+]
+_LOG_RECORDS_PER_READ = 256
+
 
 class PythonQueueProcessingResult(Enum):
     NOTHING = 0
@@ -20,60 +93,111 @@ class PythonQueueProcessingResult(Enum):
 
 
 class NativeInterface(Interface):
-    def __init__(self):
+    def __init__(self, capture_frames: int = 2**18):
+        """
+        :param capture_frames: Length of the ring that input is captured to
+        until it's passed to input_chunk_callback, by default about 5 seconds
+        at 48 kHz. Input that doesn't fit is dropped.
+        """
         super().__init__()
         self.jack_interface = None
         self.message_task = None
-        self._keepalive_clips: List[Optional[ImmutableAudioClip]] = []
-        self._pending_logs = ""
+        self._keepalive_playspec: Optional[PackedPlayspec] = None
+        self._log_records = bytearray(LOG_RECORD_DTYPE.itemsize * _LOG_RECORDS_PER_READ)
+        self._dropped_log_records = 0
+        self._capture_ring = np.zeros((capture_frames, 2), np.float32)
+        self._capture_spans = bytearray(
+            CAPTURE_SPAN_DTYPE.itemsize * _CAPTURE_SPAN_QUEUE_SIZE
+        )
 
     async def init(self, client_name: str) -> None:
         if self.jack_interface is not None:
             raise ValueError(
                 "Attempt to initialize an already initialized AMIO interface"
             )
-        self.jack_interface = amio._native.create_jack_interface(client_name)
+        jack_interface = amio._native.create_jack_interface(client_name)
+        if jack_interface < 0:
+            raise RuntimeError("Unable to create the AMIO interface")
+        self.jack_interface = jack_interface
+        amio._native.iface_set_capture_buffer(self.jack_interface, self._capture_ring)
         self.message_task = asyncio.create_task(self._process_messages_and_print_logs())
 
     async def _process_messages_and_print_logs(self) -> None:
+        # Sleep until the I/O thread posts something, instead of polling
+        loop = asyncio.get_running_loop()
+        wakeup = asyncio.Event()
+        wakeup_fd = amio._native.iface_get_wakeup_fd(self.jack_interface)
+        loop.add_reader(wakeup_fd, wakeup.set)
         try:
             while True:
-                result = PythonQueueProcessingResult(
-                    amio._native.iface_process_messages_on_python_queue(
-                        self.jack_interface
-                    )
-                )
-                if result == PythonQueueProcessingResult.PLAYSPEC_APPLIED:
-                    playspec_id = amio._native.iface_get_current_playspec_id(
-                        self.jack_interface
-                    )
-                    if playspec_id >= 0:
-                        self._on_playspec_applied(playspec_id)
-                    self._retry_setting_playspec_if_needed()
-                self._collect_and_print_logs()
+                amio._native.iface_acknowledge_wakeup(self.jack_interface)
                 while True:
-                    input_chunk = self._get_next_input_chunk()
-                    if input_chunk is not None:
-                        self._notify_input_chunk(input_chunk)
-                    if input_chunk is None:
+                    result = PythonQueueProcessingResult(
+                        amio._native.iface_process_messages_on_python_queue(
+                            self.jack_interface
+                        )
+                    )
+                    if result == PythonQueueProcessingResult.NOTHING:
                         break
-                await asyncio.sleep(0.1)
+                    if result == PythonQueueProcessingResult.PLAYSPEC_APPLIED:
+                        self._collect_playspec_reports()
+                        self._retry_setting_playspec_if_needed()
+                self._collect_logs()
+                # The callback may keep the chunks after the next drain
+                for input_chunk in self.drain_input():
+                    self._notify_input_chunk(input_chunk)
+                await wakeup.wait()
+                wakeup.clear()
         except asyncio.CancelledError:
             pass
+        finally:
+            loop.remove_reader(wakeup_fd)
+
+    def _collect_playspec_reports(self) -> None:
+        while True:
+            arr = bytearray(PLAYSPEC_REPORT_DTYPE.itemsize * 64)
+            count = amio._native.iface_get_playspec_reports(self.jack_interface, arr)
+            reports = np.frombuffer(arr, PLAYSPEC_REPORT_DTYPE, count)
+            for report in reports:
+                self._on_playspec_reported(int(report["id"]), bool(report["was_used"]))
+            if count < 64:
+                break
 
-    def _collect_and_print_logs(self) -> None:
-        # Get any new logs from the IO thread.
-        arr = bytearray(4096)
-        amio._native.iface_get_logs(self.jack_interface, arr)
-        log_content, _, _ = arr.partition(b"\x00")
-        self._pending_logs += log_content.decode("utf-8")
+    def _collect_logs(self) -> None:
+        # Only the records of enabled levels are decoded
+        enabled = [
+            event
+            for event, (level, _) in enumerate(LOG_EVENTS)
+            if logger.isEnabledFor(level)
+        ]
+        while True:
+            count = amio._native.iface_get_log_records(
+                self.jack_interface, self._log_records
+            )
+            records = np.frombuffer(self._log_records, LOG_RECORD_DTYPE, count)
+            for record in records[np.isin(records["event"], enabled)]:
+                level, message = LOG_EVENTS[record["event"]]
+                logger.log(
+                    level,
+                    message.format(
+                        value=int(record["value"]),
+                        text=record["text"].decode("utf-8", "replace"),
+                    ),
+                    extra={
+                        "monotonic_ns": int(record["time_ns"]),
+                        "frame": int(record["position"]),
+                    },
+                )
+            if count < _LOG_RECORDS_PER_READ:
+                break
 
-        # Print all pending logs up to the last newline.
-        # The remaining part (after the last newline) will be printed later.
-        lines = self._pending_logs.split("\n")
-        self._pending_logs = lines[-1]
-        for line in lines[:-1]:
-            logger.debug(line)
+        dropped = amio._native.iface_get_dropped_log_records(self.jack_interface)
+        if dropped > self._dropped_log_records:
+            logger.warning(
+                "%d records of the I/O thread log were dropped",
+                dropped - self._dropped_log_records,
+            )
+            self._dropped_log_records = dropped
 
     def get_frame_rate(self) -> float:
         if self.jack_interface is None:
@@ -102,51 +226,182 @@ class NativeInterface(Interface):
             self.jack_interface, 1 if rolling else 0
         )
 
+    def get_transport_snapshot(self) -> TransportSnapshot:
+        if self.jack_interface is None:
+            raise ValueError("Operation on a closed AMIO interface")
+        arr = bytearray(TRANSPORT_SNAPSHOT_DTYPE.itemsize)
+        amio._native.iface_get_transport_snapshot(self.jack_interface, arr)
+        snapshot = np.frombuffer(arr, TRANSPORT_SNAPSHOT_DTYPE)[0]
+        return TransportSnapshot(
+            int(snapshot["period"]),
+            int(snapshot["frame_rate"]),
+            int(snapshot["position"]),
+            bool(snapshot["is_transport_rolling"]),
+            int(snapshot["playspec_id"]),
+        )
+
+    @contextmanager
+    def transaction(self) -> Iterator[None]:
+        if self.jack_interface is None:
+            raise ValueError("Operation on a closed AMIO interface")
+        if not amio._native.iface_begin_transaction(self.jack_interface):
+            raise ValueError("Transactions can't be nested")
+        self._transaction_playspec_ids = []
+        try:
+            yield
+        except BaseException:
+            amio._native.iface_abort_transaction(self.jack_interface)
+            self._close_transaction(discarded=True)
+            raise
+        committed = amio._native.iface_commit_transaction(self.jack_interface) >= 0
+        self._close_transaction(discarded=not committed)
+        if not committed:
+            raise RuntimeError("Transaction doesn't fit in the I/O thread queue")
+
+    def _close_transaction(self, discarded: bool) -> None:
+        if discarded:
+            for playspec_id in self._transaction_playspec_ids or []:
+                self._submitted_playspec_callbacks.pop(playspec_id, None)
+        self._transaction_playspec_ids = None
+        # Changes that were waiting while the transaction was open
+        self._retry_setting_playspec_if_needed()
+
+    def set_param_slot(
+        self,
+        slot: int,
+        gain_l: float,
+        gain_r: float,
+        mute: bool = False,
+        solo: bool = False,
+    ) -> None:
+        if self.jack_interface is None:
+            raise ValueError("Operation on a closed AMIO interface")
+        amio._native.iface_set_param_slot(
+            self.jack_interface, slot, gain_l, gain_r, mute, solo
+        )
+
     def generate_immutable_clip(self, audio_clip: AudioClip) -> ImmutableAudioClip:
+        """
+        Upload the clip to the interface. Clips that aren't writeable are
+        uploaded only once, and the native clip is reused until the clip
+        is made writeable again. A clip at a different frame rate than
+        the interface is resampled by the native code as it's uploaded.
+        """
+        cached = audio_clip.get_cached_immutable_clip(self)
+        if cached is not None:
+            return cached
         interface_frame_rate = self.get_frame_rate()
-        assert audio_clip.frame_rate == interface_frame_rate
-        return ImmutableAudioClip(
+        clip = ImmutableAudioClip(
             self,
-            audio_clip.get_immutable_clip_data(),
+            audio_clip.array,
             audio_clip.channels,
+            audio_clip.frame_rate,
+            audio_clip.native_format,
+        )
+        resampled = audio_clip.frame_rate != interface_frame_rate
+        if resampled:
+            clip = clip.resampled(interface_frame_rate)
+        audio_clip.cache_immutable_clip(self, clip, resampled)
+        return clip
+
+    def open_streaming_clip(
+        self,
+        filename: str,
+        channels: Optional[int] = None,
+        sample_format: Optional[int] = None,
+        data_offset: int = 0,
+    ) -> ImmutableAudioClip:
+        """
+        Create a clip that is streamed from a file during playback instead
+        of being loaded into memory. Without a sample_format, the file
+        is a WAV file; otherwise it contains raw channel-interleaved samples
+        of that format (one of SAMPLE_FORMAT_*) in native byte order,
+        starting at data_offset.
+        """
+        interface_frame_rate = self.get_frame_rate()
+        if sample_format is None:
+            layout = read_wav_layout(filename)
+            assert layout.frame_rate == interface_frame_rate
+            data_offset = layout.data_offset
+            frames = layout.frames
+            channels = layout.channels
+            sample_format = layout.sample_format
+        else:
+            if channels is None or sample_format not in SAMPLE_FORMAT_SIZES:
+                raise ValueError("Invalid layout of the raw file")
+            frame_size = channels * SAMPLE_FORMAT_SIZES[sample_format]
+            frames = (os.path.getsize(filename) - data_offset) // frame_size
+        clip_id = amio._native.AudioClip_init_streaming(
+            filename,
+            data_offset,
+            frames,
+            channels,
             interface_frame_rate,
+            sample_format,
         )
+        if clip_id < 0:
+            raise ValueError("Can't stream the file")
+        clip = ImmutableAudioClip.__new__(ImmutableAudioClip)
+        clip.jack_client = self
+        clip.io_owned_clip = clip_id
+        return clip
+
+    def get_stream_underruns(self) -> int:
+        """
+        Number of times the data of a streaming clip wasn't loaded, or
+        spilled clip data wasn't read back, in time for playback. The missing
+        data is played as silence.
+        """
+        if self.jack_interface is None:
+            raise ValueError("Operation on a closed AMIO interface")
+        return amio._native.iface_get_stream_underruns(self.jack_interface)
+
+    def _get_immutable_clip(self, entry: PlayspecEntry) -> ImmutableAudioClip:
+        if isinstance(entry.clip, ImmutableAudioClip):
+            return entry.clip
+        elif isinstance(entry.clip, AudioClip):
+            return self.generate_immutable_clip(entry.clip)
+        else:
+            raise ValueError("Wrong audio clip type")
+
+    def pack_playspec(self, playspec: Playspec) -> PackedPlayspec:
+        """
+        Convert a playspec into the packed form, uploading every AudioClip
+        it references to the interface.
+        """
+        packed = PackedPlayspec(len(playspec))
+        for entry in playspec:
+            clip = self._get_immutable_clip(entry)
+            packed.append(
+                clip,
+                entry.frame_a,
+                entry.frame_b,
+                entry.play_at_frame,
+                entry.repeat_interval,
+                entry.gain_l,
+                entry.gain_r,
+                entry.param_slot,
+                entry.fade_in,
+                entry.fade_out,
+                entry.fade_in_curve,
+                entry.fade_out_curve,
+            )
+        return packed
 
     def _set_current_playspec(
-        self, playspec: Playspec, insert_at: int, start_from: int
+        self, playspec: AnyPlayspec, insert_at: int, start_from: int
     ) -> Optional[int]:
+        if not isinstance(playspec, PackedPlayspec):
+            playspec = self.pack_playspec(playspec)
         if not amio._native.begin_defining_playspec(
             len(playspec), insert_at, start_from
         ):
             raise RuntimeError("AMIO bug: playspec already being defined")
-        self._keepalive_clips = [None for _ in range(len(playspec))]
-        for n, entry in enumerate(playspec):
-            # Storing in the list to keep this ImmutableAudioClip alive
-            if isinstance(entry.clip, ImmutableAudioClip):
-                self._keepalive_clips[n] = entry.clip
-                entry.clip.use_as_playspec_entry(
-                    n,
-                    entry.frame_a,
-                    entry.frame_b,
-                    entry.play_at_frame,
-                    entry.repeat_interval,
-                    entry.gain_l,
-                    entry.gain_r,
-                )
-            elif isinstance(entry.clip, AudioClip):
-                immutable_clip = self.generate_immutable_clip(entry.clip)
-                self._keepalive_clips[n] = immutable_clip
-                immutable_clip.use_as_playspec_entry(
-                    n,
-                    entry.frame_a,
-                    entry.frame_b,
-                    entry.play_at_frame,
-                    entry.repeat_interval,
-                    entry.gain_l,
-                    entry.gain_r,
-                )
-            else:
-                raise ValueError("Wrong audio clip type")
+        if amio._native.set_entries_in_playspec(playspec.entries) < 0:
+            amio._native.cancel_defining_playspec()
+            raise ValueError("Invalid playspec entry")
+        # Storing the packed playspec to keep its ImmutableAudioClips alive
+        self._keepalive_playspec = playspec
         playspec_id = amio._native.iface_set_playspec(self.jack_interface)
         if playspec_id < 0:
             # Failed to set playspec; most probably the previously set
@@ -154,6 +409,40 @@ class NativeInterface(Interface):
             return None
         return playspec_id
 
+    def _add_patch_operation(self, operation) -> bool:
+        kind = operation[0]
+        if kind == "add":
+            packed = self.pack_playspec([operation[1]])
+            return amio._native.add_entry_in_playspec_patch(packed.entries) >= 0
+        elif kind == "replace":
+            index, entry = operation[1:]
+            packed = self.pack_playspec([entry])
+            return amio._native.replace_entry_in_playspec_patch(index, packed.entries)
+        elif kind == "set_gain":
+            index, gain_l, gain_r = operation[1:]
+            return amio._native.set_entry_gain_in_playspec_patch(index, gain_l, gain_r)
+        elif kind == "remove":
+            return amio._native.remove_entry_in_playspec_patch(operation[1])
+        else:
+            raise ValueError("Unknown playspec patch operation")
+
+    def _apply_playspec_patch(
+        self, patch: PlayspecPatch, apply_at: int
+    ) -> Optional[int]:
+        if not amio._native.begin_defining_playspec_patch(
+            self.jack_interface, apply_at
+        ):
+            # The previous playspec or patch was not yet applied
+            return None
+        for operation in patch.operations:
+            if not self._add_patch_operation(operation):
+                amio._native.cancel_defining_playspec_patch()
+                raise ValueError("Invalid playspec patch operation")
+        playspec_id = amio._native.iface_apply_playspec_patch(self.jack_interface)
+        if playspec_id < 0:
+            return None
+        return playspec_id
+
     async def close(self) -> None:
         self.message_task.cancel()
         await self.message_task
@@ -162,24 +451,78 @@ class NativeInterface(Interface):
     def is_closed(self) -> bool:
         return self.message_task is None
 
-    def _get_next_input_chunk(self) -> Optional[InputAudioChunk]:
-        success = amio._native.iface_begin_reading_input_chunk(self.jack_interface)
-        if not success:
-            return None
-        buf = bytearray(128 * 4)  # 128 float samples
-        if amio._native.InputChunk_get_samples(buf) == 0:
-            raise AssertionError("AMIO bug: invalid buffer length")
-        playspec_id = amio._native.InputChunk_get_playspec_id()
-        starting_frame = amio._native.InputChunk_get_starting_frame()
-        was_transport_rolling = amio._native.InputChunk_get_was_transport_rolling() != 0
-        array = np.frombuffer(buf, dtype=np.float32)
-        array = np.reshape(array, (array.shape[0] // 2, 2))
+    def drain_input(self, copy: bool = True) -> List[InputAudioChunk]:
+        """
+        Return all the input captured since the previous drain, as chunks
+        of consecutive frames captured with the same playspec and transport
+        state. The input returned here isn't passed to input_chunk_callback.
+        If copy is False, the arrays of the chunks are views of the capture
+        ring instead of copies. They are only valid until the next drain,
+        which the message task does whenever the event loop runs it.
+        """
+        count = amio._native.iface_drain_capture(
+            self.jack_interface, self._capture_spans
+        )
+        if count == 0:
+            return []
+        spans = np.frombuffer(self._capture_spans, CAPTURE_SPAN_DTYPE, count)
+
+        # While the transport is stopped, the starting frame doesn't advance
+        rolling = spans["was_transport_rolling"] != 0
+        starts = spans["starting_frame"]
+        expected_starts = np.where(
+            rolling[:-1], starts[:-1] + spans["frames"][:-1], starts[:-1]
+        )
+        breaks = (
+            (spans["playspec_id"][1:] != spans["playspec_id"][:-1])
+            | (rolling[1:] != rolling[:-1])
+            | (starts[1:] != expected_starts)
+        )
+        firsts = np.concatenate(([0], np.flatnonzero(breaks) + 1))
+        ends = np.append(firsts[1:], count)
+
         frame_rate = self.get_frame_rate()
-        return InputAudioChunk(
-            array,
-            frame_rate,
-            playspec_id,
-            starting_frame,
-            was_transport_rolling,
-            datetime.now(timezone.utc),
+        wall_time = datetime.now(timezone.utc)
+        chunks = []
+        for first, end in zip(firsts, ends):
+            capture_frame = int(spans["capture_frame"][first])
+            frames = (
+                int(spans["capture_frame"][end - 1] + spans["frames"][end - 1])
+                - capture_frame
+            )
+            chunks.append(
+                InputAudioChunk(
+                    self._captured_frames(capture_frame, frames, copy),
+                    frame_rate,
+                    int(spans["playspec_id"][first]),
+                    int(starts[first]),
+                    bool(rolling[first]),
+                    wall_time,
+                )
+            )
+        return chunks
+
+    def _captured_frames(
+        self, capture_frame: int, frames: int, copy: bool
+    ) -> np.ndarray:
+        length = len(self._capture_ring)
+        offset = capture_frame % length
+        if offset + frames <= length:
+            array = self._capture_ring[offset : offset + frames]
+            return array.copy() if copy else array
+        # Frames wrapping around the end of the ring can't be a view
+        return np.concatenate(
+            (
+                self._capture_ring[offset:],
+                self._capture_ring[: offset + frames - length],
+            )
         )
+
+    def get_capture_overruns(self) -> int:
+        """
+        Number of periods of input that were dropped, because the capture
+        ring was full
+        """
+        if self.jack_interface is None:
+            raise ValueError("Operation on a closed AMIO interface")
+        return amio._native.iface_get_capture_overruns(self.jack_interface)
@@ -1,6 +1,6 @@
 from amio.audio_clip import InputAudioChunk
-from amio.interface import Interface, InputChunkCallback
-from amio.playspec import Playspec
+from amio.interface import Interface, InputChunkCallback, TransportSnapshot
+from amio.playspec import AnyPlayspec, PlayspecPatch
 from datetime import datetime, timedelta, timezone
 import numpy as np
 
@@ -17,14 +17,16 @@ class NullInterface(Interface):
         super().__init__()
         self._frame_rate = frame_rate
         self._position = 0
+        self._period = 0
         self._current_playspec_id = 1
         self._is_transport_rolling = False
-        self._playspec: Playspec = []
+        self._playspec: AnyPlayspec = []
         self._closed = False
         self._time = starting_time or datetime.now(timezone.utc)
 
     def advance_single_chunk_length(self) -> None:
         self._on_playspec_applied(self._current_playspec_id)
+        self._period += 1
         chunk = InputAudioChunk(
             np.zeros((self.chunk_length, 2), np.float32),
             self._frame_rate,
@@ -61,14 +63,41 @@ class NullInterface(Interface):
         assert not self._closed
         self._is_transport_rolling = rolling
 
-    def _set_current_playspec(
-        self, playspec: Playspec, insert_at: int, start_from: int
+    def get_transport_snapshot(self) -> TransportSnapshot:
+        assert not self._closed
+        return TransportSnapshot(
+            self._period,
+            self._frame_rate,
+            self._position,
+            self._is_transport_rolling,
+            self._current_playspec_id,
+        )
+
+    def set_param_slot(
+        self,
+        slot: int,
+        gain_l: float,
+        gain_r: float,
+        mute: bool = False,
+        solo: bool = False,
     ) -> None:
         assert not self._closed
+
+    def _set_current_playspec(
+        self, playspec: AnyPlayspec, insert_at: int, start_from: int
+    ) -> int:
+        assert not self._closed
         self._playspec = playspec
         self._position = start_from
         self._current_playspec_id += 1
         # TODO Support insert_at
+        return self._current_playspec_id
+
+    def _apply_playspec_patch(self, patch: PlayspecPatch, apply_at: int) -> int:
+        assert not self._closed
+        # The playback stream is discarded, so the entries aren't needed
+        self._current_playspec_id += 1
+        return self._current_playspec_id
 
     async def close(self) -> None:
         assert not self._closed
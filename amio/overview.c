@@ -0,0 +1,180 @@
+#include "overview.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_clip.h"
+#include "clip_store.h"
+#include "mixer.h"
+
+static int64_t level_frames(int level)
+{
+    int64_t frames = OVERVIEW_BASE_FRAMES;
+    for (int i = 0; i < level; ++i)
+        frames *= OVERVIEW_LEVEL_FACTOR;
+    return frames;
+}
+
+static void clear_bin(struct OverviewBin *bin)
+{
+    bin->min = INFINITY;
+    bin->max = -INFINITY;
+    bin->sum_squares = 0.0f;
+}
+
+static void add_to_bin(struct OverviewBin *bin, const struct OverviewBin *other)
+{
+    if (other->min < bin->min)
+        bin->min = other->min;
+    if (other->max > bin->max)
+        bin->max = other->max;
+    bin->sum_squares += other->sum_squares;
+}
+
+/* Summarize frames [frame, frame + frames) of the clip from its samples */
+static void summarize_frames(
+    const struct AudioClip *clip,
+    int64_t frame,
+    int64_t frames,
+    struct OverviewBin *bin)
+{
+    /* Runs on the Python thread */
+
+    clear_bin(bin);
+    while (frames > 0) {
+        clip_store_page_in(clip->blocks[frame / CLIP_BLOCK_FRAMES]);
+
+        int n;
+        const char *data = audio_clip_frame_data(clip, frame, &n);
+        if (n > frames)
+            n = frames;
+
+        struct OverviewBin part;
+        mixer_summarize(
+            clip->format, data, n * clip->channels,
+            &part.min, &part.max, &part.sum_squares);
+        add_to_bin(bin, &part);
+
+        frame += n;
+        frames -= n;
+    }
+}
+
+struct ClipOverview * overview_create(int64_t length)
+{
+    /* Runs on the Python thread */
+
+    struct ClipOverview *overview = malloc(sizeof(struct ClipOverview));
+    for (int level = 0; level < OVERVIEW_LEVELS; ++level) {
+        int64_t frames = level_frames(level);
+        overview->num_bins[level] = (length + frames - 1) / frames;
+
+        /* All zeros is the summary of silence */
+        overview->bins[level] = calloc(
+            overview->num_bins[level] + 1, sizeof(struct OverviewBin));
+    }
+    return overview;
+}
+
+void overview_copy(
+    struct ClipOverview *overview, const struct ClipOverview *source)
+{
+    /* Runs on the Python thread */
+
+    for (int level = 0; level < OVERVIEW_LEVELS; ++level) {
+        memcpy(overview->bins[level], source->bins[level],
+            source->num_bins[level] * sizeof(struct OverviewBin));
+    }
+}
+
+void overview_update(
+    struct ClipOverview *overview,
+    const struct AudioClip *clip,
+    int64_t frame,
+    int64_t frames)
+{
+    /* Runs on the Python thread */
+
+    if (frames <= 0)
+        return;
+
+    int64_t first = frame / OVERVIEW_BASE_FRAMES;
+    int64_t last = (frame + frames - 1) / OVERVIEW_BASE_FRAMES;
+    for (int64_t i = first; i <= last; ++i) {
+        int64_t bin_frame = i * OVERVIEW_BASE_FRAMES;
+        int64_t bin_frames = clip->length - bin_frame;
+        if (bin_frames > OVERVIEW_BASE_FRAMES)
+            bin_frames = OVERVIEW_BASE_FRAMES;
+        summarize_frames(clip, bin_frame, bin_frames, &overview->bins[0][i]);
+    }
+
+    /* Every coarser bin combines the bins of the previous level it covers */
+    for (int level = 1; level < OVERVIEW_LEVELS; ++level) {
+        const struct OverviewBin *finer = overview->bins[level - 1];
+        int64_t num_finer = overview->num_bins[level - 1];
+        first /= OVERVIEW_LEVEL_FACTOR;
+        last /= OVERVIEW_LEVEL_FACTOR;
+        for (int64_t i = first; i <= last; ++i) {
+            struct OverviewBin *bin = &overview->bins[level][i];
+            clear_bin(bin);
+            for (int64_t j = i * OVERVIEW_LEVEL_FACTOR;
+                    j < (i + 1) * OVERVIEW_LEVEL_FACTOR && j < num_finer; ++j)
+                add_to_bin(bin, &finer[j]);
+        }
+    }
+}
+
+void overview_destroy(struct ClipOverview *overview)
+{
+    /* Runs on the Python thread */
+
+    for (int level = 0; level < OVERVIEW_LEVELS; ++level)
+        free(overview->bins[level]);
+    free(overview);
+}
+
+void overview_query(
+    const struct ClipOverview *overview,
+    const struct AudioClip *clip,
+    int64_t start_frame,
+    int frames_per_bin,
+    struct OverviewPoint *points,
+    int num_points)
+{
+    /* Runs on the Python thread */
+
+    int level = 0;
+    while (level + 1 < OVERVIEW_LEVELS
+            && level_frames(level + 1) <= frames_per_bin)
+        ++level;
+    int64_t bin_frames = level_frames(level);
+
+    for (int i = 0; i < num_points; ++i) {
+        int64_t a = start_frame + (int64_t)i * frames_per_bin;
+        int64_t b = a + frames_per_bin;
+        if (b > clip->length)
+            b = clip->length;
+
+        struct OverviewBin bin;
+        if (frames_per_bin < OVERVIEW_BASE_FRAMES) {
+            summarize_frames(clip, a, b - a, &bin);
+        } else {
+            int64_t first = a / bin_frames;
+            int64_t last = (b - 1) / bin_frames;
+            clear_bin(&bin);
+            for (int64_t j = first; j <= last; ++j)
+                add_to_bin(&bin, &overview->bins[level][j]);
+
+            /* The RMS is over the whole bins */
+            a = first * bin_frames;
+            b = (last + 1) * bin_frames;
+            if (b > clip->length)
+                b = clip->length;
+        }
+
+        points[i].min = bin.min;
+        points[i].max = bin.max;
+        points[i].rms = sqrtf(bin.sum_squares / ((b - a) * clip->channels));
+    }
+}
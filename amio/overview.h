@@ -0,0 +1,81 @@
+#ifndef OVERVIEW_H
+#define OVERVIEW_H
+
+#include <stdint.h>
+
+struct AudioClip;
+
+/* Number of frames summarized by a bin of the finest level of an overview */
+#define OVERVIEW_BASE_FRAMES 64
+
+/* Bins of every level are this many times longer than of the previous one */
+#define OVERVIEW_LEVEL_FACTOR 4
+
+/* Levels of 64, 256, 1024 and 4096 frames per bin */
+#define OVERVIEW_LEVELS 4
+
+/*
+ * The overview of a clip summarizes its samples for drawing waveforms
+ * and meters. Every level splits the clip into bins of a fixed number
+ * of frames, and keeps the smallest and the largest sample and the sum
+ * of squares of the samples of every bin, over all channels.
+ *
+ * Native clips keep their overview up to date as their samples are stored,
+ * so an overview of any resolution can be served from the nearest level
+ * without reading the samples.
+ */
+struct OverviewBin
+{
+    float min;
+    float max;
+    float sum_squares;
+};
+
+struct ClipOverview
+{
+    int64_t num_bins[OVERVIEW_LEVELS];
+    struct OverviewBin *bins[OVERVIEW_LEVELS];
+};
+
+/* A point of an overview passed to Python; matches OVERVIEW_DTYPE */
+struct OverviewPoint
+{
+    float min;
+    float max;
+    float rms;
+};
+
+/* API for C code */
+
+/* Create the overview of a silent clip of the given length */
+struct ClipOverview * overview_create(int64_t length);
+
+/* Copy the overview of a clip of the same length */
+void overview_copy(
+    struct ClipOverview *overview, const struct ClipOverview *source);
+
+/* Summarize frames [frame, frame + frames) of the clip anew */
+void overview_update(
+    struct ClipOverview *overview,
+    const struct AudioClip *clip,
+    int64_t frame,
+    int64_t frames);
+
+void overview_destroy(struct ClipOverview *overview);
+
+/*
+ * Fill the points, each of which summarizes frames_per_bin frames
+ * of the clip from start_frame on. Points longer than a bin are served from
+ * the coarsest level whose bins they contain, and cover the whole bins they
+ * overlap. Shorter points are computed from the samples, which are read back
+ * if they were spilled. All the points must start within the clip.
+ */
+void overview_query(
+    const struct ClipOverview *overview,
+    const struct AudioClip *clip,
+    int64_t start_frame,
+    int frames_per_bin,
+    struct OverviewPoint *points,
+    int num_points);
+
+#endif
@@ -0,0 +1,75 @@
+#include "param_table.h"
+
+void param_table_init(struct ParamTable *table)
+{
+    /* Runs on the Python thread */
+
+    for (int i = 0; i < MAX_PARAM_SLOTS; ++i) {
+        struct ParamSlot *slot = &table->slots[i];
+        slot->target_gain_l = 1.0;
+        slot->target_gain_r = 1.0;
+        slot->mute = false;
+        slot->solo = false;
+        slot->start_gain_l = 1.0;
+        slot->start_gain_r = 1.0;
+        slot->end_gain_l = 1.0;
+        slot->end_gain_r = 1.0;
+    }
+    table->num_soloed_slots = 0;
+}
+
+void param_table_set(
+    struct ParamTable *table,
+    int slot_number,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo)
+{
+    /* Runs on the Python thread */
+
+    if (slot_number < 0 || slot_number >= MAX_PARAM_SLOTS)
+        return;
+
+    struct ParamSlot *slot = &table->slots[slot_number];
+
+    if (solo != slot->solo) {
+        __atomic_store_n(
+            &table->num_soloed_slots,
+            table->num_soloed_slots + (solo ? 1 : -1),
+            __ATOMIC_RELAXED);
+    }
+
+    __atomic_store(&slot->target_gain_l, &gain_l, __ATOMIC_RELAXED);
+    __atomic_store(&slot->target_gain_r, &gain_r, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->mute, mute, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->solo, solo, __ATOMIC_RELAXED);
+}
+
+void param_table_begin_period(struct ParamTable *table)
+{
+    /* Runs on the I/O thread */
+
+    bool any_soloed = __atomic_load_n(
+        &table->num_soloed_slots, __ATOMIC_RELAXED) > 0;
+
+    for (int i = 0; i < MAX_PARAM_SLOTS; ++i) {
+        struct ParamSlot *slot = &table->slots[i];
+
+        float gain_l, gain_r;
+        __atomic_load(&slot->target_gain_l, &gain_l, __ATOMIC_RELAXED);
+        __atomic_load(&slot->target_gain_r, &gain_r, __ATOMIC_RELAXED);
+        bool mute = __atomic_load_n(&slot->mute, __ATOMIC_RELAXED);
+        bool solo = __atomic_load_n(&slot->solo, __ATOMIC_RELAXED);
+
+        if (mute || (any_soloed && !solo)) {
+            gain_l = 0.0;
+            gain_r = 0.0;
+        }
+
+        slot->start_gain_l = slot->end_gain_l;
+        slot->start_gain_r = slot->end_gain_r;
+        slot->end_gain_l = gain_l;
+        slot->end_gain_r = gain_r;
+    }
+}
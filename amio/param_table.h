@@ -0,0 +1,81 @@
+#ifndef PARAM_TABLE_H
+#define PARAM_TABLE_H
+
+#include <stdbool.h>
+
+#define MAX_PARAM_SLOTS 256
+
+/*
+ * A parameter slot holds the gains of a track or a group of playspec
+ * entries, so that they can be changed without resending the playspec.
+ * The gains of every entry that references the slot are multiplied
+ * by the gains of the slot.
+ *
+ * The target values are written by the Python thread at any time and read
+ * by the I/O thread once per period, without locking. Every value is stored
+ * atomically, so the I/O thread may see a change of one value one period
+ * before a change of another one, which isn't audible.
+ */
+struct ParamSlot
+{
+    /* Written by the Python thread */
+    float target_gain_l;
+    float target_gain_r;
+    bool mute;
+    bool solo;
+
+    /*
+     * Only accessed by the I/O thread: the gains at the beginning
+     * and at the end of the current period. The gains ramp linearly
+     * between them.
+     */
+    float start_gain_l;
+    float start_gain_r;
+    float end_gain_l;
+    float end_gain_r;
+};
+
+struct ParamTable
+{
+    struct ParamSlot slots[MAX_PARAM_SLOTS];
+
+    /* Written by the Python thread */
+    int num_soloed_slots;
+};
+
+void param_table_init(struct ParamTable *table);
+
+/* Runs on the Python thread */
+void param_table_set(
+    struct ParamTable *table,
+    int slot,
+    float gain_l,
+    float gain_r,
+    bool mute,
+    bool solo);
+
+/*
+ * Read the targets set by the Python thread. If any slot is soloed,
+ * slots that aren't soloed are muted. Runs on the I/O thread.
+ */
+void param_table_begin_period(struct ParamTable *table);
+
+/* Whether the gains of the slot change during the current period */
+static inline bool param_slot_is_ramping(const struct ParamSlot *slot)
+{
+    return slot->start_gain_l != slot->end_gain_l
+        || slot->start_gain_r != slot->end_gain_r;
+}
+
+/*
+ * Gains of the slot at the given position in the current period,
+ * which is expressed as a fraction of the period length.
+ */
+static inline void param_slot_gains_at(
+    const struct ParamSlot *slot, float t, float *gain_l, float *gain_r)
+{
+    *gain_l = slot->start_gain_l + (slot->end_gain_l - slot->start_gain_l) * t;
+    *gain_r = slot->start_gain_r + (slot->end_gain_r - slot->start_gain_r) * t;
+}
+
+#endif
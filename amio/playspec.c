@@ -2,8 +2,11 @@
 
 #include "stddef.h"
 #include <stdlib.h>
+#include <string.h>
 
 #include "audio_clip.h"
+#include "param_table.h"
+#include "render_list.h"
 
 static struct Playspec *playspec_being_built = NULL;
 
@@ -20,24 +23,45 @@ bool begin_defining_playspec(int size, int insert_at, int start_from)
     playspec_being_built->num_entries = size;
     playspec_being_built->entries = malloc(
         size * sizeof(struct PlayspecEntry));
+    playspec_being_built->entry_rows = malloc(size * sizeof(int));
+    playspec_being_built->entries_capacity = size;
 
     for (int i = 0; i < size; ++i) {
         playspec_being_built->entries[i].audio_clip_id = -1;
         playspec_being_built->entries[i].clip_frame_a = 0;
         playspec_being_built->entries[i].clip_frame_b = 0;
         playspec_being_built->entries[i].play_at_frame = 0;
+        playspec_being_built->entries[i].repeat_interval = 0;
         playspec_being_built->entries[i].gain_l = 1.0;
         playspec_being_built->entries[i].gain_r = 1.0;
+        playspec_being_built->entries[i].param_slot = -1;
+        playspec_being_built->entries[i].fade_in = 0;
+        playspec_being_built->entries[i].fade_out = 0;
+        playspec_being_built->entries[i].fade_in_curve = FADE_CURVE_LINEAR;
+        playspec_being_built->entries[i].fade_out_curve = FADE_CURVE_LINEAR;
     }
 
-    playspec_being_built->id = next_playspec_id;
-    next_playspec_id += 1;
+    playspec_being_built->id = allocate_playspec_id();
     playspec_being_built->insert_at = insert_at;
     playspec_being_built->start_from = start_from;
+    playspec_being_built->referenced_by_native_code = false;
+    playspec_being_built->was_superseded = false;
+    playspec_being_built->render_list = NULL;
 
     return true;
 }
 
+void cancel_defining_playspec()
+{
+    /* Runs on the Python thread */
+
+    if (!playspec_being_built)
+        return;
+
+    destroy_playspec(playspec_being_built);
+    playspec_being_built = NULL;
+}
+
 void set_entry_in_playspec(
     int n,
     int clip_id,
@@ -59,6 +83,66 @@ void set_entry_in_playspec(
     playspec_being_built->entries[n].gain_r = gain_r;
 }
 
+bool unpack_playspec_entry(
+    const struct PackedPlayspecEntry *packed, struct PlayspecEntry *entry)
+{
+    if (packed->clip_frame_a > packed->clip_frame_b)
+        return false;
+    if (packed->repeat_interval < 0)
+        return false;
+    if (!get_audio_clip_by_id(packed->clip_id))
+        return false;
+    if (packed->param_slot < -1 || packed->param_slot >= MAX_PARAM_SLOTS)
+        return false;
+    if (packed->fade_in < 0 || packed->fade_out < 0)
+        return false;
+    if (packed->fade_in_curve < 0 || packed->fade_in_curve >= NUM_FADE_CURVES)
+        return false;
+    if (packed->fade_out_curve < 0
+            || packed->fade_out_curve >= NUM_FADE_CURVES)
+        return false;
+
+    entry->audio_clip_id = packed->clip_id;
+    entry->clip_frame_a = packed->clip_frame_a;
+    entry->clip_frame_b = packed->clip_frame_b;
+    entry->play_at_frame = packed->play_at_frame;
+    entry->repeat_interval = packed->repeat_interval;
+    entry->gain_l = packed->gain_l;
+    entry->gain_r = packed->gain_r;
+    entry->param_slot = packed->param_slot;
+    entry->fade_in = packed->fade_in;
+    entry->fade_out = packed->fade_out;
+    entry->fade_in_curve = packed->fade_in_curve;
+    entry->fade_out_curve = packed->fade_out_curve;
+    return true;
+}
+
+int set_entries_in_playspec(char *bytes, int n)
+{
+    /* Runs on the Python thread */
+
+    if (!playspec_being_built)
+        return -1;
+
+    if (n % sizeof(struct PackedPlayspecEntry) != 0)
+        return -1;
+
+    int num_entries = n / sizeof(struct PackedPlayspecEntry);
+    if (num_entries != playspec_being_built->num_entries)
+        return -1;
+
+    const struct PackedPlayspecEntry *packed =
+        (const struct PackedPlayspecEntry *)bytes;
+    struct PlayspecEntry *entries = playspec_being_built->entries;
+
+    for (int i = 0; i < num_entries; ++i) {
+        if (!unpack_playspec_entry(&packed[i], &entries[i]))
+            return -1;
+    }
+
+    return num_entries;
+}
+
 struct Playspec * get_built_playspec()
 {
     struct Playspec *result = playspec_being_built;
@@ -73,9 +157,53 @@ struct Playspec * create_empty_playspec()
     struct Playspec *result = malloc(sizeof(struct Playspec));
     result->num_entries = 0;
     result->entries = NULL;
-    result->id = next_playspec_id;
-    next_playspec_id += 1;
+    result->entry_rows = NULL;
+    result->entries_capacity = 0;
+    result->id = allocate_playspec_id();
     result->insert_at = 0;
     result->start_from = 0;
+    result->referenced_by_native_code = false;
+    result->was_superseded = false;
+    result->render_list = compile_render_list(result);
     return result;
 }
+
+void destroy_playspec(struct Playspec *playspec)
+{
+    /* Runs on the Python thread */
+
+    destroy_render_list(playspec->render_list);
+    free(playspec->entry_rows);
+    free(playspec->entries);
+    free(playspec);
+}
+
+struct Playspec * copy_playspec(
+    const struct Playspec *playspec, int insert_at, int start_from)
+{
+    /* Runs on the Python thread */
+
+    int size = playspec->num_entries;
+
+    struct Playspec *result = malloc(sizeof(struct Playspec));
+    result->num_entries = size;
+    result->entries = malloc(size * sizeof(struct PlayspecEntry));
+    memcpy(result->entries, playspec->entries,
+        size * sizeof(struct PlayspecEntry));
+    result->entry_rows = malloc(size * sizeof(int));
+    result->entries_capacity = size;
+    result->id = allocate_playspec_id();
+    result->insert_at = insert_at;
+    result->start_from = start_from;
+    result->referenced_by_native_code = false;
+    result->was_superseded = false;
+    result->render_list = NULL;
+    return result;
+}
+
+int allocate_playspec_id()
+{
+    /* Runs on the Python thread */
+
+    return next_playspec_id++;
+}
@@ -4,6 +4,14 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct RenderList;
+
+/* Shapes of fade curves */
+#define FADE_CURVE_LINEAR 0
+#define FADE_CURVE_EQUAL_POWER 1  /* quarter of a sine wave */
+#define FADE_CURVE_SMOOTH 2       /* half of a cosine wave, flat at both ends */
+#define NUM_FADE_CURVES 3
+
 struct PlayspecEntry
 {
     /* Audio clip to mix into the output */
@@ -31,6 +39,25 @@ struct PlayspecEntry
      */
     float gain_l;
     float gain_r;
+
+    /*
+     * If not -1, the slot of the interface parameter table whose gains,
+     * mute and solo also apply to this entry
+     */
+    int param_slot;
+
+    /*
+     * Lengths of the fade-in at the beginning and of the fade-out
+     * at the end of the clip region (in frames, 0 for none), and the shapes
+     * of their curves. If the region extends past the end of the clip,
+     * the fade-out ends with the last frame of the clip. Fades are applied
+     * while mixing, so the clip data isn't modified. Every repetition
+     * of a periodic entry is faded.
+     */
+    int fade_in;
+    int fade_out;
+    int fade_in_curve;
+    int fade_out_curve;
 };
 
 struct Playspec
@@ -38,6 +65,15 @@ struct Playspec
     int num_entries;
     struct PlayspecEntry *entries;
 
+    /*
+     * Row of the render list that every entry was compiled into,
+     * or -1 if the entry can't produce any sound. The entries and their rows
+     * are only accessed by the Python thread, so playspec patches can
+     * modify them, and grow both arrays up to entries_capacity.
+     */
+    int *entry_rows;
+    int entries_capacity;
+
     /*
      * Playspec tracking id.
      */
@@ -64,11 +100,45 @@ struct Playspec
      * by a new playspec.
      */
     bool referenced_by_native_code;
+
+    /*
+     * Set by the I/O thread if the playspec was replaced by the next
+     * scheduled one at the same frame at which it was applied,
+     * before the Python thread is notified.
+     */
+    bool was_superseded;
+
+    /*
+     * Entries compiled into the form used by the I/O thread for mixing.
+     * Compiled on the Python thread when the playspec is set.
+     */
+    struct RenderList *render_list;
+};
+
+/*
+ * Layout of a single entry in a buffer passed to set_entries_in_playspec.
+ * It must match PLAYSPEC_ENTRY_DTYPE in playspec.py.
+ */
+struct PackedPlayspecEntry
+{
+    int32_t clip_id;
+    int32_t clip_frame_a;
+    int32_t clip_frame_b;
+    int32_t play_at_frame;
+    int32_t repeat_interval;
+    float gain_l;
+    float gain_r;
+    int32_t param_slot;
+    int32_t fade_in;
+    int32_t fade_out;
+    int32_t fade_in_curve;
+    int32_t fade_out_curve;
 };
 
 /* API for Python code */
 
 bool begin_defining_playspec(int size, int insert_at, int start_from);
+void cancel_defining_playspec();
 void set_entry_in_playspec(
     int n,
     int clip_id,
@@ -76,9 +146,35 @@ void set_entry_in_playspec(
     int play_at_frame, int repeat_interval,
     float gain_l, float gain_r);
 
+/*
+ * Set all entries of the playspec being defined from a buffer
+ * of struct PackedPlayspecEntry. The number of entries in the buffer
+ * must be equal to the playspec size. Returns the number of entries set,
+ * or -1 if the buffer or any of the entries is invalid.
+ */
+int set_entries_in_playspec(char *bytes, int n);
+
 /* API for C code */
 
+/*
+ * Convert a packed entry, returning false if it's invalid (e.g. it references
+ * a clip that doesn't exist)
+ */
+bool unpack_playspec_entry(
+    const struct PackedPlayspecEntry *packed, struct PlayspecEntry *entry);
+
 struct Playspec * get_built_playspec();
 struct Playspec * create_empty_playspec();
+void destroy_playspec(struct Playspec *playspec);
+
+/*
+ * Create a playspec with a new id and the same entries as the given one.
+ * Its render list is not compiled.
+ */
+struct Playspec * copy_playspec(
+    const struct Playspec *playspec, int insert_at, int start_from);
+
+/* Return a playspec id that was not used yet */
+int allocate_playspec_id();
 
 #endif
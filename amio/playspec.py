@@ -1,15 +1,30 @@
 from amio.audio_clip import ImmutableAudioClip
 import amio._native
 from collections import namedtuple
-from typing import List
+import numpy as np
+from typing import Any, List, Tuple, Union
+
+
+# Shapes of fade curves; must match FADE_CURVE_* in playspec.h
+FADE_CURVE_LINEAR = 0
+FADE_CURVE_EQUAL_POWER = 1
+FADE_CURVE_SMOOTH = 2
 
 
 class PlayspecEntry(
     namedtuple(
         "PlayspecEntry",
-        "clip frame_a frame_b play_at_frame repeat_interval gain_l gain_r",
+        "clip frame_a frame_b play_at_frame repeat_interval gain_l gain_r "
+        "param_slot fade_in fade_out fade_in_curve fade_out_curve",
+        defaults=(-1, 0, 0, FADE_CURVE_LINEAR, FADE_CURVE_LINEAR),
     )
 ):
+    """
+    A clip region played at a given position. fade_in and fade_out are
+    lengths in frames of the fades at the beginning and at the end
+    of the region; they are applied by the mixer, without copying the clip.
+    """
+
     @property
     def start(self):
         return self.play_at_frame
@@ -38,3 +53,119 @@ class PlayspecEntry(
 
 
 Playspec = List[PlayspecEntry]
+
+
+# Must match struct PackedPlayspecEntry in playspec.h
+PLAYSPEC_ENTRY_DTYPE = np.dtype(
+    [
+        ("clip_id", np.int32),
+        ("frame_a", np.int32),
+        ("frame_b", np.int32),
+        ("play_at_frame", np.int32),
+        ("repeat_interval", np.int32),
+        ("gain_l", np.float32),
+        ("gain_r", np.float32),
+        ("param_slot", np.int32),
+        ("fade_in", np.int32),
+        ("fade_out", np.int32),
+        ("fade_in_curve", np.int32),
+        ("fade_out_curve", np.int32),
+    ]
+)
+
+
+class PackedPlayspec:
+    """
+    A playspec whose entries are kept in a NumPy structured array
+    of PLAYSPEC_ENTRY_DTYPE, so that it can be passed to the native code
+    in a single call. Unlike Playspec, it can only reference clips
+    that were already uploaded to the interface (ImmutableAudioClip).
+    The clips are kept alive for as long as the packed playspec exists.
+    """
+
+    def __init__(self, capacity: int = 16):
+        self._entries = np.zeros(max(capacity, 1), PLAYSPEC_ENTRY_DTYPE)
+        self._length = 0
+        self._clips: List[ImmutableAudioClip] = []
+
+    def __len__(self):
+        return self._length
+
+    @property
+    def entries(self) -> np.ndarray:
+        """
+        The structured array of entries. It can be modified in place, e.g.
+        to change gains of many entries at once.
+        """
+        return self._entries[: self._length]
+
+    @property
+    def clips(self) -> List[ImmutableAudioClip]:
+        return self._clips
+
+    def append(
+        self,
+        clip: ImmutableAudioClip,
+        frame_a: int,
+        frame_b: int,
+        play_at_frame: int,
+        repeat_interval: int = 0,
+        gain_l: float = 1.0,
+        gain_r: float = 1.0,
+        param_slot: int = -1,
+        fade_in: int = 0,
+        fade_out: int = 0,
+        fade_in_curve: int = FADE_CURVE_LINEAR,
+        fade_out_curve: int = FADE_CURVE_LINEAR,
+    ) -> None:
+        if self._length == len(self._entries):
+            self._entries = np.resize(self._entries, 2 * len(self._entries))
+        self._entries[self._length] = (
+            clip.io_owned_clip,
+            frame_a,
+            frame_b,
+            play_at_frame,
+            repeat_interval,
+            gain_l,
+            gain_r,
+            param_slot,
+            fade_in,
+            fade_out,
+            fade_in_curve,
+            fade_out_curve,
+        )
+        self._length += 1
+        self._clips.append(clip)
+
+
+AnyPlayspec = Union[Playspec, PackedPlayspec]
+
+
+class PlayspecPatch:
+    """
+    A set of changes to the entries of the current playspec, which is sent
+    to the interface instead of a whole new playspec, so that the cost
+    of an edit doesn't depend on the size of the playspec.
+
+    Entries are addressed by their index in the playspec. Entries added
+    by a patch get the following indices, in order. Removed entries keep
+    their index, so the indices stay valid until a new playspec is set.
+    """
+
+    def __init__(self):
+        self.operations: List[Tuple[Any, ...]] = []
+
+    def __len__(self):
+        return len(self.operations)
+
+    def add(self, entry: PlayspecEntry) -> None:
+        self.operations.append(("add", entry))
+
+    def replace(self, index: int, entry: PlayspecEntry) -> None:
+        self.operations.append(("replace", index, entry))
+
+    def set_gain(self, index: int, gain_l: float, gain_r: float) -> None:
+        self.operations.append(("set_gain", index, gain_l, gain_r))
+
+    def remove(self, index: int) -> None:
+        self.operations.append(("remove", index))
@@ -0,0 +1,347 @@
+#include "playspec_patch.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "interface.h"
+#include "render_list.h"
+
+static struct PlayspecPatch *patch_being_built = NULL;
+
+bool begin_defining_playspec_patch(int interface_id, int apply_at)
+{
+    /* Runs on the Python thread */
+
+    if (patch_being_built)
+        return false;
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface)
+        return false;
+
+    /* Patches can only be applied to a playspec that is already current */
+    if (interface->py_thread_scheduled_playspecs.count
+            || interface->py_thread_pending_patch)
+        return false;
+
+    struct Playspec *playspec = interface->py_thread_current_playspec;
+
+    patch_being_built = malloc(sizeof(struct PlayspecPatch));
+    patch_being_built->playspec = playspec;
+    patch_being_built->id = -1;
+    patch_being_built->apply_at = apply_at;
+
+    patch_being_built->num_patched_entries = 0;
+    patch_being_built->patched_entries_capacity = 0;
+    patch_being_built->patched_entries = NULL;
+
+    /*
+     * The I/O thread only changes the number of rows when applying a patch,
+     * and there is no patch pending, so it's safe to read it here.
+     */
+    patch_being_built->first_added_row = playspec->render_list->num_rows;
+    patch_being_built->added_rows = create_render_list(16);
+
+    patch_being_built->num_disabled_rows = 0;
+    patch_being_built->disabled_rows_capacity = 0;
+    patch_being_built->disabled_rows = NULL;
+
+    patch_being_built->num_gain_changes = 0;
+    patch_being_built->gain_changes_capacity = 0;
+    patch_being_built->gain_changes = NULL;
+
+    return true;
+}
+
+void cancel_defining_playspec_patch()
+{
+    /* Runs on the Python thread */
+
+    if (!patch_being_built)
+        return;
+
+    undo_playspec_patch(patch_being_built);
+    destroy_playspec_patch(patch_being_built);
+    patch_being_built = NULL;
+}
+
+static void * grow_array(void *array, int *capacity, int size, int item_size)
+{
+    if (size < *capacity)
+        return array;
+
+    *capacity = *capacity ? 2 * *capacity : 16;
+    return realloc(array, *capacity * item_size);
+}
+
+/* Whether the entries only differ in gains */
+static bool same_region(
+    const struct PlayspecEntry *a, const struct PlayspecEntry *b)
+{
+    return a->audio_clip_id == b->audio_clip_id
+        && a->clip_frame_a == b->clip_frame_a
+        && a->clip_frame_b == b->clip_frame_b
+        && a->play_at_frame == b->play_at_frame
+        && a->repeat_interval == b->repeat_interval
+        && a->param_slot == b->param_slot
+        && a->fade_in == b->fade_in
+        && a->fade_out == b->fade_out
+        && a->fade_in_curve == b->fade_in_curve
+        && a->fade_out_curve == b->fade_out_curve;
+}
+
+static void record_patched_entry(
+    struct PlayspecPatch *patch, int index, bool added)
+{
+    struct Playspec *playspec = patch->playspec;
+
+    patch->patched_entries = grow_array(
+        patch->patched_entries,
+        &patch->patched_entries_capacity,
+        patch->num_patched_entries,
+        sizeof(struct PatchedEntry));
+
+    struct PatchedEntry *patched =
+        &patch->patched_entries[patch->num_patched_entries++];
+    patched->index = index;
+    patched->added = added;
+    if (added) {
+        patched->row = -1;
+    } else {
+        patched->entry = playspec->entries[index];
+        patched->row = playspec->entry_rows[index];
+    }
+}
+
+static int add_row(struct PlayspecPatch *patch, struct PlayspecEntry *entry)
+{
+    int row = render_list_add_entry(patch->added_rows, entry);
+    if (row < 0)
+        return -1;
+    return patch->first_added_row + row;
+}
+
+static void disable_row(struct PlayspecPatch *patch, int row)
+{
+    if (row < 0)
+        return;
+
+    if (row >= patch->first_added_row) {
+        /* Added by this patch, not visible to the I/O thread yet */
+        patch->added_rows->enabled[row - patch->first_added_row] = false;
+        return;
+    }
+
+    patch->disabled_rows = grow_array(
+        patch->disabled_rows,
+        &patch->disabled_rows_capacity,
+        patch->num_disabled_rows,
+        sizeof(int));
+    patch->disabled_rows[patch->num_disabled_rows++] = row;
+}
+
+static void change_row_gains(
+    struct PlayspecPatch *patch, int row, float gain_l, float gain_r)
+{
+    if (row >= patch->first_added_row) {
+        struct RenderList *rows = patch->added_rows;
+        int i = row - patch->first_added_row;
+        render_list_compute_gains(
+            rows, i, gain_l, gain_r,
+            &rows->gain_l[i], &rows->gain_r[i], &rows->kernel[i]);
+        return;
+    }
+
+    patch->gain_changes = grow_array(
+        patch->gain_changes,
+        &patch->gain_changes_capacity,
+        patch->num_gain_changes,
+        sizeof(struct RowGainChange));
+
+    struct RowGainChange *change =
+        &patch->gain_changes[patch->num_gain_changes++];
+    change->row = row;
+    render_list_compute_gains(
+        patch->playspec->render_list, row, gain_l, gain_r,
+        &change->gain_l, &change->gain_r, &change->kernel);
+}
+
+static void replace_entry(
+    struct PlayspecPatch *patch, int index, struct PlayspecEntry *entry)
+{
+    struct Playspec *playspec = patch->playspec;
+    struct PlayspecEntry *old_entry = &playspec->entries[index];
+    int old_row = playspec->entry_rows[index];
+
+    record_patched_entry(patch, index, false);
+
+    if (old_row >= 0 && same_region(old_entry, entry)) {
+        change_row_gains(patch, old_row, entry->gain_l, entry->gain_r);
+    } else {
+        disable_row(patch, old_row);
+        playspec->entry_rows[index] = add_row(patch, entry);
+    }
+
+    *old_entry = *entry;
+}
+
+/* Read a single packed entry passed from Python */
+static bool unpack_single_entry(
+    char *bytes, int n, struct PlayspecEntry *entry)
+{
+    if (n != sizeof(struct PackedPlayspecEntry))
+        return false;
+
+    return unpack_playspec_entry(
+        (const struct PackedPlayspecEntry *)bytes, entry);
+}
+
+int add_entry_in_playspec_patch(char *bytes, int n)
+{
+    /* Runs on the Python thread */
+
+    if (!patch_being_built)
+        return -1;
+
+    struct PlayspecEntry entry;
+    if (!unpack_single_entry(bytes, n, &entry))
+        return -1;
+
+    struct Playspec *playspec = patch_being_built->playspec;
+    if (playspec->num_entries == playspec->entries_capacity) {
+        int capacity = playspec->entries_capacity
+            ? 2 * playspec->entries_capacity : 16;
+        playspec->entries = realloc(
+            playspec->entries, capacity * sizeof(struct PlayspecEntry));
+        playspec->entry_rows = realloc(
+            playspec->entry_rows, capacity * sizeof(int));
+        playspec->entries_capacity = capacity;
+    }
+
+    int index = playspec->num_entries++;
+    record_patched_entry(patch_being_built, index, true);
+    playspec->entries[index] = entry;
+    playspec->entry_rows[index] = add_row(patch_being_built, &entry);
+
+    return index;
+}
+
+bool replace_entry_in_playspec_patch(int index, char *bytes, int n)
+{
+    /* Runs on the Python thread */
+
+    if (!patch_being_built)
+        return false;
+
+    if (index < 0 || index >= patch_being_built->playspec->num_entries)
+        return false;
+
+    struct PlayspecEntry entry;
+    if (!unpack_single_entry(bytes, n, &entry))
+        return false;
+
+    replace_entry(patch_being_built, index, &entry);
+    return true;
+}
+
+bool set_entry_gain_in_playspec_patch(int index, float gain_l, float gain_r)
+{
+    /* Runs on the Python thread */
+
+    if (!patch_being_built)
+        return false;
+
+    if (index < 0 || index >= patch_being_built->playspec->num_entries)
+        return false;
+
+    struct PlayspecEntry entry = patch_being_built->playspec->entries[index];
+    entry.gain_l = gain_l;
+    entry.gain_r = gain_r;
+    replace_entry(patch_being_built, index, &entry);
+    return true;
+}
+
+bool remove_entry_in_playspec_patch(int index)
+{
+    /* Runs on the Python thread */
+
+    if (!patch_being_built)
+        return false;
+
+    if (index < 0 || index >= patch_being_built->playspec->num_entries)
+        return false;
+
+    struct PlayspecEntry entry = patch_being_built->playspec->entries[index];
+    entry.audio_clip_id = -1;
+    replace_entry(patch_being_built, index, &entry);
+    return true;
+}
+
+struct PlayspecPatch * get_built_playspec_patch()
+{
+    struct PlayspecPatch *result = patch_being_built;
+    patch_being_built = NULL;
+    return result;
+}
+
+bool playspec_patch_fits(struct PlayspecPatch *patch)
+{
+    /* Runs on the Python thread */
+
+    struct RenderList *list = patch->playspec->render_list;
+    return patch->first_added_row + patch->added_rows->num_rows
+        <= list->capacity;
+}
+
+void undo_playspec_patch(struct PlayspecPatch *patch)
+{
+    /* Runs on the Python thread */
+
+    struct Playspec *playspec = patch->playspec;
+
+    for (int i = patch->num_patched_entries - 1; i >= 0; --i) {
+        struct PatchedEntry *patched = &patch->patched_entries[i];
+        if (patched->added) {
+            assert(patched->index == playspec->num_entries - 1);
+            --playspec->num_entries;
+        } else {
+            playspec->entries[patched->index] = patched->entry;
+            playspec->entry_rows[patched->index] = patched->row;
+        }
+    }
+
+    patch->num_patched_entries = 0;
+}
+
+void apply_playspec_patch(struct PlayspecPatch *patch)
+{
+    /* Runs on the I/O thread */
+
+    struct RenderList *list = patch->playspec->render_list;
+
+    assert(list->num_rows == patch->first_added_row);
+    render_list_append_rows(list, patch->added_rows);
+
+    for (int i = 0; i < patch->num_disabled_rows; ++i)
+        list->enabled[patch->disabled_rows[i]] = false;
+
+    for (int i = 0; i < patch->num_gain_changes; ++i) {
+        struct RowGainChange *change = &patch->gain_changes[i];
+        list->gain_l[change->row] = change->gain_l;
+        list->gain_r[change->row] = change->gain_r;
+        list->kernel[change->row] = change->kernel;
+    }
+
+    patch->playspec->id = patch->id;
+}
+
+void destroy_playspec_patch(struct PlayspecPatch *patch)
+{
+    /* Runs on the Python thread */
+
+    destroy_render_list(patch->added_rows);
+    free(patch->patched_entries);
+    free(patch->disabled_rows);
+    free(patch->gain_changes);
+    free(patch);
+}
@@ -0,0 +1,110 @@
+#ifndef PLAYSPEC_PATCH_H
+#define PLAYSPEC_PATCH_H
+
+#include <stdbool.h>
+
+#include "mixer.h"
+#include "playspec.h"
+
+struct Interface;
+struct RenderList;
+
+/*
+ * A playspec patch inserts, removes or updates individual entries
+ * of the current playspec, without rebuilding and resending all of it.
+ *
+ * Entries are addressed by their index in the playspec. Added entries get
+ * the following indices, and removed entries keep their index (they just
+ * stop referencing a clip), so the indices stay stable until a new playspec
+ * is set.
+ *
+ * The entries of the current playspec are modified on the Python thread
+ * as soon as the patch is defined, while the render list edits are applied
+ * by the I/O thread when it reaches apply_at. Until then, the entries
+ * replaced by the patch are kept in the patch, so that their clips
+ * aren't garbage collected, and so that the patch can be undone.
+ */
+
+/* Entry of the playspec as it was before the patch modified it */
+struct PatchedEntry
+{
+    int index;
+    bool added;
+    struct PlayspecEntry entry;
+    int row;
+};
+
+/* New gains of an existing row of the render list */
+struct RowGainChange
+{
+    int row;
+    float gain_l;
+    float gain_r;
+    const struct MixKernelPair *kernel;
+};
+
+struct PlayspecPatch
+{
+    /* Playspec being patched, and the id it will have once patched */
+    struct Playspec *playspec;
+    int id;
+
+    /* Time in frames, counted from the beginning of the playspec */
+    int apply_at;
+
+    /* Undo log, in the order the entries were modified */
+    int num_patched_entries;
+    int patched_entries_capacity;
+    struct PatchedEntry *patched_entries;
+
+    /*
+     * Render list edits. Rows are compiled into added_rows, and appended
+     * after the first_added_row rows of the current render list.
+     */
+    int first_added_row;
+    struct RenderList *added_rows;
+
+    int num_disabled_rows;
+    int disabled_rows_capacity;
+    int *disabled_rows;
+
+    int num_gain_changes;
+    int gain_changes_capacity;
+    struct RowGainChange *gain_changes;
+};
+
+/* API for Python code */
+
+bool begin_defining_playspec_patch(int interface_id, int apply_at);
+void cancel_defining_playspec_patch();
+
+/*
+ * The entry is passed as a buffer holding a single
+ * struct PackedPlayspecEntry. Returns the index of the new entry, or -1
+ * if the entry is invalid.
+ */
+int add_entry_in_playspec_patch(char *bytes, int n);
+
+bool replace_entry_in_playspec_patch(int index, char *bytes, int n);
+bool set_entry_gain_in_playspec_patch(int index, float gain_l, float gain_r);
+bool remove_entry_in_playspec_patch(int index);
+
+/* API for C code */
+
+struct PlayspecPatch * get_built_playspec_patch();
+
+/*
+ * Whether the render list of the patched playspec has room for the rows
+ * added by the patch
+ */
+bool playspec_patch_fits(struct PlayspecPatch *patch);
+
+/* Restore the entries of the playspec to the state before the patch */
+void undo_playspec_patch(struct PlayspecPatch *patch);
+
+/* Runs on the I/O thread */
+void apply_playspec_patch(struct PlayspecPatch *patch);
+
+void destroy_playspec_patch(struct PlayspecPatch *patch);
+
+#endif
@@ -9,8 +9,8 @@ void pool_create(struct Pool *pool, int num_slots)
     for (int i = 0; i < num_slots; ++i) {
         pool->slots[i].id = -1;
         pool->slots[i].allocated = false;
-        pool->slots[i].prev_free_slot = -1;
-        pool->slots[i].next_free_slot = -1;
+        pool->slots[i].prev_free_slot = i - 1;
+        pool->slots[i].next_free_slot = i + 1 < num_slots ? i + 1 : -1;
         pool->slots[i].object = NULL;
     }
     pool->num_slots = num_slots;
@@ -55,6 +55,9 @@ int pool_put(struct Pool *pool, void *object)
 
 void * pool_find(struct Pool *pool, int id)
 {
+    if (id < 0)
+        return NULL;
+
     struct Slot *slot = &pool->slots[id % pool->num_slots];
     if (!slot->allocated)
         return NULL;
@@ -91,21 +94,13 @@ void pool_remove(struct Pool *pool, int id)
 
     slot->allocated = false;
 
-    if (pool->first_free_slot != -1) {
-        struct Slot *a = &pool->slots[pool->first_free_slot];
-
-        slot->prev_free_slot = pool->first_free_slot;
-        slot->next_free_slot = a->next_free_slot;
-
-        if (a->next_free_slot != -1)
-            pool->slots[a->next_free_slot].prev_free_slot = slot_index;
-        a->next_free_slot = slot_index;
-    } else {
-        slot->prev_free_slot = -1;
-        slot->next_free_slot = -1;
-    }
+    /* The slot becomes the first unallocated one */
+    slot->prev_free_slot = -1;
+    slot->next_free_slot = pool->first_free_slot;
+    if (pool->first_free_slot != -1)
+        pool->slots[pool->first_free_slot].prev_free_slot = slot_index;
 
-    pool->first_free_slot = id;
+    pool->first_free_slot = slot_index;
 }
 
 static void remove_object_if_allocated(struct Pool *pool, int slot)
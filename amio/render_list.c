@@ -0,0 +1,729 @@
+#include "render_list.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "audio_clip.h"
+#include "playspec.h"
+
+static void reserve_rows(struct RenderList *list, int capacity)
+{
+    /* Runs on the Python thread */
+
+    list->clip = realloc(
+        list->clip, capacity * sizeof(const struct AudioClip *));
+    list->clip_frame = realloc(list->clip_frame, capacity * sizeof(int64_t));
+    list->channels = realloc(list->channels, capacity * sizeof(int));
+    list->frame_size = realloc(list->frame_size, capacity * sizeof(int));
+    list->format = realloc(list->format, capacity * sizeof(int));
+    list->start = realloc(list->start, capacity * sizeof(int));
+    list->length = realloc(list->length, capacity * sizeof(int));
+    list->repeat_interval = realloc(
+        list->repeat_interval, capacity * sizeof(int));
+    list->folded = realloc(
+        list->folded, capacity * sizeof(struct FoldedBuffer *));
+    list->gain_l = realloc(list->gain_l, capacity * sizeof(float));
+    list->gain_r = realloc(list->gain_r, capacity * sizeof(float));
+    list->kernel = realloc(
+        list->kernel, capacity * sizeof(const struct MixKernelPair *));
+    list->enabled = realloc(list->enabled, capacity * sizeof(bool));
+    list->param_slot = realloc(list->param_slot, capacity * sizeof(int));
+    list->fades = realloc(list->fades, capacity * sizeof(struct RowFades));
+
+    list->periodic_rows = realloc(
+        list->periodic_rows, capacity * sizeof(int));
+    list->active_rows = realloc(list->active_rows, capacity * sizeof(int));
+
+    list->capacity = capacity;
+}
+
+/* Sample of clip data, scaled to the range [-1.0, 1.0] */
+static float load_sample(const void *data, int format, int index)
+{
+    if (format == SAMPLE_FORMAT_FLOAT32)
+        return ((const float *)data)[index];
+
+    if (format == SAMPLE_FORMAT_INT24) {
+        const uint8_t *p = (const uint8_t *)data + 3 * index;
+        int32_t sample = (int32_t)((uint32_t)p[0] << 8
+            | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+        return sample * sample_format_scale(format);
+    }
+
+    return ((const int16_t *)data)[index] * sample_format_scale(format);
+}
+
+/*
+ * Sum all repetitions of a periodic entry longer than its repeat interval
+ * into a buffer of float samples one interval long. Since an entry repeats
+ * indefinitely in both directions, at any frame the output is the sum
+ * of the samples at the same offset modulo the interval. Only the first
+ * two channels are kept. Every repetition is faded before being summed.
+ * The sums are scaled like SAMPLE_FORMAT_FLOAT32 samples, whatever
+ * the format of the clip.
+ */
+static float * fold_periodic_entry(
+    const struct AudioClip *clip,
+    int a_in_clip,
+    int length,
+    int interval,
+    int folded_channels,
+    const struct RowFades *fades)
+{
+    /* Runs on the Python thread */
+
+    float *folded = calloc(interval * folded_channels, sizeof(float));
+    bool faded = fades->in || fades->out;
+
+    for (int i = 0; i < length;) {
+        int contiguous_frames;
+        const char *data = audio_clip_frame_data(
+            clip, a_in_clip + i, &contiguous_frames);
+        int end = i + contiguous_frames < length
+            ? i + contiguous_frames : length;
+
+        for (int index = 0; i < end; ++i, index += clip->channels) {
+            float *frame = folded + (i % interval) * folded_channels;
+            float gain = faded ? render_list_fade_gain(fades, i) : 1.0f;
+            for (int c = 0; c < folded_channels; ++c) {
+                frame[c] +=
+                    load_sample(data, clip->format, index + c) * gain;
+            }
+        }
+    }
+
+    return folded;
+}
+
+#define FOLDED_BUFFER_BUCKETS 256
+
+/*
+ * Repetitions of a periodic entry folded into one interval. Clips never
+ * change their data, and their ids aren't reused, so the buffer is shared
+ * by every row that folds the same frames of the same clip with the same
+ * fades. This way recompiling a playspec, or patching it, doesn't fold
+ * its periodic entries again while the previous render list still holds
+ * their buffers.
+ */
+struct FoldedBuffer
+{
+    struct FoldedBuffer *next;
+    int refcount;
+
+    int clip_id;
+    int clip_frame;
+    int length;
+    int interval;
+    int channels;
+    struct RowFades fades;
+
+    float *samples;
+};
+
+/* Folded buffers held by render lists, hashed by what was folded */
+static struct FoldedBuffer *folded_buffers[FOLDED_BUFFER_BUCKETS];
+
+static struct FoldedBuffer ** folded_bucket(
+    int clip_id, int clip_frame, int interval)
+{
+    unsigned hash = (unsigned)clip_id * 2654435761u
+        ^ (unsigned)clip_frame * 40503u ^ (unsigned)interval;
+    return &folded_buffers[hash % FOLDED_BUFFER_BUCKETS];
+}
+
+static bool same_fades(const struct RowFades *a, const struct RowFades *b)
+{
+    return a->offset == b->offset && a->length == b->length
+        && a->in == b->in && a->out == b->out
+        && a->in_curve == b->in_curve && a->out_curve == b->out_curve
+        && a->segment_frames == b->segment_frames;
+}
+
+/* Find or make the folded buffer of a periodic entry */
+static struct FoldedBuffer * acquire_folded_buffer(
+    int clip_id,
+    struct AudioClip *clip,
+    int a_in_clip,
+    int length,
+    int interval,
+    int folded_channels,
+    const struct RowFades *fades)
+{
+    /* Runs on the Python thread */
+
+    struct FoldedBuffer **bucket = folded_bucket(clip_id, a_in_clip, interval);
+    struct FoldedBuffer *folded = *bucket;
+    for (; folded; folded = folded->next) {
+        if (folded->clip_id == clip_id && folded->clip_frame == a_in_clip
+                && folded->length == length && folded->interval == interval
+                && folded->channels == folded_channels
+                && same_fades(&folded->fades, fades)) {
+            ++folded->refcount;
+            return folded;
+        }
+    }
+
+    /* The data is folded right away, so it can't wait for the reader */
+    audio_clip_page_in(clip);
+
+    folded = malloc(sizeof(struct FoldedBuffer));
+    folded->refcount = 1;
+    folded->clip_id = clip_id;
+    folded->clip_frame = a_in_clip;
+    folded->length = length;
+    folded->interval = interval;
+    folded->channels = folded_channels;
+    folded->fades = *fades;
+    folded->samples = fold_periodic_entry(
+        clip, a_in_clip, length, interval, folded_channels, fades);
+    folded->next = *bucket;
+    *bucket = folded;
+    return folded;
+}
+
+static void release_folded_buffer(struct FoldedBuffer *folded)
+{
+    /* Runs on the Python thread */
+
+    if (!folded || --folded->refcount > 0)
+        return;
+
+    struct FoldedBuffer **link = folded_bucket(
+        folded->clip_id, folded->clip_frame, folded->interval);
+    while (*link != folded)
+        link = &(*link)->next;
+    *link = folded->next;
+
+    free(folded->samples);
+    free(folded);
+}
+
+static int fade_segment_frames(const struct RowFades *fades)
+{
+    int segment_frames = ENVELOPE_SEGMENT_FRAMES;
+    if (fades->in && fades->in_curve != FADE_CURVE_LINEAR
+            && fades->in / FADE_CURVE_SEGMENTS < segment_frames)
+        segment_frames = fades->in / FADE_CURVE_SEGMENTS;
+    if (fades->out && fades->out_curve != FADE_CURVE_LINEAR
+            && fades->out / FADE_CURVE_SEGMENTS < segment_frames)
+        segment_frames = fades->out / FADE_CURVE_SEGMENTS;
+    return segment_frames > 0 ? segment_frames : 1;
+}
+
+struct RowStart
+{
+    int start;
+    int row;
+};
+
+static int compare_row_starts(const void *a, const void *b)
+{
+    const struct RowStart *x = a;
+    const struct RowStart *y = b;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->row - y->row;
+}
+
+static void allocate_max_end_tree(struct TimeIndex *index, int max_rows)
+{
+    /* Runs on the Python thread */
+
+    index->num_leaves = 1;
+    while (index->num_leaves < max_rows)
+        index->num_leaves *= 2;
+    index->max_end = malloc(2 * index->num_leaves * sizeof(int));
+}
+
+static void build_max_end_tree(
+    const struct RenderList *list, struct TimeIndex *index)
+{
+    int *max_end = index->max_end;
+    for (int i = 0; i < index->num_leaves; ++i) {
+        int row = i < index->num_rows ? index->rows[i] : -1;
+        max_end[index->num_leaves + i] =
+            row >= 0 ? list->start[row] + list->length[row] : INT_MIN;
+    }
+    for (int node = index->num_leaves - 1; node > 0; --node) {
+        int left = max_end[2 * node];
+        int right = max_end[2 * node + 1];
+        max_end[node] = left > right ? left : right;
+    }
+}
+
+static void build_time_index(struct RenderList *list)
+{
+    /* Runs on the Python thread */
+
+    struct RowStart *starts = malloc(list->num_rows * sizeof(struct RowStart));
+    int num_starts = 0;
+
+    list->num_periodic_rows = 0;
+    for (int row = 0; row < list->num_rows; ++row) {
+        if (list->repeat_interval[row]) {
+            list->periodic_rows[list->num_periodic_rows++] = row;
+        } else {
+            starts[num_starts].start = list->start[row];
+            starts[num_starts].row = row;
+            ++num_starts;
+        }
+    }
+
+    qsort(starts, num_starts, sizeof(struct RowStart), compare_row_starts);
+
+    struct TimeIndex *index = &list->index;
+    index->num_rows = num_starts;
+    index->rows = malloc((num_starts > 0 ? num_starts : 1) * sizeof(int));
+    for (int i = 0; i < num_starts; ++i)
+        index->rows[i] = starts[i].row;
+
+    allocate_max_end_tree(index, num_starts);
+    build_max_end_tree(list, index);
+    index->next = 0;
+
+    free(starts);
+
+    /* Rows added by patches fill up the rest of the capacity */
+    struct TimeIndex *patch_index = &list->patch_index;
+    int spare_rows = list->capacity - list->num_rows;
+    patch_index->num_rows = 0;
+    patch_index->rows = malloc(
+        (spare_rows > 0 ? spare_rows : 1) * sizeof(int));
+    allocate_max_end_tree(patch_index, spare_rows);
+    build_max_end_tree(list, patch_index);
+    patch_index->next = 0;
+
+    list->cursor_frame = INT_MIN;
+    list->num_active_rows = 0;
+}
+
+struct RenderList * create_render_list(int capacity)
+{
+    /* Runs on the Python thread */
+
+    struct RenderList *list = calloc(1, sizeof(struct RenderList));
+    reserve_rows(list, capacity > 0 ? capacity : 1);
+    list->cursor_frame = INT_MIN;
+    return list;
+}
+
+bool render_list_entry_region(
+    const struct PlayspecEntry *entry,
+    const struct AudioClip *clip,
+    struct ClipRegion *region)
+{
+    /* Runs on the Python thread */
+
+    /* Clamp the region to the clip bounds */
+    int a_in_clip = entry->clip_frame_a;
+    int b_in_clip = entry->clip_frame_b;
+    int start = entry->play_at_frame;
+    if (a_in_clip < 0) {
+        start += -a_in_clip;
+        a_in_clip = 0;
+    }
+    if (b_in_clip > clip->length)
+        b_in_clip = clip->length;
+    if (a_in_clip >= b_in_clip)
+        return false;
+
+    int interval = entry->repeat_interval;
+    if (interval < 0)
+        return false;
+    if (interval > 0) {
+        /* Normalize to the repetition starting in [0, interval) */
+        start -= entry->play_at_frame;
+        int play_at_frame = entry->play_at_frame % interval;
+        if (play_at_frame < 0)
+            play_at_frame += interval;
+        start += play_at_frame;
+    }
+
+    region->clip_frame = a_in_clip;
+    region->length = b_in_clip - a_in_clip;
+    region->start = start;
+    region->repeat_interval = interval;
+    return true;
+}
+
+int render_list_add_entry(
+    struct RenderList *list, const struct PlayspecEntry *entry)
+{
+    /* Runs on the Python thread */
+
+    struct AudioClip *clip = get_audio_clip_by_id(entry->audio_clip_id);
+    if (!clip)
+        return -1;
+
+    struct ClipRegion region;
+    if (!render_list_entry_region(entry, clip, &region))
+        return -1;
+
+    if (list->num_rows == list->capacity)
+        reserve_rows(list, 2 * list->capacity);
+
+    int row = list->num_rows++;
+    int a_in_clip = region.clip_frame;
+    int length = region.length;
+    int interval = region.repeat_interval;
+    list->start[row] = region.start;
+    list->repeat_interval[row] = interval;
+    list->enabled[row] = true;
+    list->param_slot[row] = entry->param_slot;
+
+    struct RowFades *fades = &list->fades[row];
+    fades->offset = a_in_clip - entry->clip_frame_a;
+    /* The fade-out ends with the last frame of the clip, not of the entry */
+    fades->length = fades->offset + length;
+    fades->in = entry->fade_in;
+    fades->out = entry->fade_out;
+    fades->in_curve = entry->fade_in_curve;
+    fades->out_curve = entry->fade_out_curve;
+    fades->segment_frames = fade_segment_frames(fades);
+
+    /*
+     * Streaming clips aren't folded, since their data isn't in memory.
+     * Their repetitions are mixed one by one instead.
+     */
+    if (interval > 0 && length > interval && !clip->stream) {
+        int folded_channels = clip->channels == 1 ? 1 : 2;
+        list->folded[row] = acquire_folded_buffer(
+            entry->audio_clip_id, clip, a_in_clip, length, interval,
+            folded_channels, fades);
+        list->clip[row] = NULL;
+        list->clip_frame[row] = 0;
+        list->channels[row] = folded_channels;
+        list->format[row] = SAMPLE_FORMAT_FLOAT32;
+        list->frame_size[row] = folded_channels * sizeof(float);
+        list->length[row] = interval;
+        fades->in = 0;
+        fades->out = 0;
+    } else {
+        /*
+         * Spilled data is read back by the stream reader thread, so as not
+         * to block the Python thread. The I/O thread plays silence until then.
+         */
+        audio_clip_request_page_in(clip);
+        list->clip[row] = clip;
+        list->clip_frame[row] = a_in_clip;
+        list->channels[row] = clip->channels;
+        list->format[row] = clip->format;
+        list->frame_size[row] = audio_clip_frame_size(clip);
+        list->length[row] = length;
+        list->folded[row] = NULL;
+    }
+
+    render_list_compute_gains(
+        list, row, entry->gain_l, entry->gain_r,
+        &list->gain_l[row], &list->gain_r[row], &list->kernel[row]);
+
+    return row;
+}
+
+void render_list_compute_gains(
+    const struct RenderList *list,
+    int row,
+    float gain_l,
+    float gain_r,
+    float *scaled_gain_l,
+    float *scaled_gain_r,
+    const struct MixKernelPair **kernel)
+{
+    /* Runs on the Python thread */
+
+    /*
+     * Integer clip data is e.g. -32768 to +32767, while port data is -1 to +1
+     */
+    int format = list->format[row];
+    *scaled_gain_l = gain_l * sample_format_scale(format);
+    *scaled_gain_r = gain_r * sample_format_scale(format);
+
+    /* The gains of a parameter slot may be different for each channel */
+    bool equal_gains = gain_l == gain_r && list->param_slot[row] < 0;
+
+    *kernel = mixer_select_kernel(format, list->channels[row], equal_gains);
+}
+
+struct RenderList * compile_render_list(struct Playspec *playspec)
+{
+    /* Runs on the Python thread */
+
+    struct RenderList *list = create_render_list(
+        playspec->num_entries + RENDER_LIST_SPARE_ROWS);
+
+    for (int i = 0; i < playspec->num_entries; ++i) {
+        playspec->entry_rows[i] = render_list_add_entry(
+            list, &playspec->entries[i]);
+    }
+
+    build_time_index(list);
+
+    return list;
+}
+
+void render_list_append_rows(struct RenderList *list, struct RenderList *rows)
+{
+    /* Runs on the I/O thread */
+
+    assert(list->num_rows + rows->num_rows <= list->capacity);
+
+    struct TimeIndex *patch_index = &list->patch_index;
+    bool indexed_any = false;
+
+    for (int i = 0; i < rows->num_rows; ++i) {
+        int row = list->num_rows++;
+        list->clip[row] = rows->clip[i];
+        list->clip_frame[row] = rows->clip_frame[i];
+        list->channels[row] = rows->channels[i];
+        list->frame_size[row] = rows->frame_size[i];
+        list->format[row] = rows->format[i];
+        list->start[row] = rows->start[i];
+        list->length[row] = rows->length[i];
+        list->repeat_interval[row] = rows->repeat_interval[i];
+        list->gain_l[row] = rows->gain_l[i];
+        list->gain_r[row] = rows->gain_r[i];
+        list->kernel[row] = rows->kernel[i];
+        list->enabled[row] = rows->enabled[i];
+        list->param_slot[row] = rows->param_slot[i];
+        list->fades[row] = rows->fades[i];
+
+        /* The folded buffer is now owned by this render list */
+        list->folded[row] = rows->folded[i];
+        rows->folded[i] = NULL;
+
+        if (list->repeat_interval[row]) {
+            list->periodic_rows[list->num_periodic_rows++] = row;
+            continue;
+        }
+
+        /* Insert the row keeping the patch rows sorted by start */
+        int position = patch_index->num_rows++;
+        while (position > 0 && list->start[
+                patch_index->rows[position - 1]] > list->start[row]) {
+            patch_index->rows[position] = patch_index->rows[position - 1];
+            --position;
+        }
+        patch_index->rows[position] = row;
+        indexed_any = true;
+    }
+
+    if (indexed_any) {
+        build_max_end_tree(list, patch_index);
+
+        /* The active rows are found anew, including the added ones */
+        list->cursor_frame = INT_MIN;
+    }
+}
+
+void destroy_render_list(struct RenderList *list)
+{
+    /* Runs on the Python thread */
+
+    if (!list)
+        return;
+
+    for (int row = 0; row < list->num_rows; ++row)
+        release_folded_buffer(list->folded[row]);
+
+    free(list->clip);
+    free(list->clip_frame);
+    free(list->channels);
+    free(list->frame_size);
+    free(list->format);
+    free(list->start);
+    free(list->length);
+    free(list->repeat_interval);
+    free(list->folded);
+    free(list->gain_l);
+    free(list->gain_r);
+    free(list->kernel);
+    free(list->enabled);
+    free(list->param_slot);
+    free(list->fades);
+    free(list->periodic_rows);
+    free(list->index.rows);
+    free(list->index.max_end);
+    free(list->patch_index.rows);
+    free(list->patch_index.max_end);
+    free(list->active_rows);
+    free(list);
+}
+
+/* Gain of a fade curve at x, going from 0.0 at x = 0 to 1.0 at x = 1 */
+static float fade_curve(int curve, float x)
+{
+    if (curve == FADE_CURVE_EQUAL_POWER)
+        return sinf(x * (float)M_PI_2);
+    if (curve == FADE_CURVE_SMOOTH)
+        return 0.5f - 0.5f * cosf(x * (float)M_PI);
+    return x;
+}
+
+const char * render_list_row_data(
+    const struct RenderList *list,
+    int row,
+    int frame,
+    int *contiguous_frames)
+{
+    /* Runs on the I/O thread */
+
+    const struct AudioClip *clip = list->clip[row];
+    if (!clip) {
+        *contiguous_frames = list->length[row] - frame;
+        return (const char *)list->folded[row]->samples
+            + frame * list->frame_size[row];
+    }
+
+    return audio_clip_frame_data(
+        clip, list->clip_frame[row] + frame, contiguous_frames);
+}
+
+int render_list_row_silence_run(
+    const struct RenderList *list,
+    int row,
+    int frame,
+    int max_frames,
+    bool *silent)
+{
+    /* Runs on the I/O thread */
+
+    const struct AudioClip *clip = list->clip[row];
+    if (!clip) {
+        *silent = false;
+        return max_frames;
+    }
+
+    return audio_clip_silence_run(
+        clip, list->clip_frame[row] + frame, max_frames, silent);
+}
+
+float render_list_fade_gain(const struct RowFades *fades, int frame)
+{
+    /*
+     * The first frame of a fade-in and the last frame of a fade-out
+     * are silent
+     */
+    int position = fades->offset + frame;
+    int remaining = fades->length - 1 - position;
+    float gain = 1.0f;
+
+    if (position < fades->in)
+        gain *= fade_curve(fades->in_curve, (float)position / fades->in);
+    if (remaining < fades->out) {
+        gain *= remaining > 0
+            ? fade_curve(fades->out_curve, (float)remaining / fades->out)
+            : 0.0f;
+    }
+
+    return gain;
+}
+
+static int row_end(struct RenderList *list, int row)
+{
+    return list->start[row] + list->length[row];
+}
+
+/* First position in the time index whose row starts at or after frame */
+static int find_first_starting_at(
+    const struct RenderList *list, const struct TimeIndex *index, int frame)
+{
+    int a = 0;
+    int b = index->num_rows;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (list->start[index->rows[mid]] < frame)
+            a = mid + 1;
+        else
+            b = mid;
+    }
+    return a;
+}
+
+/* Node of the max-end tree, and the positions of the rows under it */
+struct TimeIndexNode
+{
+    int node;
+    int first;
+    int count;
+};
+
+/*
+ * Activate the rows of the index that started before the frame and end
+ * after it, and move the cursor of the index to the frame
+ */
+static void seek_index(
+    struct RenderList *list, struct TimeIndex *index, int frame)
+{
+    index->next = find_first_starting_at(list, index, frame);
+
+    /* The depth of the tree is at most 31, and so is the size of the stack */
+    struct TimeIndexNode stack[32];
+    int depth = 0;
+    stack[depth++] = (struct TimeIndexNode){1, 0, index->num_leaves};
+
+    while (depth > 0) {
+        struct TimeIndexNode n = stack[--depth];
+        if (n.first >= index->next || index->max_end[n.node] <= frame)
+            continue;
+        if (n.count == 1) {
+            list->active_rows[list->num_active_rows++] =
+                index->rows[n.first];
+            continue;
+        }
+        int half = n.count / 2;
+        stack[depth++] =
+            (struct TimeIndexNode){2 * n.node + 1, n.first + half, half};
+        stack[depth++] = (struct TimeIndexNode){2 * n.node, n.first, half};
+    }
+}
+
+static void seek(struct RenderList *list, int frame)
+{
+    list->num_active_rows = 0;
+    seek_index(list, &list->index, frame);
+    seek_index(list, &list->patch_index, frame);
+}
+
+static void retire_rows_ending_by(struct RenderList *list, int frame)
+{
+    int i = 0;
+    while (i < list->num_active_rows) {
+        if (row_end(list, list->active_rows[i]) <= frame) {
+            list->active_rows[i] =
+                list->active_rows[--list->num_active_rows];
+        } else {
+            ++i;
+        }
+    }
+}
+
+static void activate_rows_starting_before(
+    struct RenderList *list, struct TimeIndex *index, int frame)
+{
+    while (index->next < index->num_rows) {
+        int row = index->rows[index->next];
+        if (list->start[row] >= frame)
+            break;
+        list->active_rows[list->num_active_rows++] = row;
+        ++index->next;
+    }
+}
+
+void render_list_update_active_rows(
+    struct RenderList *list, int frame, int frames)
+{
+    /* Runs on the I/O thread */
+
+    if (frame == list->cursor_frame)
+        retire_rows_ending_by(list, frame);
+    else
+        seek(list, frame);
+
+    int end_frame = frame + frames;
+    activate_rows_starting_before(list, &list->index, end_frame);
+    activate_rows_starting_before(list, &list->patch_index, end_frame);
+
+    list->cursor_frame = end_frame;
+}
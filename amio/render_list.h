@@ -0,0 +1,286 @@
+#ifndef RENDER_LIST_H
+#define RENDER_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mixer.h"
+
+struct AudioClip;
+struct FoldedBuffer;
+struct Playspec;
+struct PlayspecEntry;
+
+/*
+ * Number of rows that a compiled render list can grow by when playspec
+ * patches add entries to it. A patch that doesn't fit is turned into
+ * a full playspec rebuild.
+ */
+#define RENDER_LIST_SPARE_ROWS 256
+
+/*
+ * Gains that don't change linearly (fade curves, or fades combined
+ * with a ramping parameter slot) are approximated by linear ramps
+ * at most this many frames long. Curved fades are also split into at least
+ * FADE_CURVE_SEGMENTS ramps, so that short ones keep their shape.
+ */
+#define ENVELOPE_SEGMENT_FRAMES 32
+#define FADE_CURVE_SEGMENTS 16
+
+/*
+ * Fades of a row. Positions are counted in frames from the beginning
+ * of the clip region of the entry, which may be before the first audible
+ * frame of the row if the region was clamped to the clip bounds.
+ */
+struct RowFades
+{
+    /* Position of the first audible frame of the row */
+    int offset;
+
+    /*
+     * Position just past the last audible frame of the row, where
+     * the fade-out ends
+     */
+    int length;
+
+    /* Lengths of the fades (0 for none) and FADE_CURVE_* shapes */
+    int in;
+    int out;
+    int in_curve;
+    int out_curve;
+
+    /* Maximum length of a linear ramp approximating the fades */
+    int segment_frames;
+};
+
+/*
+ * Time index of non-repeating rows: the rows sorted by start, and a tree
+ * of the maximum end of the rows under every node. The tree is a perfect
+ * binary tree stored in an array: node 1 is the root, the children of
+ * node i are 2i and 2i + 1, and leaf num_leaves + j holds the end of the row
+ * at position j (INT_MIN past the last row). A search for the rows that play
+ * at a frame skips every subtree whose rows all end by then, so finding
+ * the k rows that started before the frame and are still playing takes
+ * O((k + 1) log n) steps for n rows, however long any of them are.
+ */
+struct TimeIndex
+{
+    int num_rows;
+    int *rows;
+
+    int num_leaves;  /* a power of two, at least num_rows */
+    int *max_end;    /* 2 * num_leaves nodes, the first one unused */
+
+    /* Only accessed by the I/O thread: first position not yet activated */
+    int next;
+};
+
+/*
+ * A render list is a playspec compiled on the Python thread into a form
+ * that the I/O thread can mix without any lookups. Clip ids are resolved
+ * to clip pointers, the clip region is clamped to the clip bounds, gains
+ * are prescaled to the sample format, and a mixing kernel is picked for
+ * every row. Entries that can't produce any sound are left out.
+ *
+ * Rows are stored as a structure of arrays, so that the mixing loop streams
+ * over contiguous memory.
+ *
+ * The clip pointers stay valid as long as the playspec is current
+ * or pending, because the garbage collector won't destroy clips referenced
+ * by the entries of such playspecs.
+ */
+struct RenderList
+{
+    int num_rows;
+    int capacity;
+
+    /*
+     * Clip whose blocks the row reads, and the frame of the clip that is
+     * the first audible frame of the row. Folded periodic rows read their
+     * folded buffer instead, and have no clip.
+     */
+    const struct AudioClip **clip;
+    int64_t *clip_frame;
+    int *channels;
+    int *frame_size;  /* in bytes */
+    int *format;      /* SAMPLE_FORMAT_* */
+
+    /*
+     * Position of the first audible frame in the playspec. For periodic
+     * rows, the position of the first audible frame of the repetition
+     * that starts in [0, repeat_interval).
+     */
+    int *start;
+
+    /* Number of audible frames */
+    int *length;
+
+    /*
+     * If non-zero, the row repeats with this period. When an entry is
+     * longer than its interval, its repetitions are summed at compile time
+     * into a buffer one interval long (see fold_periodic_entry), and the row
+     * plays that buffer in a seamless loop. This way the cost of mixing
+     * a periodic row doesn't depend on the clip length. Entries of streaming
+     * clips are the exception: their overlapping repetitions are mixed
+     * separately.
+     */
+    int *repeat_interval;
+
+    /*
+     * Folded buffers of periodic rows, NULL for other rows. Rows that fold
+     * the same repetitions of a clip share a buffer, even across render lists.
+     */
+    struct FoldedBuffer **folded;
+
+    /* Gains, already scaled to the sample format */
+    float *gain_l;
+    float *gain_r;
+
+    const struct MixKernelPair **kernel;
+
+    /* Slot of the parameter table whose gains apply to the row, or -1 */
+    int *param_slot;
+
+    /*
+     * Fades of the row. Folded periodic rows have their fades applied
+     * when folding, so they have none here.
+     */
+    struct RowFades *fades;
+
+    /* Rows disabled by a playspec patch are skipped when mixing */
+    bool *enabled;
+
+    /* Rows with a non-zero repeat interval */
+    int num_periodic_rows;
+    int *periodic_rows;
+
+    /* Time index of the non-repeating rows */
+    struct TimeIndex index;
+
+    /*
+     * Time index of the non-repeating rows added by playspec patches.
+     * It has room for all the rows that can be added, and is rebuilt
+     * by the I/O thread when rows are added, which is cheap because
+     * there are few of them.
+     */
+    struct TimeIndex patch_index;
+
+    /*
+     * Cursor over the time index, only accessed by the I/O thread.
+     * When playback continues where the previous window ended,
+     * the active set is updated incrementally. Otherwise (the position
+     * was changed, or the playspec has just been applied) the cursor
+     * seeks to the new position.
+     */
+    int cursor_frame;
+    int num_active_rows;
+    int *active_rows;
+};
+
+/* Part of a clip played by an entry, clamped to the clip bounds */
+struct ClipRegion
+{
+    /* First audible frame in the clip, and the number of audible frames */
+    int clip_frame;
+    int length;
+
+    /*
+     * Position of the first audible frame in the playspec. For periodic
+     * entries, of the repetition that starts in [0, repeat_interval).
+     */
+    int start;
+    int repeat_interval;
+};
+
+/*
+ * Compute the region of the clip that an entry plays. Returns false
+ * if the entry can't produce any sound.
+ */
+bool render_list_entry_region(
+    const struct PlayspecEntry *entry,
+    const struct AudioClip *clip,
+    struct ClipRegion *region);
+
+/*
+ * Compile all entries of the playspec. The render list has room
+ * for RENDER_LIST_SPARE_ROWS more rows. The row of every entry is stored
+ * in playspec->entry_rows.
+ */
+struct RenderList * compile_render_list(struct Playspec *playspec);
+void destroy_render_list(struct RenderList *render_list);
+
+/*
+ * Create an empty render list without a time index, used to compile
+ * the rows added by a playspec patch. Runs on the Python thread.
+ */
+struct RenderList * create_render_list(int capacity);
+
+/*
+ * Compile a single entry into a new row, growing the render list if needed.
+ * Returns the row, or -1 if the entry can't produce any sound.
+ * Must not be used on a render list that the I/O thread can access.
+ */
+int render_list_add_entry(
+    struct RenderList *render_list, const struct PlayspecEntry *entry);
+
+/*
+ * Return the gains and the kernel that a row would mix with if its entry
+ * had the given gains. Runs on the Python thread.
+ */
+void render_list_compute_gains(
+    const struct RenderList *render_list,
+    int row,
+    float gain_l,
+    float gain_r,
+    float *scaled_gain_l,
+    float *scaled_gain_r,
+    const struct MixKernelPair **kernel);
+
+/*
+ * Move the rows of another render list to the end of this one, adding them
+ * to the time index of patch rows. The capacity must be sufficient.
+ * Runs on the I/O thread.
+ */
+void render_list_append_rows(
+    struct RenderList *render_list, struct RenderList *rows);
+
+/*
+ * Sample data of the given frame of a row, counted from the first audible
+ * frame, and the number of frames from there that are stored contiguously.
+ * Returns NULL if the frame belongs to a block of a streaming clip that
+ * isn't loaded. Runs on the I/O thread.
+ */
+const char * render_list_row_data(
+    const struct RenderList *render_list,
+    int row,
+    int frame,
+    int *contiguous_frames);
+
+/*
+ * Length of the run of frames of a row starting at the given frame, up to
+ * max_frames, that are either all silent or all audible, and which of these
+ * it is. Folded rows are never considered silent. Runs on the I/O thread.
+ */
+int render_list_row_silence_run(
+    const struct RenderList *list,
+    int row,
+    int frame,
+    int max_frames,
+    bool *silent);
+
+/*
+ * Gain factor of the fades at the given frame of a row, counted from
+ * the first audible frame
+ */
+float render_list_fade_gain(const struct RowFades *fades, int frame);
+
+/*
+ * Update the set of active rows, so that it contains every non-repeating
+ * row that overlaps frames [frame, frame + frames). It may also contain
+ * rows that don't, but these will be removed in a following update.
+ * Runs on the I/O thread.
+ */
+void render_list_update_active_rows(
+    struct RenderList *render_list, int frame, int frames);
+
+#endif
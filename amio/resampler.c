@@ -0,0 +1,181 @@
+#include "resampler.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_clip.h"
+#include "mixer.h"
+
+/* Fraction of the Nyquist frequency of the lower rate passed by the filters */
+#define RESAMPLER_PASSBAND 0.95
+
+/* Shape of the Kaiser window; it attenuates the stopband by about 90 dB */
+#define RESAMPLER_KAISER_BETA 9.0
+
+static int64_t greatest_common_divisor(int64_t a, int64_t b)
+{
+    while (b) {
+        int64_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+/* Modified Bessel function of the first kind of order zero */
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; term > sum * 1e-12; ++k) {
+        double factor = x / (2.0 * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+static double kaiser_window(double x)
+{
+    double square = 1.0 - x * x;
+    if (square <= 0.0)
+        return 0.0;
+    return bessel_i0(RESAMPLER_KAISER_BETA * sqrt(square))
+        / bessel_i0(RESAMPLER_KAISER_BETA);
+}
+
+static double sinc(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+bool resampler_create(
+    struct Resampler *resampler, float from_rate, float to_rate)
+{
+    /* Runs on the Python thread */
+
+    if (from_rate < 1.0f || to_rate < 1.0f)
+        return false;
+    if (from_rate != floorf(from_rate) || to_rate != floorf(to_rate))
+        return false;
+
+    int64_t divisor = greatest_common_divisor(from_rate, to_rate);
+    resampler->up = to_rate / divisor;
+    resampler->down = from_rate / divisor;
+    if (resampler->up > RESAMPLER_MAX_PHASES)
+        return false;
+
+    /* When downsampling, the cutoff is relative to the input rate */
+    double cutoff = RESAMPLER_PASSBAND;
+    if (resampler->up < resampler->down)
+        cutoff *= (double)resampler->up / resampler->down;
+
+    int half = ceil(RESAMPLER_ZERO_CROSSINGS / cutoff);
+    resampler->delay = half - 1;
+    resampler->taps = (2 * half + 7) / 8 * 8;
+
+    size_t size = (size_t)resampler->up * resampler->taps * sizeof(float);
+    void *memory = NULL;
+    if (posix_memalign(&memory, 32, size))
+        return false;
+    resampler->filters = memory;
+    memset(resampler->filters, 0, size);
+
+    for (int phase = 0; phase < resampler->up; ++phase) {
+        float *filter = resampler->filters + (size_t)phase * resampler->taps;
+
+        /* Distance of every input frame from the output frame */
+        double sum = 0.0;
+        for (int k = 0; k < 2 * half; ++k) {
+            double distance = (double)phase / resampler->up + half - 1 - k;
+            double coefficient = cutoff * sinc(cutoff * distance)
+                * kaiser_window(distance / half);
+            filter[k] = coefficient;
+            sum += coefficient;
+        }
+
+        /* Every phase passes a constant signal unchanged */
+        for (int k = 0; k < 2 * half; ++k)
+            filter[k] /= sum;
+    }
+    return true;
+}
+
+void resampler_destroy(struct Resampler *resampler)
+{
+    free(resampler->filters);
+    resampler->filters = NULL;
+}
+
+int64_t resampler_output_length(
+    const struct Resampler *resampler, int64_t input_length)
+{
+    return (input_length * resampler->up + resampler->down - 1)
+        / resampler->down;
+}
+
+/* Read frames [start, start + frames) of a channel of the clip */
+static void load_input(
+    const struct AudioClip *clip,
+    int channel,
+    int64_t start,
+    int frames,
+    float *input)
+{
+    while (frames > 0 && start < 0) {
+        *input++ = 0.0f;
+        ++start;
+        --frames;
+    }
+
+    while (frames > 0 && start < clip->length) {
+        int n;
+        const char *data = audio_clip_frame_data(clip, start, &n);
+        if (n > frames)
+            n = frames;
+        mixer_load_channel(
+            clip->format, data, clip->channels, channel, input, n);
+        input += n;
+        start += n;
+        frames -= n;
+    }
+
+    memset(input, 0, frames * sizeof(float));
+}
+
+void resampler_process_clip(
+    const struct Resampler *resampler,
+    const struct AudioClip *clip,
+    int64_t first,
+    int frames,
+    float *output)
+{
+    if (frames <= 0)
+        return;
+
+    /* The input frames read by the filters of all the output frames */
+    int64_t last = first + frames - 1;
+    int64_t start =
+        first * resampler->down / resampler->up - resampler->delay;
+    int64_t end = last * resampler->down / resampler->up - resampler->delay
+        + resampler->taps;
+    float *input = malloc((end - start) * sizeof(float));
+
+    for (int channel = 0; channel < clip->channels; ++channel) {
+        load_input(clip, channel, start, end - start, input);
+        for (int i = 0; i < frames; ++i) {
+            int64_t position = (first + i) * resampler->down;
+            int64_t frame = position / resampler->up;
+            int phase = position % resampler->up;
+            output[i * clip->channels + channel] = mixer_dot(
+                resampler->filters + (size_t)phase * resampler->taps,
+                input + (frame - resampler->delay - start),
+                resampler->taps);
+        }
+    }
+
+    free(input);
+}
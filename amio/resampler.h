@@ -0,0 +1,74 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct AudioClip;
+
+/* Zero crossings of the sinc on either side of the center of the filter */
+#define RESAMPLER_ZERO_CROSSINGS 16
+
+/*
+ * Largest number of filter phases, i.e. the numerator of the reduced ratio
+ * of the frame rates. It's at most 640 for the common frame rates.
+ */
+#define RESAMPLER_MAX_PHASES 4096
+
+/*
+ * A polyphase windowed-sinc resampler, converting between frame rates whose
+ * ratio, reduced to up / down, has at most RESAMPLER_MAX_PHASES in the
+ * numerator. Output frame n lies at input position n * down / up, and
+ * is computed with the filter of phase (n * down) % up from the input frames
+ * around it. The filters are Kaiser-windowed sincs, with the cutoff below
+ * the Nyquist frequency of the lower of the rates.
+ *
+ * The resampler has no state besides the filters, so any range of output
+ * frames can be computed on its own, e.g. by several threads at once.
+ */
+struct Resampler
+{
+    int up;
+    int down;
+
+    /* Length of the filter of every phase, a multiple of 8 */
+    int taps;
+
+    /*
+     * Number of input frames before the one at or before the position
+     * of an output frame, where its filter starts
+     */
+    int delay;
+
+    /* Filters of all the phases, one after another */
+    float *filters;
+};
+
+/* API for C code */
+
+/*
+ * Prepare a resampler from one frame rate to the other. Returns false
+ * if the rates aren't whole numbers or their ratio needs too many phases.
+ */
+bool resampler_create(
+    struct Resampler *resampler, float from_rate, float to_rate);
+
+void resampler_destroy(struct Resampler *resampler);
+
+/* Number of output frames for the given number of input frames */
+int64_t resampler_output_length(
+    const struct Resampler *resampler, int64_t input_length);
+
+/*
+ * Compute output frames [first, first + frames) from all the channels
+ * of the clip, channel-interleaved. The clip must be in memory.
+ * Frames before and after the clip are taken as silence.
+ */
+void resampler_process_clip(
+    const struct Resampler *resampler,
+    const struct AudioClip *clip,
+    int64_t first,
+    int frames,
+    float *output);
+
+#endif
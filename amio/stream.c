@@ -0,0 +1,495 @@
+#include "stream.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_clip.h"
+#include "interface.h"
+#include "render_list.h"
+
+/* How often the reader checks the playback positions */
+#define STREAM_READER_INTERVAL_NS 10000000
+
+/*
+ * A periodic region repeated more times than this within the prefetched
+ * range is loaded as a whole instead of repetition by repetition
+ */
+#define STREAM_MAX_REPETITIONS 16
+
+/* A region of a streaming clip that a playspec plays */
+struct StreamRegion
+{
+    struct ClipStream *stream;
+    struct ClipRegion region;
+
+    /*
+     * Playspec frame from which to prefetch, or -1 to follow
+     * the playback position of the interface
+     */
+    int prefetch_from;
+};
+
+struct StreamDemand
+{
+    /* NULL if there is no interface with this key */
+    struct Interface *interface;
+
+    int num_regions;
+    struct StreamRegion *regions;
+};
+
+/* A block evicted by the reader, and the periods it may still be used in */
+struct RetiredBlock
+{
+    struct ClipData *data;
+    unsigned cycles[MAX_INTERFACES];
+    struct RetiredBlock *next;
+};
+
+/*
+ * Everything below is protected by the mutex. The reader holds it
+ * for a whole pass, including the reads from the files, so the Python
+ * thread can't close a file while it's being read.
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t reader;
+static bool reader_running;
+static bool reader_stopping;
+
+static struct ClipStream *streams;
+static struct StreamDemand demands[MAX_INTERFACES];
+static struct RetiredBlock *retired_blocks;
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0)))
+        --q;
+    return q;
+}
+
+/* Mark the blocks holding clip frames [a, b) as wanted */
+static void want_clip_frames(struct ClipStream *stream, int64_t a, int64_t b)
+{
+    for (int64_t block = a / CLIP_BLOCK_FRAMES;
+            block * CLIP_BLOCK_FRAMES < b; ++block)
+        stream->wanted[block] = true;
+}
+
+/*
+ * Mark the blocks that a region placed at the given playspec frame plays
+ * in playspec frames [from, to)
+ */
+static void want_placement(
+    const struct StreamRegion *r, int64_t start, int64_t from, int64_t to)
+{
+    int64_t a = start > from ? start : from;
+    int64_t b = start + r->region.length;
+    if (b > to)
+        b = to;
+    if (a >= b)
+        return;
+
+    int64_t clip_frame = r->region.clip_frame - start;
+    want_clip_frames(r->stream, clip_frame + a, clip_frame + b);
+}
+
+static void want_region(const struct StreamRegion *r, int position)
+{
+    /* Runs on the stream reader thread */
+
+    int64_t from = r->prefetch_from >= 0 ? r->prefetch_from : position;
+    int64_t to = from + STREAM_PREFETCH_FRAMES;
+    int64_t start = r->region.start;
+    int64_t interval = r->region.repeat_interval;
+
+    if (!interval) {
+        want_placement(r, start, from, to);
+        return;
+    }
+
+    /* Repetitions that overlap the prefetched range */
+    int64_t first = floor_div(from - r->region.length - start, interval) + 1;
+    int64_t last = floor_div(to - 1 - start, interval);
+    if (last - first >= STREAM_MAX_REPETITIONS) {
+        want_clip_frames(
+            r->stream, r->region.clip_frame,
+            r->region.clip_frame + r->region.length);
+        return;
+    }
+
+    for (int64_t k = first; k <= last; ++k)
+        want_placement(r, start + k * interval, from, to);
+}
+
+/* Read a block from the file, filling what's missing with silence */
+static struct ClipData * load_block(struct ClipStream *stream, int block)
+{
+    /* Runs on the stream reader thread */
+
+    struct AudioClip *clip = stream->clip;
+    size_t size =
+        (size_t)audio_clip_block_frames(clip, block)
+        * audio_clip_frame_size(clip);
+    off_t offset = stream->data_offset
+        + (off_t)block * CLIP_BLOCK_FRAMES * audio_clip_frame_size(clip);
+
+    char *bytes = malloc(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(stream->fd, bytes + done, size - done, offset + done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    memset(bytes + done, 0, size - done);
+
+    /* Streamed blocks are private to the clip, not in the clip store */
+    struct ClipData *data = malloc(sizeof(struct ClipData));
+    data->hash = 0;
+    data->size = size;
+    data->bytes = bytes;
+    data->refcount = 1;
+    data->next = NULL;
+    return data;
+}
+
+static void free_block(struct ClipData *data)
+{
+    free(data->bytes);
+    free(data);
+}
+
+static void retire_block(struct ClipData *data)
+{
+    /* Runs on the stream reader thread */
+
+    struct RetiredBlock *retired = malloc(sizeof(struct RetiredBlock));
+    retired->data = data;
+    for (int i = 0; i < MAX_INTERFACES; ++i) {
+        struct Interface *interface = demands[i].interface;
+        retired->cycles[i] = interface
+            ? __atomic_load_n(&interface->stream_cycles, __ATOMIC_SEQ_CST)
+            : 0;
+    }
+    retired->next = retired_blocks;
+    retired_blocks = retired;
+}
+
+/* Whether every interface started a period since the block was evicted */
+static bool can_free(const struct RetiredBlock *retired)
+{
+    for (int i = 0; i < MAX_INTERFACES; ++i) {
+        struct Interface *interface = demands[i].interface;
+        if (interface && __atomic_load_n(
+                &interface->stream_cycles, __ATOMIC_SEQ_CST)
+                == retired->cycles[i])
+            return false;
+    }
+    return true;
+}
+
+static void free_retired_blocks(bool all)
+{
+    struct RetiredBlock **link = &retired_blocks;
+    while (*link) {
+        struct RetiredBlock *retired = *link;
+        if (all || can_free(retired)) {
+            *link = retired->next;
+            free_block(retired->data);
+            free(retired);
+        } else {
+            link = &retired->next;
+        }
+    }
+}
+
+static void prefetch()
+{
+    /* Runs on the stream reader thread */
+
+    for (struct ClipStream *s = streams; s; s = s->next)
+        memset(s->wanted, 0, s->clip->num_blocks * sizeof(bool));
+
+    for (int i = 0; i < MAX_INTERFACES; ++i) {
+        struct StreamDemand *demand = &demands[i];
+        if (!demand->interface)
+            continue;
+        int position = __atomic_load_n(
+            &demand->interface->stream_position, __ATOMIC_RELAXED);
+        for (int j = 0; j < demand->num_regions; ++j)
+            want_region(&demand->regions[j], position);
+    }
+
+    for (struct ClipStream *s = streams; s; s = s->next) {
+        struct ClipData **blocks = s->clip->blocks;
+        for (int block = 0; block < s->clip->num_blocks; ++block) {
+            struct ClipData *data = blocks[block];
+            if (s->wanted[block] && !data) {
+                __atomic_store_n(
+                    &blocks[block], load_block(s, block), __ATOMIC_RELEASE);
+            } else if (!s->wanted[block] && data) {
+                __atomic_store_n(&blocks[block], NULL, __ATOMIC_SEQ_CST);
+                retire_block(data);
+            }
+        }
+    }
+}
+
+static void * reader_main(void *arg)
+{
+    /* Runs on the stream reader thread */
+
+    (void)arg;
+
+    pthread_mutex_lock(&mutex);
+    while (!reader_stopping) {
+        prefetch();
+        free_retired_blocks(false);
+
+        /* The Python thread doesn't have to wait for these reads */
+        pthread_mutex_unlock(&mutex);
+        clip_store_read_requested();
+        pthread_mutex_lock(&mutex);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += STREAM_READER_INTERVAL_NS;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            ++deadline.tv_sec;
+        }
+        pthread_cond_timedwait(&wakeup, &mutex, &deadline);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    /* Spilled data requested while the reader was being stopped */
+    clip_store_read_requested();
+    return NULL;
+}
+
+static void start_reader()
+{
+    /* Runs on the Python thread, with the mutex held */
+
+    if (!reader_running) {
+        reader_stopping = false;
+        reader_running =
+            pthread_create(&reader, NULL, reader_main, NULL) == 0;
+    }
+}
+
+bool stream_open(struct AudioClip *clip, const char *path, int64_t data_offset)
+{
+    /* Runs on the Python thread */
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct ClipStream *stream = malloc(sizeof(struct ClipStream));
+    stream->fd = fd;
+    stream->data_offset = data_offset;
+    stream->clip = clip;
+    stream->wanted = calloc(clip->num_blocks, sizeof(bool));
+    stream->underruns = 0;
+    clip->stream = stream;
+
+    pthread_mutex_lock(&mutex);
+    stream->next = streams;
+    streams = stream;
+    start_reader();
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+/* Remove the regions of the stream from the demand of an interface */
+static void forget_stream(struct StreamDemand *demand, struct ClipStream *stream)
+{
+    int n = 0;
+    for (int i = 0; i < demand->num_regions; ++i) {
+        if (demand->regions[i].stream != stream)
+            demand->regions[n++] = demand->regions[i];
+    }
+    demand->num_regions = n;
+}
+
+void stream_close(struct AudioClip *clip)
+{
+    /* Runs on the Python thread */
+
+    struct ClipStream *stream = clip->stream;
+
+    pthread_mutex_lock(&mutex);
+    struct ClipStream **link = &streams;
+    while (*link != stream)
+        link = &(*link)->next;
+    *link = stream->next;
+    for (int i = 0; i < MAX_INTERFACES; ++i)
+        forget_stream(&demands[i], stream);
+
+    bool stop_reader = !streams && reader_running;
+    if (stop_reader) {
+        reader_stopping = true;
+        pthread_cond_signal(&wakeup);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (stop_reader) {
+        pthread_join(reader, NULL);
+        reader_running = false;
+
+        /* No streaming clip is left for the I/O thread to use */
+        free_retired_blocks(true);
+    }
+
+    for (int i = 0; i < clip->num_blocks; ++i) {
+        if (clip->blocks[i])
+            free_block(clip->blocks[i]);
+    }
+    close(stream->fd);
+    free(stream->wanted);
+    free(stream);
+    clip->stream = NULL;
+}
+
+struct DemandBuilder
+{
+    int num_regions;
+    int capacity;
+    struct StreamRegion *regions;
+};
+
+static void add_demand(
+    struct DemandBuilder *builder,
+    const struct PlayspecEntry *entry,
+    int prefetch_from)
+{
+    struct AudioClip *clip = get_audio_clip_by_id(entry->audio_clip_id);
+    if (!clip || !clip->stream)
+        return;
+
+    struct ClipRegion region;
+    if (!render_list_entry_region(entry, clip, &region))
+        return;
+
+    if (builder->num_regions == builder->capacity) {
+        builder->capacity = builder->capacity ? 2 * builder->capacity : 16;
+        builder->regions = realloc(
+            builder->regions,
+            builder->capacity * sizeof(struct StreamRegion));
+    }
+
+    struct StreamRegion *r = &builder->regions[builder->num_regions++];
+    r->stream = clip->stream;
+    r->region = region;
+    r->prefetch_from = prefetch_from;
+}
+
+static void add_playspec_demand(
+    struct DemandBuilder *builder,
+    const struct Playspec *playspec,
+    int prefetch_from)
+{
+    if (!playspec)
+        return;
+
+    for (int i = 0; i < playspec->num_entries; ++i)
+        add_demand(builder, &playspec->entries[i], prefetch_from);
+}
+
+void stream_update_demand(struct Interface *interface)
+{
+    /* Runs on the Python thread */
+
+    int key = iface_get_key(interface->id);
+
+    /*
+     * Nothing to do if there are no streaming clips. The list of streams
+     * is only modified on the Python thread.
+     */
+    if (!streams && !demands[key].num_regions)
+        return;
+
+    struct DemandBuilder builder = {0, 0, NULL};
+
+    add_playspec_demand(&builder, interface->py_thread_current_playspec, -1);
+
+    /* Entries replaced by the pending patch are played until it's applied */
+    struct PlayspecPatch *patch = interface->py_thread_pending_patch;
+    if (patch) {
+        for (int i = 0; i < patch->num_patched_entries; ++i) {
+            struct PatchedEntry *patched = &patch->patched_entries[i];
+            if (!patched->added)
+                add_demand(&builder, &patched->entry, -1);
+        }
+    }
+
+    /* Scheduled playspecs are prefetched from where they start playing */
+    struct PlayspecQueue *scheduled = &interface->py_thread_scheduled_playspecs;
+    for (int i = 0; i < scheduled->count; ++i) {
+        struct Playspec *playspec = playspec_queue_at(scheduled, i);
+        add_playspec_demand(&builder, playspec, playspec->start_from);
+    }
+
+    pthread_mutex_lock(&mutex);
+    struct StreamRegion *old_regions = demands[key].regions;
+    demands[key].num_regions = builder.num_regions;
+    demands[key].regions = builder.regions;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&mutex);
+
+    free(old_regions);
+}
+
+void stream_add_interface(struct Interface *interface)
+{
+    /* Runs on the Python thread */
+
+    pthread_mutex_lock(&mutex);
+    demands[iface_get_key(interface->id)].interface = interface;
+    pthread_mutex_unlock(&mutex);
+}
+
+void stream_forget_interface(struct Interface *interface)
+{
+    /* Runs on the Python thread */
+
+    int key = iface_get_key(interface->id);
+
+    pthread_mutex_lock(&mutex);
+    struct StreamRegion *old_regions = demands[key].regions;
+    demands[key].interface = NULL;
+    demands[key].num_regions = 0;
+    demands[key].regions = NULL;
+    pthread_mutex_unlock(&mutex);
+
+    free(old_regions);
+}
+
+void stream_wake_reader()
+{
+    /* Runs on the Python thread */
+
+    pthread_mutex_lock(&mutex);
+    start_reader();
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&mutex);
+}
+
+void stream_report_underrun(
+    struct Interface *interface, const struct AudioClip *clip)
+{
+    /* Runs on the I/O thread */
+
+    __atomic_add_fetch(&interface->stream_underruns, 1, __ATOMIC_RELAXED);
+
+    /* Clips held in memory may be waiting for spilled data */
+    if (clip->stream)
+        __atomic_add_fetch(&clip->stream->underruns, 1, __ATOMIC_RELAXED);
+}
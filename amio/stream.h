@@ -0,0 +1,87 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct AudioClip;
+struct Interface;
+
+/*
+ * Number of frames ahead of the playback position that the blocks
+ * of streaming clips are loaded
+ */
+#define STREAM_PREFETCH_FRAMES (2 * CLIP_BLOCK_FRAMES)
+
+/*
+ * Streaming clips are backed by a file of raw samples instead of memory.
+ * A dedicated reader thread loads the blocks of the clips that the playspecs
+ * of the interfaces will play within STREAM_PREFETCH_FRAMES, and evicts
+ * the rest, so the I/O thread never touches the disk. The reader publishes
+ * a loaded block by storing it in the block table of the clip, and the I/O
+ * thread plays silence and counts an underrun if it finds a block
+ * that isn't loaded.
+ *
+ * Evicted blocks aren't freed until every interface has started a new
+ * period, since the I/O thread may still be mixing them.
+ *
+ * The reader also reads spilled clip data back into memory when it's asked
+ * to (see clip_store_request_page_in).
+ */
+struct ClipStream
+{
+    int fd;
+
+    /* Position of the first sample in the file, in bytes */
+    int64_t data_offset;
+
+    struct AudioClip *clip;
+
+    /* Blocks wanted in the current pass of the reader */
+    bool *wanted;
+
+    /* Number of times a block of the clip wasn't loaded in time */
+    int underruns;
+
+    struct ClipStream *next;
+};
+
+/* API for C code */
+
+/*
+ * Open the file backing the clip, whose samples start at the given offset.
+ * The blocks of the clip stay NULL until the reader loads them. Returns false
+ * if the file can't be opened.
+ */
+bool stream_open(struct AudioClip *clip, const char *path, int64_t data_offset);
+
+/*
+ * Close the file of the clip and free its loaded blocks. The I/O thread
+ * must no longer be able to use the clip.
+ */
+void stream_close(struct AudioClip *clip);
+
+/*
+ * Tell the reader which regions of streaming clips the playspecs set on
+ * the interface will play. Called whenever they change on the Python thread.
+ */
+void stream_update_demand(struct Interface *interface);
+
+/*
+ * Register a new interface, or forget it before it's closed. Evicted blocks
+ * are freed when every registered interface has started a new period.
+ */
+void stream_add_interface(struct Interface *interface);
+void stream_forget_interface(struct Interface *interface);
+
+/*
+ * Start the reader thread if it's not running, and have it read back
+ * the spilled clip data requested so far
+ */
+void stream_wake_reader();
+
+/* Count a block of the clip that wasn't loaded or read back in time */
+void stream_report_underrun(
+    struct Interface *interface, const struct AudioClip *clip);
+
+#endif
@@ -0,0 +1,77 @@
+#include "transport.h"
+
+#include "interface.h"
+
+void transport_init(struct PublishedTransport *transport)
+{
+    /* Runs on the Python thread */
+
+    transport->sequence = 0;
+    transport->snapshot.period = 0;
+    transport->snapshot.frame_rate = -1;
+    transport->snapshot.position = -1;
+    transport->snapshot.is_transport_rolling = 0;
+    transport->snapshot.playspec_id = -1;
+}
+
+void transport_publish(
+    struct PublishedTransport *transport,
+    const struct TransportSnapshot *snapshot)
+{
+    /* Runs on the I/O thread */
+
+    struct TransportSnapshot *dst = &transport->snapshot;
+    unsigned sequence = transport->sequence;
+
+    /* The odd sequence number must be visible before any of the fields */
+    __atomic_store_n(&transport->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&dst->period, snapshot->period, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->frame_rate, snapshot->frame_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->position, snapshot->position, __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &dst->is_transport_rolling, snapshot->is_transport_rolling,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &dst->playspec_id, snapshot->playspec_id, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&transport->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void transport_read(
+    const struct PublishedTransport *transport,
+    struct TransportSnapshot *snapshot)
+{
+    /* Runs on any thread */
+
+    const struct TransportSnapshot *src = &transport->snapshot;
+    unsigned before, after;
+    do {
+        before = __atomic_load_n(&transport->sequence, __ATOMIC_ACQUIRE);
+        snapshot->period = __atomic_load_n(&src->period, __ATOMIC_RELAXED);
+        snapshot->frame_rate =
+            __atomic_load_n(&src->frame_rate, __ATOMIC_RELAXED);
+        snapshot->position = __atomic_load_n(&src->position, __ATOMIC_RELAXED);
+        snapshot->is_transport_rolling =
+            __atomic_load_n(&src->is_transport_rolling, __ATOMIC_RELAXED);
+        snapshot->playspec_id =
+            __atomic_load_n(&src->playspec_id, __ATOMIC_RELAXED);
+
+        /* The fields must be read before the sequence number is checked */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&transport->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+bool iface_get_transport_snapshot(int interface_id, char *bytearray, int n)
+{
+    /* Runs on the Python thread */
+
+    struct Interface *interface = get_interface_by_id(interface_id);
+    if (!interface || n < (int)sizeof(struct TransportSnapshot))
+        return false;
+
+    transport_read(&interface->transport, (struct TransportSnapshot *)bytearray);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * State of the transport at the start of a period.
+ * Matches TRANSPORT_SNAPSHOT_DTYPE in native_interface.py.
+ */
+struct TransportSnapshot
+{
+    /* Number of periods started so far, including this one */
+    int64_t period;
+
+    int frame_rate;
+    int position;
+    int is_transport_rolling;
+    int playspec_id;
+};
+
+/*
+ * The I/O thread publishes a snapshot once per period, and any thread may
+ * read the latest one at any time. The snapshot is guarded by a sequence
+ * lock: the sequence number is odd while it's being written, and readers
+ * retry until they read the same even number before and after the snapshot.
+ * The writer never waits, and it holds the lock for a few stores only.
+ */
+struct PublishedTransport
+{
+    unsigned sequence;
+    struct TransportSnapshot snapshot;
+};
+
+/* API for Python code */
+
+/*
+ * Fill the bytearray with the latest struct TransportSnapshot. Returns
+ * false if there is no such interface or the bytearray is too small.
+ */
+bool iface_get_transport_snapshot(int interface_id, char *bytearray, int n);
+
+/* API for C code */
+
+void transport_init(struct PublishedTransport *transport);
+
+/* Runs on the I/O thread */
+void transport_publish(
+    struct PublishedTransport *transport,
+    const struct TransportSnapshot *snapshot);
+
+/* Runs on any thread */
+void transport_read(
+    const struct PublishedTransport *transport,
+    struct TransportSnapshot *snapshot);
+
+#endif
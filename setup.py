@@ -37,17 +37,26 @@ native_module = Extension(
     sources=[
         "amio/native.i",
         "amio/audio_clip.c",
+        "amio/capture.c",
+        "amio/clip_store.c",
         "amio/communication.c",
+        "amio/event_log.c",
         "amio/gc.c",
-        "amio/input_chunk.c",
         "amio/interface.c",
         "amio/jack_driver.c",
         "amio/mixer.c",
+        "amio/overview.c",
+        "amio/param_table.c",
         "amio/playspec.c",
+        "amio/playspec_patch.c",
         "amio/pool.c",
+        "amio/render_list.c",
+        "amio/resampler.c",
+        "amio/stream.c",
+        "amio/transport.c",
         "amio/pa_ringbuffer.c",
     ],
-    libraries=["jack"],
+    libraries=["jack", "m", "pthread"],
     extra_compile_args=extra_compile_args,
     undef_macros=undef_macros,
 )
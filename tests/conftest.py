@@ -0,0 +1,22 @@
+from amio import SAMPLE_FORMAT_FLOAT32
+from amio.audio_clip import ImmutableAudioClip
+import pytest
+
+
+class NoInterface:
+    """Stands in for the interface of native clips that are never played"""
+
+    jack_interface = -1
+
+
+@pytest.fixture
+def upload():
+    """Upload a float NumPy array as a native float32 clip"""
+
+    def upload(array, frame_rate=48000):
+        array = array.reshape(len(array), -1)
+        return ImmutableAudioClip(
+            NoInterface(), array, array.shape[1], frame_rate, SAMPLE_FORMAT_FLOAT32
+        )
+
+    return upload
@@ -1,5 +1,18 @@
-from amio import AudioClip
+from amio import (
+    AudioClip,
+    SAMPLE_FORMAT_FLOAT32,
+    SAMPLE_FORMAT_INT16,
+    SAMPLE_FORMAT_INT24,
+    get_clip_store_stats,
+    set_clip_memory_budget,
+)
+from amio.audio_clip import _native_float_samples, read_wav_layout
+import amio._native
+import amio.native_interface
+from amio.native_interface import NativeInterface
 import numpy as np
+import pytest
+import soundfile as sf
 
 
 def test_mono_audio_clip_basic_properties_1():
@@ -69,3 +82,225 @@ def test_sine_2():
     assert clip.frame_rate == 48000
     assert clip.channels == 2
     assert len(clip) == 48000
+
+
+def test_metering_data_of_fragments():
+    rng = np.random.default_rng(1)
+    array = rng.uniform(-0.5, 0.5, (10007, 2))
+    array[2000:4000] = 0.0
+    clip = AudioClip(array, 48000)
+    num_fragments, rms, peak = clip.create_metering_data(24)
+    fragments = np.array_split(array, num_fragments)
+    assert num_fragments == len(fragments) == 5
+    for i, fragment in enumerate(fragments):
+        expected_rms = 20 * np.log10(np.sqrt(np.mean(fragment ** 2)))
+        expected_peak = 20 * np.log10(np.max(np.abs(fragment)))
+        assert rms[i] == int(expected_rms)
+        assert peak[i] == int(expected_peak)
+    assert rms.dtype == peak.dtype == np.int8
+
+
+def test_metering_data_of_silence():
+    clip = AudioClip(np.zeros((4000, 1)), 48000)
+    num_fragments, rms, peak = clip.create_metering_data(24)
+    assert num_fragments == 2
+    assert list(rms) == list(peak) == [-127, -127]
+
+
+def test_native_float_samples_are_not_copied_if_contiguous():
+    array = np.zeros((100, 2), np.float32)
+    assert _native_float_samples(array) is array
+
+
+def test_native_float_samples_of_a_channel_view():
+    array = np.arange(200, dtype=np.float64).reshape((100, 2))
+    samples = _native_float_samples(AudioClip(array, 48000).channel(1).array)
+    assert samples.flags.c_contiguous
+    assert samples.dtype == np.float64
+    assert list(samples[:3, 0]) == [1.0, 3.0, 5.0]
+
+
+def test_native_float_samples_in_native_byte_order():
+    array = np.zeros(100, np.dtype(">f4"))
+    assert _native_float_samples(array).dtype == np.float32
+    assert _native_float_samples(np.zeros(100, np.float16)).dtype == np.float32
+
+
+def test_immutable_clip_is_cached_only_if_not_writeable():
+    clip = AudioClip.zeros(100, 2, 48000)
+    interface, native_clip = object(), object()
+    clip.cache_immutable_clip(interface, native_clip)
+    assert clip.get_cached_immutable_clip(interface) is None
+    clip.writeable = False
+    clip.cache_immutable_clip(interface, native_clip)
+    assert clip.get_cached_immutable_clip(interface) is native_clip
+    assert clip.get_cached_immutable_clip(object()) is None
+    clip.writeable = True
+    assert clip.get_cached_immutable_clip(interface) is None
+
+
+def test_changing_native_format_invalidates_cached_immutable_clip():
+    clip = AudioClip.zeros(100, 2, 48000)
+    clip.writeable = False
+    interface, native_clip = object(), object()
+    clip.cache_immutable_clip(interface, native_clip)
+    clip.native_format = SAMPLE_FORMAT_INT16
+    assert clip.get_cached_immutable_clip(interface) is native_clip
+    clip.native_format = SAMPLE_FORMAT_FLOAT32
+    assert clip.get_cached_immutable_clip(interface) is None
+    with pytest.raises(ValueError):
+        clip.native_format = 3
+
+
+def test_overwrite_updates_uploaded_clips_if_not_writeable():
+    class UploadedClip:
+        def updated(self, frame, data):
+            self.update = (frame, data.copy())
+            return self
+
+    clip = AudioClip.zeros(100, 2, 48000)
+    clip.writeable = False
+    interface, uploaded = object(), UploadedClip()
+    clip.cache_immutable_clip(interface, uploaded)
+    clip.overwrite(AudioClip(np.ones((10, 2)), 48000), 95)
+    assert not clip.writeable
+    assert clip.get_cached_immutable_clip(interface) is uploaded
+    assert uploaded.update[0] == 95
+    assert uploaded.update[1].shape == (5, 2)
+    assert clip.array[94, 0] == 0.0 and clip.array[95, 0] == 1.0
+
+
+def test_overwrite_drops_uploaded_clips_if_resampled(monkeypatch):
+    class UploadedClip:
+        def __init__(self, interface, data, channels, frame_rate, sample_format):
+            self.frame_rate = frame_rate
+
+        def resampled(self, frame_rate):
+            self.frame_rate = frame_rate
+            return self
+
+        def updated(self, frame, data):
+            raise AssertionError("A resampled clip can't be updated")
+
+    class Interface:
+        def get_frame_rate(self):
+            return 48000
+
+    monkeypatch.setattr(amio.native_interface, "ImmutableAudioClip", UploadedClip)
+    clip = AudioClip.zeros(100, 2, 44100)
+    clip.writeable = False
+    interface = Interface()
+    uploaded = NativeInterface.generate_immutable_clip(interface, clip)
+    assert uploaded.frame_rate == 48000
+    assert clip.get_cached_immutable_clip(interface) is uploaded
+    clip.overwrite(AudioClip(np.ones((10, 2)), 44100), 50)
+    assert clip.get_cached_immutable_clip(interface) is None
+    assert clip.array[50, 0] == 1.0
+    assert NativeInterface.generate_immutable_clip(interface, clip) is not uploaded
+
+
+def test_overwrite_cannot_extend_clip_if_not_writeable():
+    clip = AudioClip.zeros(100, 2, 48000)
+    clip.writeable = False
+    with pytest.raises(ValueError):
+        clip.overwrite(AudioClip(np.ones((10, 2)), 48000), 95, extend_to_fit=True)
+    assert len(clip) == 100
+    assert not clip.array.any()
+    clip.overwrite(AudioClip(np.ones((10, 2)), 48000), 90, extend_to_fit=True)
+    assert clip.array[90:, 0].all()
+
+
+@pytest.mark.parametrize(
+    "subtype, sample_format, sample_size",
+    [
+        ("PCM_16", SAMPLE_FORMAT_INT16, 2),
+        ("PCM_24", SAMPLE_FORMAT_INT24, 3),
+        ("FLOAT", SAMPLE_FORMAT_FLOAT32, 4),
+    ],
+)
+def test_read_wav_layout(tmp_path, subtype, sample_format, sample_size):
+    filename = str(tmp_path / "clip.wav")
+    sf.write(filename, np.zeros((1000, 2)), 48000, subtype=subtype)
+    layout = read_wav_layout(filename)
+    assert layout.frames == 1000
+    assert layout.channels == 2
+    assert layout.frame_rate == 48000
+    assert layout.sample_format == sample_format
+    with open(filename, "rb") as f:
+        assert len(f.read()) >= layout.data_offset + 1000 * 2 * sample_size
+
+
+def test_read_wav_layout_rejects_unsupported_formats(tmp_path):
+    filename = str(tmp_path / "clip.wav")
+    sf.write(filename, np.zeros((1000, 2)), 48000, subtype="PCM_U8")
+    with pytest.raises(ValueError):
+        read_wav_layout(filename)
+
+
+def test_deleting_a_missing_native_clip_is_ignored():
+    # Clips are looked up by ids of -1 and other ids that were never given out
+    amio._native.AudioClip_del(-1, -1)
+    amio._native.AudioClip_del(-1, -1025)
+
+
+def test_identical_native_clips_share_data(upload):
+    array = np.random.default_rng(14).uniform(-1, 1, (100000, 2))
+    before = get_clip_store_stats()
+    first = upload(array)
+    assert first.data_size == 100000 * 2 * 4
+    assert first.shared_data_size == 0
+    second = upload(array)
+    after = get_clip_store_stats()
+    assert first.shared_data_size == second.shared_data_size == first.data_size
+    assert after.num_clips == before.num_clips + 2
+    assert after.clip_bytes == before.clip_bytes + 2 * first.data_size
+    assert after.stored_bytes == before.stored_bytes + first.data_size
+
+
+def test_native_clips_are_created_after_many_were_removed(upload):
+    # A streaming clip is removed right away if its file doesn't open
+    for _ in range(3000):
+        clip_id = amio._native.AudioClip_init_streaming(
+            "/nonexistent.raw", 0, 100, 1, 48000, SAMPLE_FORMAT_FLOAT32
+        )
+        assert clip_id == -1
+    clips = [upload(np.full(100, i / 10)) for i in range(10)]
+    assert all(clip.data_size == 100 * 4 for clip in clips)
+
+
+def test_clip_memory_budget_spills_unused_clips(upload, tmp_path):
+    clip = upload(np.random.default_rng(17).uniform(-1, 1, 4 * 65536))
+    assert clip.resident_data_size == clip.data_size
+    try:
+        set_clip_memory_budget(1, str(tmp_path))
+        assert clip.resident_data_size == 0
+        stats = get_clip_store_stats()
+        assert stats.num_spilled_buffers >= 4
+        assert stats.spilled_bytes >= clip.data_size
+        set_clip_memory_budget(None)
+        # Only the block copied by the partial update is read back
+        clip.updated(10, np.zeros((10, 1)))
+        assert clip.resident_data_size == 65536 * 4
+    finally:
+        set_clip_memory_budget(None)
+
+
+def test_silent_frames_count_silent_granules(upload):
+    array = np.zeros(10 * 256)
+    array[300] = 0.5
+    assert upload(array).silent_frames == 9 * 256
+    assert upload(np.zeros(1000)).silent_frames == 1000
+
+
+@pytest.mark.parametrize("source_rate, target_rate", [(44100, 48000), (48000, 44100)])
+def test_resampled_sine_is_accurate(upload, source_rate, target_rate):
+    frames = np.arange(20000)
+    sine = 0.5 * np.sin(2 * np.pi * 1000 * frames / source_rate)
+    clip = upload(sine, source_rate).resampled(target_rate)
+    # Frame by frame, the smallest sample of a mono clip is the sample itself
+    samples = clip.get_overview(1)["min"]
+    assert abs(len(samples) - len(frames) * target_rate / source_rate) < 1
+    ideal = 0.5 * np.sin(2 * np.pi * 1000 * np.arange(len(samples)) / target_rate)
+    # The filter has no signal to work with near the ends
+    error = np.abs(samples - ideal)[400:-400].max()
+    assert 20 * np.log10(error / 0.5) < -80
@@ -0,0 +1,175 @@
+from amio import Fader, NativeInterface, NullInterface, PlayspecPatch
+import amio._native
+from amio.native_interface import CAPTURE_SPAN_DTYPE
+import numpy as np
+import pytest
+
+
+def test_playspec_changes_are_applied_in_order():
+    interface = NullInterface(48000)
+    applied = []
+    interface.schedule_playspec_change([], 0, 0, lambda used: applied.append(1))
+    patch = PlayspecPatch()
+    patch.remove(0)
+    interface.schedule_playspec_patch(patch, 0, lambda used: applied.append(2))
+    interface.advance_single_chunk_length()
+    assert applied == [1, 2]
+
+
+class RecordingInterface(NullInterface):
+    def __init__(self):
+        super().__init__(48000)
+        self.param_slots = {}
+
+    def set_param_slot(self, slot, gain_l, gain_r, mute=False, solo=False):
+        self.param_slots[slot] = (gain_l, gain_r, mute, solo)
+
+
+def test_attached_fader_writes_param_slot():
+    interface = RecordingInterface()
+    fader = Fader(pan=0.5)
+    fader.attach(interface, 3)
+    assert interface.param_slots[3] == (0.5, 1.5, False, False)
+    fader.mute = True
+    assert interface.param_slots[3] == (0.5, 1.5, True, False)
+
+
+def test_transport_snapshot_follows_periods():
+    interface = NullInterface(48000)
+    interface.set_transport_rolling(True)
+    interface.advance_single_chunk_length()
+    interface.advance_single_chunk_length()
+    snapshot = interface.get_transport_snapshot()
+    assert snapshot.period == 2
+    assert snapshot.frame_rate == 48000
+    assert snapshot.position == 2 * NullInterface.chunk_length
+    assert snapshot.is_transport_rolling
+
+
+class TransactionNative:
+    """Stands in for the native transaction functions of an interface"""
+
+    def __init__(self, queue_size):
+        self.queue_size = queue_size
+        self.staged = []
+        self.failed = False
+        self.committed = []
+
+    def iface_begin_transaction(self, interface):
+        self.staged = []
+        self.failed = False
+        return True
+
+    def iface_set_position(self, interface, position):
+        if len(self.staged) < self.queue_size:
+            self.staged.append(position)
+        else:
+            self.failed = True
+
+    def iface_commit_transaction(self, interface):
+        if self.failed:
+            return -1
+        self.committed += self.staged
+        return len(self.staged)
+
+    def iface_abort_transaction(self, interface):
+        self.staged = []
+
+
+@pytest.fixture
+def native(monkeypatch):
+    def install(queue_size):
+        fake = TransactionNative(queue_size)
+        for name in dir(fake):
+            if name.startswith("iface_"):
+                monkeypatch.setattr(amio._native, name, getattr(fake, name), False)
+        interface = NativeInterface(capture_frames=1)
+        interface.jack_interface = 0
+        interface.message_task = object()
+        return fake, interface
+
+    return install
+
+
+def test_transaction_is_discarded_if_it_does_not_fit(native):
+    fake, interface = native(2)
+    submitted = []
+    interface._set_current_playspec = lambda *args: 7
+    with pytest.raises(RuntimeError):
+        with interface.transaction():
+            interface.schedule_playspec_change([], 0, 0, submitted.append)
+            for position in range(3):
+                interface.set_position(position)
+    assert fake.committed == []
+    assert interface._submitted_playspec_callbacks == {}
+    with interface.transaction():
+        interface.set_position(5)
+    assert fake.committed == [5]
+
+
+def test_transaction_raises_if_playspec_change_has_to_wait(native):
+    fake, interface = native(10)
+    interface._set_current_playspec = lambda *args: None
+    with pytest.raises(ValueError):
+        with interface.transaction():
+            interface.set_position(1)
+            interface.schedule_playspec_change([], 0, 0, None)
+    assert fake.committed == []
+    assert not interface._pending_playspecs
+    # Outside of a transaction, the change waits for the previous ones
+    interface.schedule_playspec_change([], 0, 0, None)
+    assert len(interface._pending_playspecs) == 1
+    with pytest.raises(ValueError):
+        with interface.transaction():
+            interface.schedule_playspec_change([], 0, 0, None)
+    assert len(interface._pending_playspecs) == 1
+
+
+class CaptureNative:
+    """Stands in for the I/O thread, capturing periods of input to the ring"""
+
+    def __init__(self, interface):
+        self.interface = interface
+        self.spans = []
+        self.capture_frame = 0
+
+    def capture(self, frames, value):
+        ring = self.interface._capture_ring
+        for i in range(frames):
+            ring[(self.capture_frame + i) % len(ring)] = value
+        self.spans.append((self.capture_frame, frames, 1, self.capture_frame, 1))
+        self.capture_frame += frames
+
+    def iface_drain_capture(self, interface, spans):
+        array = np.array(self.spans, CAPTURE_SPAN_DTYPE)
+        spans[: array.nbytes] = array.tobytes()
+        self.spans = []
+        return len(array)
+
+    def iface_get_frame_rate(self, interface):
+        return 48000
+
+
+@pytest.fixture
+def capture(monkeypatch):
+    interface = NativeInterface(capture_frames=4)
+    interface.jack_interface = 0
+    fake = CaptureNative(interface)
+    for name in dir(fake):
+        if name.startswith("iface_"):
+            monkeypatch.setattr(amio._native, name, getattr(fake, name), False)
+    return fake, interface
+
+
+def test_drained_input_is_kept_across_drains(capture):
+    fake, interface = capture
+    fake.capture(4, 1.0)
+    (kept,) = interface.drain_input()
+    # The frames of the previous drain are overwritten after the next one
+    fake.capture(4, 2.0)
+    (chunk,) = interface.drain_input()
+    assert (kept.array == 1.0).all()
+    assert (chunk.array == 2.0).all()
+    fake.capture(2, 3.0)
+    (view,) = interface.drain_input(copy=False)
+    assert np.shares_memory(view.array, interface._capture_ring)
@@ -0,0 +1,40 @@
+from amio import FADE_CURVE_EQUAL_POWER, FADE_CURVE_LINEAR, PackedPlayspec
+from amio.playspec import PLAYSPEC_ENTRY_DTYPE, PlayspecEntry
+from collections import namedtuple
+
+FakeClip = namedtuple("FakeClip", "io_owned_clip")
+
+
+def test_playspec_entry_dtype_matches_native_layout():
+    assert PLAYSPEC_ENTRY_DTYPE.itemsize == 48
+
+
+def test_packed_playspec_append_grows():
+    playspec = PackedPlayspec(capacity=1)
+    clips = [FakeClip(i) for i in range(5)]
+    for i, clip in enumerate(clips):
+        playspec.append(clip, 0, 100, 1000 * i, gain_l=0.5)
+    assert len(playspec) == 5
+    assert list(playspec.entries["clip_id"]) == [0, 1, 2, 3, 4]
+    assert list(playspec.entries["play_at_frame"]) == [0, 1000, 2000, 3000, 4000]
+    assert all(playspec.entries["gain_l"] == 0.5)
+    assert all(playspec.entries["gain_r"] == 1.0)
+    assert playspec.clips == clips
+
+
+def test_playspec_entry_has_no_fades_by_default():
+    entry = PlayspecEntry(None, 0, 100, 0, 0, 1.0, 1.0)
+    assert entry.fade_in == 0
+    assert entry.fade_out == 0
+    assert entry.fade_in_curve == FADE_CURVE_LINEAR
+
+
+def test_packed_playspec_stores_fades():
+    playspec = PackedPlayspec()
+    playspec.append(
+        FakeClip(7), 0, 1000, 0, fade_in=64, fade_out_curve=FADE_CURVE_EQUAL_POWER
+    )
+    entry = playspec.entries[0]
+    assert entry["fade_in"] == 64
+    assert entry["fade_out"] == 0
+    assert entry["fade_out_curve"] == FADE_CURVE_EQUAL_POWER